@@ -0,0 +1,403 @@
+/*
+
+Copyright (c) Microsoft Corporation.
+Licensed under the MIT License.
+
+benchrun
+
+Runs etl2pcapng on the same input a number of times and reports how fast
+each run was: packets/s, MB/s of input read and output written, CPU time and
+the peak working set of the etl2pcapng process. Packets are counted by
+reading back the output, so the numbers are right whatever the options.
+
+Issues:
+
+-Packets can only be counted in plain pcapng output, so with --compress or
+ --split-size only the MB/s numbers are reported.
+
+-The first run usually reads the input from disk and later ones from the
+ file cache; use the later runs (or more of them) when comparing options.
+
+*/
+
+#define WIN32_LEAN_AND_MEAN 1
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <psapi.h>
+#include <strsafe.h>
+
+#define USAGE \
+"benchrun [options] <infile.etl> [-- <etl2pcapng options>]\n" \
+"Converts infile with etl2pcapng several times and reports the throughput.\n" \
+"\n" \
+"Options:\n" \
+"  --exe <path>           etl2pcapng to run (default: etl2pcapng.exe next\n" \
+"                         to benchrun.exe).\n" \
+"  --runs <n>             Number of conversions (default 5).\n" \
+"  --out <file>           Output file (default <infile>.bench.pcapng,\n" \
+"                         deleted afterwards).\n" \
+"  --verbose              Show the output of etl2pcapng.\n"
+
+#define MAX_RUNS 100
+#define MAX_COMMAND_LINE 32768
+#define READ_BUFFER_SIZE (1024 * 1024)
+
+#define PCAPNG_BLOCKTYPE_SECTION_HEADER 0x0A0D0D0A
+#define PCAPNG_BLOCKTYPE_ENHANCED_PACKET 0x00000006
+
+struct RUN {
+    double Seconds;
+    double CpuSeconds;
+    unsigned long long OutputSize;
+    unsigned long long Packets; // ULLONG_MAX if the output couldn't be read back
+    SIZE_T PeakWorkingSet;
+};
+
+BOOLEAN Verbose = FALSE;
+
+BOOLEAN ParseUlong(wchar_t* Str, unsigned long* Value)
+{
+    wchar_t* End;
+    unsigned long long Parsed = wcstoull(Str, &End, 0);
+
+    if (End == Str || *End != L'\0' || Parsed > ULONG_MAX) {
+        return FALSE;
+    }
+    *Value = (unsigned long)Parsed;
+    return TRUE;
+}
+
+int GetFileSize64(wchar_t* FileName, unsigned long long* Size)
+{
+    WIN32_FILE_ATTRIBUTE_DATA Attributes;
+
+    if (!GetFileAttributesEx(FileName, GetFileExInfoStandard, &Attributes)) {
+        return GetLastError();
+    }
+    *Size = ((unsigned long long)Attributes.nFileSizeHigh << 32) | Attributes.nFileSizeLow;
+    return NO_ERROR;
+}
+
+// Counts the enhanced packet blocks in a pcapng file by walking the block
+// headers. Returns ULLONG_MAX if the file isn't uncompressed pcapng.
+unsigned long long CountPackets(wchar_t* FileName)
+{
+    HANDLE File;
+    BYTE* Buffer = NULL;
+    unsigned long long Packets = ULLONG_MAX;
+    unsigned long long Skip = 0; // rest of the current block
+    unsigned long BufferUsed = 0;
+    unsigned long Offset;
+    DWORD BytesRead;
+    DWORD BlockType;
+    DWORD BlockLength;
+    BOOLEAN First = TRUE;
+
+    File = CreateFile(FileName, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (File == INVALID_HANDLE_VALUE) {
+        return ULLONG_MAX;
+    }
+    Buffer = malloc(READ_BUFFER_SIZE);
+    if (Buffer == NULL) {
+        goto Done;
+    }
+
+    for (;;) {
+        if (!ReadFile(File, Buffer + BufferUsed, READ_BUFFER_SIZE - BufferUsed, &BytesRead, NULL)) {
+            Packets = ULLONG_MAX;
+            goto Done;
+        }
+        if (BytesRead == 0) {
+            // A truncated last block means the output is bad.
+            if (BufferUsed != 0 || Skip != 0) {
+                Packets = ULLONG_MAX;
+            }
+            goto Done;
+        }
+        BufferUsed += BytesRead;
+
+        Offset = 0;
+        if (Skip != 0) {
+            Offset = (unsigned long)min(Skip, BufferUsed);
+            Skip -= Offset;
+        }
+        while (BufferUsed - Offset >= 2 * sizeof(DWORD)) {
+            BlockType = *(DWORD*)(Buffer + Offset);
+            BlockLength = *(DWORD*)(Buffer + Offset + sizeof(DWORD));
+            if (First) {
+                if (BlockType != PCAPNG_BLOCKTYPE_SECTION_HEADER) {
+                    goto Done;
+                }
+                First = FALSE;
+                Packets = 0;
+            }
+            if (BlockLength < 3 * sizeof(DWORD) || BlockLength % sizeof(DWORD) != 0) {
+                Packets = ULLONG_MAX;
+                goto Done;
+            }
+            if (BlockType == PCAPNG_BLOCKTYPE_ENHANCED_PACKET) {
+                Packets++;
+            }
+            if (BlockLength > BufferUsed - Offset) {
+                Skip = BlockLength - (BufferUsed - Offset);
+                Offset = BufferUsed;
+                break;
+            }
+            Offset += BlockLength;
+        }
+        memmove(Buffer, Buffer + Offset, BufferUsed - Offset);
+        BufferUsed -= Offset;
+    }
+
+Done:
+    free(Buffer);
+    CloseHandle(File);
+    return Packets;
+}
+
+double FileTimeToSeconds(FILETIME* Time)
+{
+    return (double)(((unsigned long long)Time->dwHighDateTime << 32) | Time->dwLowDateTime) / 10000000;
+}
+
+int RunOnce(wchar_t* CommandLine, wchar_t* OutFileName, struct RUN* Run)
+{
+    int Err = NO_ERROR;
+    wchar_t* CommandLineCopy = NULL;
+    STARTUPINFO StartupInfo = {0};
+    PROCESS_INFORMATION ProcessInfo = {0};
+    PROCESS_MEMORY_COUNTERS Memory = {0};
+    FILETIME Creation, Exit, Kernel, User;
+    LARGE_INTEGER Frequency, Start, End;
+    HANDLE Null = INVALID_HANDLE_VALUE;
+    DWORD ExitCode;
+    size_t Length = wcslen(CommandLine) + 1;
+
+    // CreateProcess may modify the command line.
+    CommandLineCopy = malloc(Length * sizeof(wchar_t));
+    if (CommandLineCopy == NULL) {
+        printf("out of memory\n");
+        return ERROR_NOT_ENOUGH_MEMORY;
+    }
+    memcpy(CommandLineCopy, CommandLine, Length * sizeof(wchar_t));
+
+    StartupInfo.cb = sizeof(StartupInfo);
+    if (!Verbose) {
+        SECURITY_ATTRIBUTES Inherit = {sizeof(Inherit), NULL, TRUE};
+        Null = CreateFile(L"NUL", GENERIC_WRITE, FILE_SHARE_WRITE, &Inherit, OPEN_EXISTING, 0, NULL);
+        if (Null == INVALID_HANDLE_VALUE) {
+            Err = GetLastError();
+            printf("CreateFile(NUL) failed with %u\n", Err);
+            goto Done;
+        }
+        StartupInfo.dwFlags = STARTF_USESTDHANDLES;
+        StartupInfo.hStdInput = GetStdHandle(STD_INPUT_HANDLE);
+        StartupInfo.hStdOutput = Null;
+        StartupInfo.hStdError = Null;
+    }
+
+    DeleteFile(OutFileName);
+
+    QueryPerformanceFrequency(&Frequency);
+    QueryPerformanceCounter(&Start);
+    if (!CreateProcess(NULL, CommandLineCopy, NULL, NULL, !Verbose, 0, NULL, NULL, &StartupInfo, &ProcessInfo)) {
+        Err = GetLastError();
+        printf("CreateProcess failed with %u\n", Err);
+        goto Done;
+    }
+    WaitForSingleObject(ProcessInfo.hProcess, INFINITE);
+    QueryPerformanceCounter(&End);
+
+    if (!GetExitCodeProcess(ProcessInfo.hProcess, &ExitCode) || ExitCode != 0) {
+        printf("etl2pcapng failed with %u\n", ExitCode);
+        Err = ERROR_GEN_FAILURE;
+        goto Done;
+    }
+
+    Run->Seconds = (double)(End.QuadPart - Start.QuadPart) / (double)Frequency.QuadPart;
+    Run->CpuSeconds = 0;
+    if (GetProcessTimes(ProcessInfo.hProcess, &Creation, &Exit, &Kernel, &User)) {
+        Run->CpuSeconds = FileTimeToSeconds(&Kernel) + FileTimeToSeconds(&User);
+    }
+    Run->PeakWorkingSet = 0;
+    Memory.cb = sizeof(Memory);
+    if (GetProcessMemoryInfo(ProcessInfo.hProcess, &Memory, sizeof(Memory))) {
+        Run->PeakWorkingSet = Memory.PeakWorkingSetSize;
+    }
+    Run->OutputSize = 0;
+    GetFileSize64(OutFileName, &Run->OutputSize);
+    Run->Packets = CountPackets(OutFileName);
+
+Done:
+    if (ProcessInfo.hProcess != NULL) {
+        CloseHandle(ProcessInfo.hThread);
+        CloseHandle(ProcessInfo.hProcess);
+    }
+    if (Null != INVALID_HANDLE_VALUE) {
+        CloseHandle(Null);
+    }
+    free(CommandLineCopy);
+    return Err;
+}
+
+void PrintRun(const char* Label, struct RUN* Run, unsigned long long InputSize)
+{
+    printf("%-8s %8.3f s %8.3f s", Label, Run->Seconds, Run->CpuSeconds);
+    if (Run->Packets != ULLONG_MAX) {
+        printf(" %12.0f", (double)Run->Packets / Run->Seconds);
+    } else {
+        printf(" %12s", "n/a");
+    }
+    printf(" %9.1f %9.1f %9.1f\n",
+        (double)InputSize / 1000000 / Run->Seconds,
+        (double)Run->OutputSize / 1000000 / Run->Seconds,
+        (double)Run->PeakWorkingSet / (1024 * 1024));
+}
+
+int __cdecl RunCompareFn(const void* A, const void* B)
+{
+    double a = ((struct RUN*)A)->Seconds;
+    double b = ((struct RUN*)B)->Seconds;
+    return a < b ? -1 : a > b ? 1 : 0;
+}
+
+int __cdecl wmain(int argc, wchar_t** argv)
+{
+    int Err = NO_ERROR;
+    wchar_t Exe[MAX_PATH];
+    wchar_t* ExeArg = NULL;
+    wchar_t* InFileName = NULL;
+    wchar_t* OutFileArg = NULL;
+    wchar_t OutFileName[MAX_PATH];
+    wchar_t* CommandLine = NULL;
+    wchar_t* Slash;
+    unsigned long NumRuns = 5;
+    unsigned long long InputSize;
+    struct RUN* Runs = NULL;
+    unsigned long long Packets = ULLONG_MAX;
+    unsigned long i;
+    int Arg;
+
+    for (Arg = 1; Arg < argc; Arg++) {
+        if (!wcscmp(argv[Arg], L"--")) {
+            Arg++;
+            break;
+        } else if (!wcscmp(argv[Arg], L"--exe")) {
+            if (++Arg == argc) {
+                goto Usage;
+            }
+            ExeArg = argv[Arg];
+        } else if (!wcscmp(argv[Arg], L"--runs")) {
+            if (++Arg == argc || !ParseUlong(argv[Arg], &NumRuns) || NumRuns == 0 || NumRuns > MAX_RUNS) {
+                goto Usage;
+            }
+        } else if (!wcscmp(argv[Arg], L"--out")) {
+            if (++Arg == argc) {
+                goto Usage;
+            }
+            OutFileArg = argv[Arg];
+        } else if (!wcscmp(argv[Arg], L"--verbose")) {
+            Verbose = TRUE;
+        } else if (InFileName == NULL && argv[Arg][0] != L'-') {
+            InFileName = argv[Arg];
+        } else {
+            goto Usage;
+        }
+    }
+    if (InFileName == NULL) {
+        goto Usage;
+    }
+
+    if (ExeArg != NULL) {
+        Err = StringCchCopy(Exe, RTL_NUMBER_OF(Exe), ExeArg);
+    } else {
+        GetModuleFileName(NULL, Exe, RTL_NUMBER_OF(Exe));
+        Slash = wcsrchr(Exe, L'\\');
+        if (Slash != NULL) {
+            *(Slash + 1) = L'\0';
+        }
+        Err = StringCchCat(Exe, RTL_NUMBER_OF(Exe), L"etl2pcapng.exe");
+    }
+    if (Err == NO_ERROR) {
+        Err = OutFileArg != NULL ?
+            StringCchCopy(OutFileName, RTL_NUMBER_OF(OutFileName), OutFileArg) :
+            StringCchPrintf(OutFileName, RTL_NUMBER_OF(OutFileName), L"%s.bench.pcapng", InFileName);
+    }
+    if (Err != NO_ERROR) {
+        printf("File name too long\n");
+        return ERROR_FILENAME_EXCED_RANGE;
+    }
+
+    Err = GetFileSize64(InFileName, &InputSize);
+    if (Err != NO_ERROR) {
+        printf("Can't open %ws (error %u)\n", InFileName, Err);
+        return Err;
+    }
+
+    // "<exe>" <options> "<infile>" "<outfile>"
+    CommandLine = malloc(MAX_COMMAND_LINE * sizeof(wchar_t));
+    Runs = malloc(NumRuns * sizeof(struct RUN));
+    if (CommandLine == NULL || Runs == NULL) {
+        printf("out of memory\n");
+        Err = ERROR_NOT_ENOUGH_MEMORY;
+        goto Done;
+    }
+    Err = StringCchPrintf(CommandLine, MAX_COMMAND_LINE, L"\"%s\"", Exe);
+    for (; Arg < argc && Err == NO_ERROR; Arg++) {
+        Err = StringCchCat(CommandLine, MAX_COMMAND_LINE, L" ");
+        if (Err == NO_ERROR) {
+            Err = StringCchCat(CommandLine, MAX_COMMAND_LINE, argv[Arg]);
+        }
+    }
+    if (Err == NO_ERROR) {
+        Err = StringCchPrintf(
+            CommandLine + wcslen(CommandLine), MAX_COMMAND_LINE - wcslen(CommandLine),
+            L" \"%s\" \"%s\"", InFileName, OutFileName);
+    }
+    if (Err != NO_ERROR) {
+        printf("Command line too long\n");
+        Err = ERROR_FILENAME_EXCED_RANGE;
+        goto Done;
+    }
+
+    printf("%ws\n", CommandLine);
+    printf("input: %.1f MB\n\n", (double)InputSize / 1000000);
+    printf("run        elapsed      cpu    packets/s  in MB/s  out MB/s   peak MB\n");
+
+    for (i = 0; i < NumRuns; i++) {
+        char Label[16];
+
+        Err = RunOnce(CommandLine, OutFileName, &Runs[i]);
+        if (Err != NO_ERROR) {
+            goto Done;
+        }
+        if (i > 0 && Runs[i].Packets != Packets) {
+            printf("WARNING: run %u wrote %llu packets, the run before %llu\n", i + 1, Runs[i].Packets, Packets);
+        }
+        Packets = Runs[i].Packets;
+        StringCchPrintfA(Label, sizeof(Label), "%u", i + 1);
+        PrintRun(Label, &Runs[i], InputSize);
+    }
+
+    if (Packets != ULLONG_MAX) {
+        printf("\n%llu packets per run\n", Packets);
+    }
+    qsort(Runs, NumRuns, sizeof(struct RUN), RunCompareFn);
+    printf("\n");
+    PrintRun("best", &Runs[0], InputSize);
+    PrintRun("median", &Runs[NumRuns / 2], InputSize);
+
+Done:
+    if (OutFileArg == NULL) {
+        DeleteFile(OutFileName);
+    }
+    free(Runs);
+    free(CommandLine);
+    return Err;
+
+Usage:
+    printf(USAGE);
+    return ERROR_INVALID_PARAMETER;
+}
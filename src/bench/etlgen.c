@@ -0,0 +1,484 @@
+/*
+
+Copyright (c) Microsoft Corporation.
+Licensed under the MIT License.
+
+etlgen
+
+Generates a synthetic packet capture in ETL format, with the same events
+ndiscap logs, so that etl2pcapng can be benchmarked on the same input over
+and over. The packets are made up: Ethernet, native 802.11 (each packet
+preceded by a receive metadata event) and VMSwitch packets on a number of
+interfaces, with a range of frame sizes and some packets split over several
+fragment events.
+
+The events are written with our own registration of the ndiscap provider
+GUID into a private in-process session, so the real ndiscap (which would
+start capturing if the provider were enabled in a normal session) never
+sees it. Decoding still uses the ndiscap manifest installed with Windows.
+
+Issues:
+
+-The metadata event carries DOT11_EXTSTA_RECV_CONTEXT, which contains a
+ pointer, so a capture generated by the x86 build only converts cleanly with
+ the x86 etl2pcapng and likewise for x64 (the same is true of real captures).
+
+*/
+
+#define WIN32_LEAN_AND_MEAN 1
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <evntprov.h>
+#include <evntrace.h>
+
+#define USAGE \
+"etlgen [options] <outfile.etl>\n" \
+"Generates a synthetic ndiscap packet capture for benchmarking etl2pcapng.\n" \
+"\n" \
+"Options:\n" \
+"  --packets <n>          Number of packets (default 1000000).\n" \
+"  --interfaces <n>       Interfaces of each media type (default 4).\n" \
+"  --min-size <n>         Smallest frame in bytes (default 60).\n" \
+"  --max-size <n>         Largest frame in bytes (default 1514).\n" \
+"  --wifi <percent>       Share of 802.11 packets, each with a metadata\n" \
+"                         event (default 20).\n" \
+"  --vmswitch <percent>   Share of VMSwitch packets (default 10).\n" \
+"  --fragmented <percent> Share of packets split over several events,\n" \
+"                         up to 9000 bytes each (default 5).\n" \
+"  --seed <n>             Seed for the packet contents and sizes, so the\n" \
+"                         same options give the same capture (default 1).\n"
+
+// From the ndiscap manifest
+#define KW_MEDIA_802_3                  0x1
+#define KW_MEDIA_NATIVE_802_11      0x10000
+#define KW_VMSWITCH               0x1000000
+#define KW_PACKET_START          0x40000000
+#define KW_PACKET_END            0x80000000
+#define KW_SEND                 0x100000000
+#define KW_RECEIVE              0x200000000
+
+#define tidPacketFragment            1001
+#define tidPacketMetadata            1002
+#define tidVMSwitchPacketFragment    1003
+
+// From: https://docs.microsoft.com/en-us/windows-hardware/drivers/ddi/windot11/ns-windot11-dot11_extsta_recv_context
+#pragma pack(push,8)
+typedef struct _NDIS_OBJECT_HEADER {
+    UCHAR  Type;
+    UCHAR  Revision;
+    USHORT Size;
+} NDIS_OBJECT_HEADER, * PNDIS_OBJECT_HEADER;
+
+typedef struct DOT11_EXTSTA_RECV_CONTEXT {
+    NDIS_OBJECT_HEADER Header;
+    ULONG              uReceiveFlags;
+    ULONG              uPhyId;
+    ULONG              uChCenterFrequency;
+    USHORT             usNumberOfMPDUsReceived;
+    LONG               lRSSI;
+    UCHAR              ucDataRate;
+    ULONG              uSizeMediaSpecificInfo;
+    PVOID              pvMediaSpecificInfo;
+    ULONGLONG          ullTimestamp;
+} DOT11_EXTSTA_RECV_CONTEXT, * PDOT11_EXTSTA_RECV_CONTEXT;
+#pragma pack(pop)
+
+#define NDIS_OBJECT_TYPE_DEFAULT 0x80
+
+const GUID NdisCapId = { // Microsoft-Windows-NDIS-PacketCapture {2ED6006E-4729-4609-B423-3EE7BCD678EF}
+    0x2ed6006e, 0x4729, 0x4609, 0xb4, 0x23, 0x3e, 0xe7, 0xbc, 0xd6, 0x78, 0xef};
+
+// IfIndexes of the generated interfaces of each type, so that they are
+// easy to tell apart in the output.
+#define IFINDEX_BASE_ETHERNET 10
+#define IFINDEX_BASE_WIFI     100
+#define IFINDEX_BASE_VMSWITCH 200
+
+#define MAX_FRAME_SIZE 9000
+#define MAX_FRAGMENT_SIZE 1500 // of multi-event packets
+
+#define SESSION_NAME L"etl2pcapng-etlgen"
+
+struct SESSION_PROPERTIES {
+    EVENT_TRACE_PROPERTIES Properties;
+    wchar_t LoggerName[RTL_NUMBER_OF(SESSION_NAME)];
+    wchar_t LogFileName[MAX_PATH];
+};
+
+unsigned long NumPackets = 1000000;
+unsigned long NumInterfaces = 4;
+unsigned long MinSize = 60;
+unsigned long MaxSize = 1514;
+unsigned long WifiPercent = 20;
+unsigned long VmSwitchPercent = 10;
+unsigned long FragmentedPercent = 5;
+unsigned long long Seed = 1;
+
+REGHANDLE Provider;
+
+// xorshift64*: fast, and the same sequence on every machine.
+unsigned long Random(unsigned long Range)
+{
+    Seed ^= Seed >> 12;
+    Seed ^= Seed << 25;
+    Seed ^= Seed >> 27;
+    return (unsigned long)((Seed * 0x2545F4914F6CDD1DULL) >> 32) % Range;
+}
+
+// Minimal IPv4/UDP headers with varying addresses and ports.
+unsigned long WriteIpUdp(BYTE* Buf, unsigned long Length, unsigned long Flow)
+{
+    unsigned long IpLength = Length;
+    unsigned long UdpLength = Length - 20;
+
+    Buf[0] = 0x45;
+    Buf[1] = 0;
+    Buf[2] = (BYTE)(IpLength >> 8);
+    Buf[3] = (BYTE)IpLength;
+    ZeroMemory(Buf + 4, 8);
+    Buf[8] = 128; // TTL
+    Buf[9] = 17;  // UDP
+    Buf[12] = 10;
+    Buf[13] = 0;
+    Buf[14] = (BYTE)(Flow >> 8);
+    Buf[15] = (BYTE)Flow;
+    Buf[16] = 10;
+    Buf[17] = 1;
+    Buf[18] = (BYTE)(Flow >> 4);
+    Buf[19] = 1;
+    Buf[20] = (BYTE)((49152 + Flow % 1000) >> 8);
+    Buf[21] = (BYTE)(49152 + Flow % 1000);
+    Buf[22] = 0x01;
+    Buf[23] = 0xbb; // 443
+    Buf[24] = (BYTE)(UdpLength >> 8);
+    Buf[25] = (BYTE)UdpLength;
+    Buf[26] = 0;
+    Buf[27] = 0;
+    return 28;
+}
+
+// Builds a frame of Length bytes for the given interface type: a link
+// header, IPv4/UDP and a payload that is partly repetitive (like real
+// traffic) and partly random (like encrypted traffic).
+void BuildFrame(BYTE* Frame, unsigned long Length, BOOLEAN Wifi, unsigned long Flow)
+{
+    unsigned long Offset;
+    unsigned long i;
+
+    if (Wifi) {
+        // Native 802.11 data frame, then LLC/SNAP.
+        static const BYTE Header[] = {
+            0x08, 0x01, 0x2c, 0x00,
+            0x00, 0x11, 0x22, 0x33, 0x44, 0x00,
+            0x00, 0x55, 0x66, 0x77, 0x88, 0x00,
+            0x00, 0x11, 0x22, 0x33, 0x44, 0x01,
+            0x00, 0x00,
+            0xaa, 0xaa, 0x03, 0x00, 0x00, 0x00, 0x08, 0x00};
+        memcpy(Frame, Header, sizeof(Header));
+        Frame[9] = (BYTE)Flow;
+        Frame[15] = (BYTE)(Flow >> 8);
+        Offset = sizeof(Header);
+    } else {
+        static const BYTE Header[] = {
+            0x00, 0x15, 0x5d, 0x00, 0x00, 0x00,
+            0x00, 0x15, 0x5d, 0x01, 0x00, 0x00,
+            0x08, 0x00};
+        memcpy(Frame, Header, sizeof(Header));
+        Frame[5] = (BYTE)Flow;
+        Frame[11] = (BYTE)(Flow >> 8);
+        Offset = sizeof(Header);
+    }
+
+    Offset += WriteIpUdp(Frame + Offset, Length - Offset, Flow);
+
+    for (i = Offset; i < Length; i++) {
+        Frame[i] = (i - Offset) < 64 ? (BYTE)(i * 7) : (BYTE)Random(256);
+    }
+}
+
+int WriteEvent(USHORT Id, ULONGLONG Keyword, EVENT_DATA_DESCRIPTOR* Data, ULONG NumData)
+{
+    EVENT_DESCRIPTOR Descriptor = {0};
+    int Err;
+
+    Descriptor.Id = Id;
+    Descriptor.Version = 0;
+    Descriptor.Channel = 0x10; // analytic
+    Descriptor.Level = TRACE_LEVEL_INFORMATION;
+    Descriptor.Keyword = Keyword;
+
+    Err = EventWrite(Provider, &Descriptor, NumData, Data);
+    if (Err != NO_ERROR) {
+        printf("EventWrite failed with %u\n", Err);
+    }
+    return Err;
+}
+
+int WriteMetadata(ULONG IfIndex, ULONGLONG Keyword)
+{
+    EVENT_DATA_DESCRIPTOR Data[4];
+    DOT11_EXTSTA_RECV_CONTEXT Metadata = {0};
+    ULONG MetadataSize = sizeof(Metadata);
+    BOOLEAN Is5GHz = Random(2) == 0;
+
+    Metadata.Header.Type = NDIS_OBJECT_TYPE_DEFAULT;
+    Metadata.Header.Revision = 1;
+    Metadata.Header.Size = sizeof(Metadata);
+    Metadata.uPhyId = Is5GHz ? 8 + Random(3) : 6 + Random(2); // ht, vht, he or erp, ht
+    Metadata.uChCenterFrequency = Is5GHz ? 5180 + 20 * Random(8) : 2412 + 5 * Random(13);
+    Metadata.usNumberOfMPDUsReceived = 1;
+    Metadata.lRSSI = -30 - (LONG)Random(60);
+    Metadata.ucDataRate = (UCHAR)(12 + Random(230)); // 500 Kbps units
+
+    EventDataDescCreate(&Data[0], &IfIndex, sizeof(IfIndex)); // MiniportIfIndex
+    EventDataDescCreate(&Data[1], &IfIndex, sizeof(IfIndex)); // LowerIfIndex
+    EventDataDescCreate(&Data[2], &MetadataSize, sizeof(MetadataSize));
+    EventDataDescCreate(&Data[3], &Metadata, sizeof(Metadata));
+    return WriteEvent(tidPacketMetadata, Keyword & ~(ULONGLONG)(KW_PACKET_START | KW_PACKET_END), Data, 4);
+}
+
+// Writes one fragment event. VMSwitch events also carry the source and
+// destination switch ports before the fragment.
+int WriteFragment(ULONG IfIndex, ULONGLONG Keyword, BOOLEAN VmSwitch, const BYTE* Fragment, ULONG FragmentSize)
+{
+    EVENT_DATA_DESCRIPTOR Data[16];
+    ULONG NumData = 0;
+    ULONG PortId = IfIndex - IFINDEX_BASE_VMSWITCH + 1;
+    ULONG DestinationCount = 1;
+    ULONG DestinationPortId = PortId + 1000;
+    ULONG OobDataSize = 0;
+    static const wchar_t PortName[] = L"C2B1B5F2-4D0A-4A42-9E4B-1A0E0BFF6E3B";
+    static const wchar_t NicName[] = L"Network Adapter";
+    static const wchar_t NicType[] = L"Synthetic";
+
+    EventDataDescCreate(&Data[NumData++], &IfIndex, sizeof(IfIndex)); // MiniportIfIndex
+    EventDataDescCreate(&Data[NumData++], &IfIndex, sizeof(IfIndex)); // LowerIfIndex
+    if (VmSwitch) {
+        EventDataDescCreate(&Data[NumData++], &PortId, sizeof(PortId));
+        EventDataDescCreate(&Data[NumData++], PortName, sizeof(PortName));
+        EventDataDescCreate(&Data[NumData++], NicName, sizeof(NicName));
+        EventDataDescCreate(&Data[NumData++], NicType, sizeof(NicType));
+        EventDataDescCreate(&Data[NumData++], &DestinationCount, sizeof(DestinationCount));
+        EventDataDescCreate(&Data[NumData++], &DestinationPortId, sizeof(DestinationPortId));
+        EventDataDescCreate(&Data[NumData++], PortName, sizeof(PortName));
+        EventDataDescCreate(&Data[NumData++], NicName, sizeof(NicName));
+        EventDataDescCreate(&Data[NumData++], NicType, sizeof(NicType));
+    }
+    EventDataDescCreate(&Data[NumData++], &FragmentSize, sizeof(FragmentSize));
+    EventDataDescCreate(&Data[NumData++], Fragment, FragmentSize);
+    if (VmSwitch) {
+        EventDataDescCreate(&Data[NumData++], &OobDataSize, sizeof(OobDataSize));
+    }
+
+    return WriteEvent(VmSwitch ? tidVMSwitchPacketFragment : tidPacketFragment, Keyword, Data, NumData);
+}
+
+int WritePacket(unsigned long Index, BYTE* Frame)
+{
+    int Err;
+    unsigned long Kind = Random(100);
+    BOOLEAN Wifi = Kind < WifiPercent;
+    BOOLEAN VmSwitch = !Wifi && Kind < WifiPercent + VmSwitchPercent;
+    BOOLEAN Fragmented = Random(100) < FragmentedPercent;
+    unsigned long Length;
+    unsigned long Offset;
+    unsigned long FragmentSize;
+    ULONG IfIndex;
+    ULONGLONG Keyword;
+
+    if (Fragmented) {
+        Length = MAX_FRAGMENT_SIZE + 1 + Random(MAX_FRAME_SIZE - MAX_FRAGMENT_SIZE);
+    } else {
+        Length = MinSize + Random(MaxSize - MinSize + 1);
+    }
+
+    if (Wifi) {
+        IfIndex = IFINDEX_BASE_WIFI + Random(NumInterfaces);
+        Keyword = KW_MEDIA_NATIVE_802_11;
+    } else if (VmSwitch) {
+        IfIndex = IFINDEX_BASE_VMSWITCH + Random(NumInterfaces);
+        Keyword = KW_MEDIA_802_3 | KW_VMSWITCH;
+    } else {
+        IfIndex = IFINDEX_BASE_ETHERNET + Random(NumInterfaces);
+        Keyword = KW_MEDIA_802_3;
+    }
+    Keyword |= Random(2) == 0 ? KW_SEND : KW_RECEIVE;
+
+    BuildFrame(Frame, Length, Wifi, Index % 4096);
+
+    if (Wifi) {
+        Err = WriteMetadata(IfIndex, Keyword);
+        if (Err != NO_ERROR) {
+            return Err;
+        }
+    }
+
+    // Packets longer than MAX_FRAGMENT_SIZE go out as a KW_PACKET_START
+    // event, zero or more middle events and a KW_PACKET_END event.
+    for (Offset = 0; Offset < Length; Offset += FragmentSize) {
+        FragmentSize = min(Length - Offset, Fragmented ? MAX_FRAGMENT_SIZE : Length);
+        Err = WriteFragment(
+            IfIndex,
+            Keyword |
+                (Offset == 0 ? KW_PACKET_START : 0) |
+                (Offset + FragmentSize == Length ? KW_PACKET_END : 0),
+            VmSwitch,
+            Frame + Offset,
+            FragmentSize);
+        if (Err != NO_ERROR) {
+            return Err;
+        }
+    }
+    return NO_ERROR;
+}
+
+void InitSessionProperties(struct SESSION_PROPERTIES* Props, wchar_t* FileName)
+{
+    ZeroMemory(Props, sizeof(*Props));
+    Props->Properties.Wnode.BufferSize = sizeof(*Props);
+    Props->Properties.Wnode.Flags = WNODE_FLAG_TRACED_GUID;
+    Props->Properties.Wnode.ClientContext = 1; // QPC timestamps
+    Props->Properties.Wnode.Guid = NdisCapId;
+    Props->Properties.LogFileMode =
+        EVENT_TRACE_FILE_MODE_SEQUENTIAL | EVENT_TRACE_PRIVATE_LOGGER_MODE | EVENT_TRACE_PRIVATE_IN_PROC;
+    Props->Properties.BufferSize = 1024; // KB
+    Props->Properties.MinimumBuffers = 64;
+    Props->Properties.MaximumBuffers = 512;
+    Props->Properties.LoggerNameOffset = FIELD_OFFSET(struct SESSION_PROPERTIES, LoggerName);
+    Props->Properties.LogFileNameOffset = FIELD_OFFSET(struct SESSION_PROPERTIES, LogFileName);
+    if (FileName != NULL) {
+        GetFullPathName(FileName, RTL_NUMBER_OF(Props->LogFileName), Props->LogFileName, NULL);
+    }
+}
+
+BOOLEAN ParseUlong(wchar_t* Str, unsigned long* Value)
+{
+    wchar_t* End;
+    unsigned long long Parsed = wcstoull(Str, &End, 0);
+
+    if (End == Str || *End != L'\0' || Parsed > ULONG_MAX) {
+        return FALSE;
+    }
+    *Value = (unsigned long)Parsed;
+    return TRUE;
+}
+
+int __cdecl wmain(int argc, wchar_t** argv)
+{
+    int Err;
+    struct SESSION_PROPERTIES Props;
+    TRACEHANDLE Session = 0;
+    wchar_t* OutFileName = NULL;
+    BYTE* Frame = NULL;
+    unsigned long SeedArg;
+    unsigned long i;
+    int Arg;
+
+    for (Arg = 1; Arg < argc; Arg++) {
+        if (!wcscmp(argv[Arg], L"--packets")) {
+            if (++Arg == argc || !ParseUlong(argv[Arg], &NumPackets)) {
+                goto Usage;
+            }
+        } else if (!wcscmp(argv[Arg], L"--interfaces")) {
+            if (++Arg == argc || !ParseUlong(argv[Arg], &NumInterfaces) ||
+                NumInterfaces == 0 || NumInterfaces > IFINDEX_BASE_WIFI - IFINDEX_BASE_ETHERNET) {
+                goto Usage;
+            }
+        } else if (!wcscmp(argv[Arg], L"--min-size")) {
+            if (++Arg == argc || !ParseUlong(argv[Arg], &MinSize)) {
+                goto Usage;
+            }
+        } else if (!wcscmp(argv[Arg], L"--max-size")) {
+            if (++Arg == argc || !ParseUlong(argv[Arg], &MaxSize)) {
+                goto Usage;
+            }
+        } else if (!wcscmp(argv[Arg], L"--wifi")) {
+            if (++Arg == argc || !ParseUlong(argv[Arg], &WifiPercent)) {
+                goto Usage;
+            }
+        } else if (!wcscmp(argv[Arg], L"--vmswitch")) {
+            if (++Arg == argc || !ParseUlong(argv[Arg], &VmSwitchPercent)) {
+                goto Usage;
+            }
+        } else if (!wcscmp(argv[Arg], L"--fragmented")) {
+            if (++Arg == argc || !ParseUlong(argv[Arg], &FragmentedPercent) || FragmentedPercent > 100) {
+                goto Usage;
+            }
+        } else if (!wcscmp(argv[Arg], L"--seed")) {
+            if (++Arg == argc || !ParseUlong(argv[Arg], &SeedArg)) {
+                goto Usage;
+            }
+            Seed = SeedArg;
+        } else if (OutFileName == NULL && argv[Arg][0] != L'-') {
+            OutFileName = argv[Arg];
+        } else {
+            goto Usage;
+        }
+    }
+    // The headers need 60 bytes (802.11 + LLC/SNAP + IPv4 + UDP), and
+    // unfragmented packets have to fit in one fragment event.
+    if (OutFileName == NULL || MinSize < 60 || MaxSize < MinSize ||
+        MaxSize > MAX_FRAME_SIZE || WifiPercent + VmSwitchPercent > 100) {
+        goto Usage;
+    }
+    Seed = Seed * 0x9E3779B97F4A7C15ULL | 1; // xorshift needs a nonzero state
+
+    Frame = malloc(MAX_FRAME_SIZE);
+    if (Frame == NULL) {
+        printf("out of memory\n");
+        return ERROR_NOT_ENOUGH_MEMORY;
+    }
+
+    Err = EventRegister(&NdisCapId, NULL, NULL, &Provider);
+    if (Err != NO_ERROR) {
+        printf("EventRegister failed with %u\n", Err);
+        goto Done;
+    }
+
+    InitSessionProperties(&Props, OutFileName);
+    Err = StartTrace(&Session, SESSION_NAME, &Props.Properties);
+    if (Err != NO_ERROR) {
+        printf("StartTrace failed with %u\n", Err);
+        Session = 0;
+        goto Done;
+    }
+
+    Err = EnableTraceEx2(
+        Session, &NdisCapId, EVENT_CONTROL_CODE_ENABLE_PROVIDER,
+        TRACE_LEVEL_VERBOSE, 0, 0, 0, NULL);
+    if (Err != NO_ERROR) {
+        printf("EnableTraceEx2 failed with %u\n", Err);
+        goto Done;
+    }
+
+    for (i = 0; i < NumPackets; i++) {
+        Err = WritePacket(i, Frame);
+        if (Err != NO_ERROR) {
+            goto Done;
+        }
+    }
+
+Done:
+    if (Session != 0) {
+        InitSessionProperties(&Props, NULL);
+        if (ControlTrace(Session, NULL, &Props.Properties, EVENT_TRACE_CONTROL_STOP) == NO_ERROR &&
+            Err == NO_ERROR) {
+            if (Props.Properties.EventsLost != 0) {
+                // The session buffers filled up faster than they were
+                // written out; the capture is still usable but smaller.
+                printf("WARNING: %u events were lost\n", Props.Properties.EventsLost);
+            }
+            printf("Wrote %u packets to %ws\n", NumPackets, OutFileName);
+        }
+    }
+    if (Provider != 0) {
+        EventUnregister(Provider);
+    }
+    free(Frame);
+    return Err;
+
+Usage:
+    printf(USAGE);
+    return ERROR_INVALID_PARAMETER;
+}
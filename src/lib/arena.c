@@ -0,0 +1,72 @@
+/*
+
+Copyright (c) Microsoft Corporation.
+Licensed under the MIT License.
+
+Bump allocator for state that lives exactly as long as one conversion.
+
+*/
+
+#define WIN32_LEAN_AND_MEAN 1
+#include <windows.h>
+#include <arena.h>
+
+struct ARENA_CHUNK {
+    struct ARENA_CHUNK* Next;
+    size_t Size; // including this header
+    size_t Used;
+};
+
+#define ArenaAlign(Size) (((Size) + 7) & ~(size_t)7)
+
+void ArenaInit(struct ARENA* Arena)
+{
+    ZeroMemory(Arena, sizeof(*Arena));
+}
+
+void* ArenaAlloc(struct ARENA* Arena, size_t Size)
+{
+    struct ARENA_CHUNK* Chunk = Arena->Chunks;
+    size_t ChunkSize;
+    void* Ptr;
+
+    Size = ArenaAlign(Size);
+    if (Chunk == NULL || Chunk->Size - Chunk->Used < Size) {
+        // Big allocations get a chunk of their own, so that they don't waste
+        // the rest of the current one.
+        ChunkSize = max(ARENA_CHUNK_SIZE, ArenaAlign(sizeof(struct ARENA_CHUNK)) + Size);
+        Chunk = (struct ARENA_CHUNK*)VirtualAlloc(
+            NULL, ChunkSize, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+        if (Chunk == NULL) {
+            return NULL;
+        }
+        // VirtualAlloc returns zeroed pages, and arena memory is never
+        // reused before ArenaFree gives it back.
+        Chunk->Size = ChunkSize;
+        Chunk->Used = ArenaAlign(sizeof(struct ARENA_CHUNK));
+        Arena->Size += ChunkSize;
+        if (Arena->Chunks != NULL && ChunkSize > ARENA_CHUNK_SIZE) {
+            // Keep allocating from the current chunk.
+            Chunk->Next = Arena->Chunks->Next;
+            Arena->Chunks->Next = Chunk;
+        } else {
+            Chunk->Next = Arena->Chunks;
+            Arena->Chunks = Chunk;
+        }
+    }
+
+    Ptr = (BYTE*)Chunk + Chunk->Used;
+    Chunk->Used += Size;
+    return Ptr;
+}
+
+void ArenaFree(struct ARENA* Arena)
+{
+    struct ARENA_CHUNK* Chunk;
+
+    while ((Chunk = Arena->Chunks) != NULL) {
+        Arena->Chunks = Chunk->Next;
+        VirtualFree(Chunk, 0, MEM_RELEASE);
+    }
+    Arena->Size = 0;
+}
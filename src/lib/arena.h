@@ -0,0 +1,33 @@
+/*
+
+Copyright (c) Microsoft Corporation.
+Licensed under the MIT License.
+
+Bump allocator for state that lives exactly as long as one conversion.
+
+Memory is handed out from large chunks taken straight from VirtualAlloc, so
+conversions running on different threads never contend on the heap lock,
+and everything is released at once by ArenaFree. There is no way to free a
+single allocation; growing tables allocate a new copy and abandon the old
+one, which at most doubles their footprint.
+
+*/
+
+#pragma once
+
+#define ARENA_CHUNK_SIZE (64 * 1024)
+
+struct ARENA_CHUNK;
+
+struct ARENA {
+    struct ARENA_CHUNK* Chunks; // the current one first
+    unsigned long long Size; // bytes taken from the system
+};
+
+void ArenaInit(struct ARENA* Arena);
+
+// Returns Size zeroed bytes, 8-byte aligned, or NULL if out of memory.
+void* ArenaAlloc(struct ARENA* Arena, size_t Size);
+
+// Releases everything allocated from the arena, which can then be reused.
+void ArenaFree(struct ARENA* Arena);
@@ -0,0 +1,4197 @@
+/*
+
+Copyright (c) Microsoft Corporation.
+Licensed under the MIT License.
+
+etl2pcapng conversion engine (see etl2pcapng.h)
+
+Converts packet captures in ETL format generated by ndiscap (the ETW provider
+in Windows that produces packet capture events) to pcapng format
+(readable by Wireshark).
+
+Issues:
+
+-ndiscap supports packet truncation and so does pcapng, but ndiscap doesn't
+ currently log metadata about truncation in its events (other than marking
+ them with a keyword), so we pretend there is no truncation for now.
+
+*/
+
+#define WIN32_LEAN_AND_MEAN 1
+#include <winsock2.h> // before windows.h, for iphlpapi.h
+#include <windows.h>
+#include <ws2ipdef.h>
+#include <iphlpapi.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <evntrace.h>
+#include <evntcons.h>
+#include <tdh.h>
+#include <strsafe.h>
+#include <io.h>
+#include <pcapng.h>
+#include <ring.h>
+#include <sinks.h>
+#include <gzip.h>
+#include <etlfile.h>
+#include <arena.h>
+#include <etl2pcapng.h>
+
+#define MAX_PACKET_SIZE 65535
+
+// From the ndiscap manifest
+#define KW_MEDIA_WIRELESS_WAN         0x200
+#define KW_MEDIA_NATIVE_802_11      0x10000
+#define KW_PACKET_START          0x40000000
+#define KW_PACKET_END            0x80000000
+#define KW_SEND                 0x100000000
+#define KW_RECEIVE              0x200000000
+
+#define tidPacketFragment            1001
+#define tidPacketMetadata            1002
+#define tidVMSwitchPacketFragment    1003
+
+// From: https://docs.microsoft.com/en-us/windows-hardware/drivers/ddi/windot11/ns-windot11-dot11_extsta_recv_context
+#pragma pack(push,8)
+typedef struct _NDIS_OBJECT_HEADER {
+    UCHAR  Type;
+    UCHAR  Revision;
+    USHORT Size;
+} NDIS_OBJECT_HEADER, * PNDIS_OBJECT_HEADER;
+
+typedef struct DOT11_EXTSTA_RECV_CONTEXT {
+    NDIS_OBJECT_HEADER Header;
+    ULONG              uReceiveFlags;
+    ULONG              uPhyId;
+    ULONG              uChCenterFrequency;
+    USHORT             usNumberOfMPDUsReceived;
+    LONG               lRSSI;
+    UCHAR              ucDataRate;
+    ULONG              uSizeMediaSpecificInfo;
+    PVOID              pvMediaSpecificInfo;
+    ULONGLONG          ullTimestamp;
+} DOT11_EXTSTA_RECV_CONTEXT, * PDOT11_EXTSTA_RECV_CONTEXT;
+#pragma pack(pop)
+
+// Custom options (PCAPNG_OPTIONCODE_CUSTOM_BINARY) written with
+// --metadata custom/radiotap. The value is Microsoft's Private Enterprise
+// Number followed by a type and the fields for that type.
+#define ETL2PCAPNG_PEN 311
+#define CUSTOM_OPTION_TYPE_PID            1
+#define CUSTOM_OPTION_TYPE_DOT11_METADATA 2
+
+// Radiotap fields we fill in from DOT11_EXTSTA_RECV_CONTEXT.
+// From: https://www.radiotap.org/fields/defined
+#define RADIOTAP_PRESENT_RATE          0x00000004
+#define RADIOTAP_PRESENT_CHANNEL       0x00000008
+#define RADIOTAP_PRESENT_DBM_ANTSIGNAL 0x00000020
+#define RADIOTAP_CHANNEL_2GHZ          0x0080
+#define RADIOTAP_CHANNEL_5GHZ          0x0100
+
+#include <pshpack1.h>
+struct CUSTOM_OPTION_PID {
+    DWORD Pen;  // ETL2PCAPNG_PEN
+    USHORT Type; // CUSTOM_OPTION_TYPE_PID
+    ULONG ProcessId;
+};
+struct CUSTOM_OPTION_DOT11_METADATA {
+    DWORD Pen;  // ETL2PCAPNG_PEN
+    USHORT Type; // CUSTOM_OPTION_TYPE_DOT11_METADATA
+    ULONG ReceiveFlags;
+    ULONG PhyId;
+    ULONG ChCenterFrequency; // MHz
+    USHORT NumMPDUsReceived;
+    LONG Rssi; // dBm
+    UCHAR DataRate; // 500 kbps units
+};
+struct RADIOTAP_HEADER {
+    UCHAR Version; // 0
+    UCHAR Pad;
+    USHORT Length; // including the fields that follow
+    ULONG Present;
+};
+struct RADIOTAP_DOT11_METADATA {
+    struct RADIOTAP_HEADER Header;
+    UCHAR Rate; // 500 kbps units
+    UCHAR Pad;  // the channel field is 2-byte aligned
+    USHORT ChannelFrequency; // MHz
+    USHORT ChannelFlags;
+    CHAR AntennaSignal; // dBm
+};
+#include <poppack.h>
+
+// From: https://docs.microsoft.com/en-us/windows-hardware/drivers/ddi/windot11/ne-windot11-_dot11_phy_type
+static const char* DOT11_PHY_TYPE_NAMES[] = {
+    "Unknown",        // dot11_phy_type_unknown = 0
+    "Fhss",           // dot11_phy_type_fhss = 1
+    "Dsss",           // dot11_phy_type_dsss = 2
+    "IrBaseband",     // dot11_phy_type_irbaseband = 3
+    "802.11a",        // dot11_phy_type_ofdm = 4
+    "802.11b",        // dot11_phy_type_hrdsss = 5
+    "802.11g",        // dot11_phy_type_erp = 6
+    "802.11n",        // dot11_phy_type_ht = 7
+    "802.11ac",       // dot11_phy_type_vht = 8
+    "802.11ad",       // dot11_phy_type_dmg = 9
+    "802.11ax"        // dot11_phy_type_he = 10
+};
+
+// ETW timestamps are FILETIMEs: 100ns units since 1/1/1601. By default they
+// are converted to usec since 1/1/1970 (pcapng's default resolution); with
+// TsResol 100ns they are written as 100ns units, which only needs a
+// subtraction (TimeStampBias), and with TsOffset too they're written
+// unchanged and the IDBs carry the offset to 1970 in if_tsoffset. The offset
+// of 11644473600 seconds can be calculated with a couple of calls to
+// SystemTimeToFileTime.
+#define FILETIME_UNIX_EPOCH_SECONDS 11644473600ll
+
+const GUID NdisCapId = { // Microsoft-Windows-NDIS-PacketCapture {2ED6006E-4729-4609-B423-3EE7BCD678EF}
+    0x2ed6006e, 0x4729, 0x4609, 0xb4, 0x23, 0x3e, 0xe7, 0xbc, 0xd6, 0x78, 0xef};
+
+struct INTERFACE {
+    unsigned long Input; // IfIndexes are only unique within one input
+    unsigned long LowerIfIndex;
+    unsigned long MiniportIfIndex;
+    unsigned long PcapNgIfIndex;
+    short Type;
+    char* Name; // UTF-8, NULL if unknown (--if-names)
+    char* Description;
+    unsigned long long Packets;
+    unsigned long long PacketsSent;
+    unsigned long long Bytes; // before --snaplen
+    unsigned long MaxLength; // of the largest packet, --scan
+    ULARGE_INTEGER FirstTimeStamp; // of the first packet, if Packets > 0
+    ULARGE_INTEGER LastTimeStamp; // (FILETIMEs with --scan)
+    // --if-stats with --split-size/--split-seconds: the packets in the
+    // current output file, counted where they are written.
+    unsigned long long FilePackets;
+    ULARGE_INTEGER FileFirstTimeStamp;
+    ULARGE_INTEGER FileLastTimeStamp;
+};
+
+// Interfaces are looked up on every packet event, and vmswitch captures can
+// have hundreds of them, so they're kept in an open addressing hash table
+// (linear probing, power of two size, see InterfaceHash) with the key
+// stored next to the pointer, so that a lookup usually touches a single
+// cache line. The INTERFACEs themselves are allocated separately (from the
+// conversion's arena) and never move, since the pipeline's encoder thread
+// and OutputInterfaces hold pointers to them.
+#define IFACE_HT_MIN_BITS 6 // 64 slots
+
+struct INTERFACE_SLOT {
+    unsigned long Input;
+    unsigned long LowerIfIndex;
+    struct INTERFACE* Iface; // NULL if the slot is free
+};
+
+// Fields of the ndiscap packet events that we care about.
+#define NDISCAP_PROP_MINIPORT_IFINDEX 0
+#define NDISCAP_PROP_LOWER_IFINDEX    1
+#define NDISCAP_PROP_FRAGMENT_SIZE    2
+#define NDISCAP_PROP_FRAGMENT         3
+#define NDISCAP_PROP_METADATA_SIZE    4
+#define NDISCAP_PROP_METADATA         5
+#define NDISCAP_PROP_COUNT            6
+
+const wchar_t* NdisCapPropNames[NDISCAP_PROP_COUNT] = {
+    L"MiniportIfIndex",
+    L"LowerIfIndex",
+    L"FragmentSize",
+    L"Fragment",
+    L"MetadataSize",
+    L"Metadata"
+};
+
+// Resolving a property by name with TdhGetProperty looks up the event's
+// schema every time. The layout of a given (event id, version) never
+// changes, so instead we fetch the schema once with TdhGetEventInformation,
+// work out where each property lives, and then read the fields straight out
+// of UserData. Properties that follow only fixed-size ones get a precomputed
+// offset; anything after a variable-length property (e.g. the port and NIC
+// name strings in tidVMSwitchPacketFragment) is found by walking the
+// properties once per event. Events whose layout we can't walk fall back to
+// TdhGetProperty.
+
+#define MAX_SCHEMA_PROPS 64
+#define MAX_EVENT_SCHEMAS 16
+
+struct SCHEMA_PROP {
+    ULONG Flags;       // PROPERTY_FLAGS
+    USHORT InType;     // TDH_INTYPE_*, or the first member if PropertyStruct
+    USHORT NumMembers; // PropertyStruct only
+    USHORT Count;      // or the index of the count property (PropertyParamCount)
+    USHORT Length;     // or the index of the length property (PropertyParamLength)
+};
+
+struct EVENT_SCHEMA {
+    USHORT Id;
+    UCHAR Version;
+    BOOLEAN Usable;
+    ULONG NumProps;
+    ULONG NumTopLevelProps;
+    struct SCHEMA_PROP Props[MAX_SCHEMA_PROPS];
+    long PropIndex[NDISCAP_PROP_COUNT];   // -1 if the event doesn't have it
+    long FixedOffset[NDISCAP_PROP_COUNT]; // -1 if it must be found by walking
+};
+
+// Packet comments are built in one small reusable buffer with the minimal
+// formatter below rather than with printf, since this runs for every packet.
+// The longest comment we build (the 802.11 metadata one) is well under
+// COMMENT_MAX_SIZE.
+#define COMMENT_MAX_SIZE 256
+
+// Used by the pipeline (--pipeline) between the parse and encoder threads.
+#define PIPELINE_RING_SIZE (16 * 1024 * 1024)
+
+// etl2pcapng-<pid>-<n>, see the --live comment above StartLiveSession.
+#define LIVE_SESSION_NAME_SIZE 48
+#define PIPELINE_WRITE_BUFFERS 4
+
+// --stats: counters and timings reported at the end of a conversion. The
+// times are in QueryPerformanceCounter ticks and are only measured with
+// --stats.
+#define STATS_MAX_EVENT_IDS 32
+
+struct EVENT_ID_STATS {
+    USHORT Id;
+    unsigned long long Seen;
+    unsigned long long Filtered;
+};
+
+struct STATS {
+    struct EVENT_ID_STATS EventIds[STATS_MAX_EVENT_IDS]; // ndiscap events
+    unsigned long NumEventIds;
+    unsigned long long OtherEvents; // from other providers
+    unsigned long long TooLarge; // packets dropped as too large
+    unsigned long long BadMetadataLength;
+    unsigned long long BadEvents; // with fields that couldn't be read
+    LONGLONG TraceTicks;    // in ProcessTrace
+    LONGLONG CallbackTicks; // in EventCallback
+    LONGLONG EmitTicks;     // in EventCallback, passing packets on
+    LONGLONG EncodeTicks;   // building pcapng blocks
+    LONGLONG FormatTicks;   // building their comments and options
+    LONGLONG WriteTicks;    // writing them out
+};
+
+// A packet on its way from the event callback to the encoder, built once
+// from its events. In the pipeline's batches it's followed by a copy of
+// the metadata and the data, which it then points to.
+struct PACKET_RECORD {
+    struct INTERFACE* Iface;
+    const BYTE* Data;
+    PDOT11_EXTSTA_RECV_CONTEXT Metadata; // NULL if there is none
+    ULARGE_INTEGER TimeStamp; // in TimeStampsPerSecond units
+    unsigned long Length;
+    unsigned long ProcessId;
+    BOOLEAN IsSend;
+};
+
+// --dedup (see DedupPacket). The window is well above the time a packet
+// takes through the layers of the stack, and well below TCP's shortest
+// retransmission timeout, so that retransmitted packets are kept.
+#define DEDUP_WINDOW 100000 // 10ms, in FILETIME units
+#define DEDUP_MAX_PACKETS 16384 // held at a time
+#define DEDUP_TABLE_SIZE (DEDUP_MAX_PACKETS * 2) // a power of two
+#define DEDUP_BUFFER_SIZE (16 * 1024 * 1024)
+
+struct DEDUP_PACKET {
+    struct PACKET_RECORD Packet; // pointing at Metadata and into DedupData
+    unsigned long long Older; // sequence number of the next one in the chain
+    unsigned long long Hash;
+    LONGLONG Time; // FILETIME
+    unsigned long Offset; // of the data in DedupData
+    BOOLEAN Dropped; // a later copy is written instead
+    BOOLEAN OutsideRange; // --parallel, only held to find copies
+    DOT11_EXTSTA_RECV_CONTEXT Metadata;
+};
+
+// One of the ETL files being merged into the output. ProcessTrace merges
+// the inputs by timestamp, so the events of a multi-event packet (and the
+// metadata event before a packet) can be interleaved with events from the
+// other inputs; the packet being put together is therefore per input.
+struct INPUT {
+    struct CONVERSION* Conv;
+    unsigned long Index;
+    wchar_t* FileName; // NULL for --live and Etl2PcapngCreate
+    char Name[MAX_PATH * 3]; // file name without the directory, UTF-8
+    unsigned long long BytesRead; // in the current pass, for --progress
+
+    char AuxFragBuf[MAX_PACKET_SIZE];
+    unsigned long AuxFragBufOffset;
+    DOT11_EXTSTA_RECV_CONTEXT PacketMetadata;
+    BOOLEAN AddMetadata;
+};
+
+// The state of converting the inputs to one output. Everything lives
+// here, including a copy of the options, so that several conversions (see
+// --batch) can run at the same time.
+struct CONVERSION {
+    struct ETL2PCAPNG_OPTIONS Options;
+    LONGLONG TimeStampBias; // with ETL2PCAPNG_TSRESOL_100NS
+    unsigned long long TimeStampsPerSecond;
+
+    struct INPUT* Inputs;
+    unsigned long NumInputs;
+    wchar_t* OutFileName; // NULL for Etl2PcapngCreate and --scan
+    TRACEHANDLE LiveSession;
+    wchar_t LiveSessionName[LIVE_SESSION_NAME_SIZE]; // --live
+
+    HANDLE OutFile;
+    BOOLEAN OutFileIsPipe;
+    struct PCAPNG_FILE_SINK FileSink;
+    struct THREAD_SINK ThreadSink;
+    struct OVERLAPPED_SINK OverlappedSink;
+    struct GZIP_SINK GzipSink;
+    struct SOCKET_SINK SocketSink;
+    struct TIMED_SINK TimedSink;
+    struct PCAPNG_SINK* Sink;
+    struct PCAPNG_SINK* CallerSink; // Etl2PcapngCreate
+    struct PCAPNG_WRITER Writer;
+    char CommentBuf[COMMENT_MAX_SIZE];
+
+    BOOLEAN Pass2;
+    int Err; // the first error that stopped the conversion of events
+    unsigned long long NumFramesConverted;
+    unsigned long long NumFramesFiltered;
+    unsigned long long NumBytesConverted; // packet data, after --snaplen
+    unsigned long long NumFramesDuplicate; // --dedup
+    BOOLEAN LimitReached; // --max-packets/--max-bytes
+
+    // --progress
+    unsigned long long InputSize; // of all inputs, 0 if unknown
+    unsigned long long NumEvents; // delivered in the current pass
+    unsigned long long ProgressEvents; // NumEvents at the last progress line
+    ULONGLONG ProgressTime; // GetTickCount64 at the last progress line
+    BOOLEAN ProgressShown;
+
+    struct INTERFACE_SLOT* InterfaceTable;
+    unsigned long InterfaceTableSize; // 0 or 1 << InterfaceTableBits
+    unsigned long InterfaceTableBits;
+    unsigned long NumInterfaces;
+    struct INTERFACE* LastInterface; // last one GetInterface returned
+
+    struct EVENT_SCHEMA EventSchemas[MAX_EVENT_SCHEMAS];
+    unsigned long NumEventSchemas;
+    // Only used when a schema can't be walked and TdhGetProperty has to copy
+    // the data out for us.
+    char FallbackBuf[MAX_PACKET_SIZE];
+
+    struct RECORD_RING PacketRing;
+    HANDLE Encoder; // non-NULL while the pipeline is running
+    struct PIPELINE_RECORD* Batch; // being filled in PacketRing, or NULL
+    unsigned long BatchUsed; // bytes of Batch, from its start
+
+    // --direct: one per input, or NULL if the inputs are read with
+    // ProcessTrace.
+    struct ETL_FILE* EtlFiles;
+    BOOLEAN SharedEtlFiles; // opened by the --parallel conversion
+
+    // --parallel: a segment only writes the packets that end in
+    // [RangeStart, RangeEnd) (see ConvertParallel).
+    BOOLEAN HasRange;
+    BOOLEAN RangeDone; // an event after the range was seen
+    LONGLONG RangeStart;
+    LONGLONG RangeEnd;
+
+    // The interfaces written to the output, in PcapNgIfIndex order; with
+    // --split-size/--split-seconds every new file starts with all of them.
+    struct INTERFACE** OutputInterfaces;
+    unsigned long NumOutputInterfaces;
+    unsigned long MaxOutputInterfaces;
+    unsigned long SplitIndex; // number of the current file, from 1
+    wchar_t SplitFileName[MAX_PATH];
+    BOOLEAN SplitHasPackets;
+    unsigned long long SplitStart; // timestamp of the file's first packet
+
+    // --index: the index of the current output file, written when the file
+    // is closed.
+    struct ETL2PCAPNG_INDEX_ENTRY* IndexEntries;
+    unsigned long NumIndexEntries;
+    unsigned long MaxIndexEntries;
+    struct ETL2PCAPNG_INDEX_INTERFACE* IndexInterfaces; // by PcapNgIfIndex
+    unsigned long MaxIndexInterfaces;
+    unsigned long long IndexPackets;
+
+    // --dedup: the packets of about the last DEDUP_WINDOW, by sequence
+    // number % DEDUP_MAX_PACKETS, with their data in DedupData, and the
+    // newest sequence number in each bucket of DedupTable (0 for none).
+    struct DEDUP_PACKET* DedupPackets;
+    unsigned long long* DedupTable;
+    BYTE* DedupData;
+    unsigned long long DedupHead; // sequence number of the oldest held packet
+    unsigned long long DedupTail; // and of the next one
+    unsigned long DedupDataHead;
+    unsigned long DedupDataTail;
+
+    struct STATS Stats;
+
+    // The interfaces, their names and the tables pointing at them, all
+    // released together by FreeInterfaces.
+    struct ARENA Arena;
+};
+
+LONGLONG StatsNow(struct CONVERSION* Conv)
+{
+    LARGE_INTEGER Now;
+
+    if (!Conv->Options.ReportStats) {
+        return 0;
+    }
+    QueryPerformanceCounter(&Now);
+    return Now.QuadPart;
+}
+
+// Whether the event counters of Stats are kept: for --stats and --scan, in
+// the pass that converts.
+BOOLEAN CountEvents(struct CONVERSION* Conv)
+{
+    return (Conv->Options.ReportStats || Conv->Options.Scan != ETL2PCAPNG_SCAN_NONE) && Conv->Pass2;
+}
+
+// Returns the counters for an ndiscap event id, or NULL if there are too
+// many different ids to keep track of.
+struct EVENT_ID_STATS* GetEventIdStats(struct CONVERSION* Conv, USHORT Id)
+{
+    struct EVENT_ID_STATS* Counts;
+    unsigned long i;
+
+    for (i = 0; i < Conv->Stats.NumEventIds; i++) {
+        if (Conv->Stats.EventIds[i].Id == Id) {
+            return &Conv->Stats.EventIds[i];
+        }
+    }
+    if (Conv->Stats.NumEventIds == STATS_MAX_EVENT_IDS) {
+        return NULL;
+    }
+    Counts = &Conv->Stats.EventIds[Conv->Stats.NumEventIds++];
+    Counts->Id = Id;
+    return Counts;
+}
+
+// Allocates zeroed memory that lasts until the end of the conversion. On
+// failure the conversion is stopped with ERROR_NOT_ENOUGH_MEMORY.
+void* ConvAlloc(struct CONVERSION* Conv, size_t Size)
+{
+    void* Ptr = ArenaAlloc(&Conv->Arena, Size);
+    if (Ptr == NULL && Conv->Err == NO_ERROR) {
+        printf("out of memory\n");
+        Conv->Err = ERROR_NOT_ENOUGH_MEMORY;
+    }
+    return Ptr;
+}
+
+// The slot to start probing at in a table of 1 << Bits slots. IfIndexes are
+// small and mostly consecutive, and merged inputs (e.g. several hosts) use
+// the same ones, so the input and the IfIndex are combined into one 64-bit
+// key and spread out by Fibonacci hashing: the index is the top bits of the
+// product, which depend on all bits of the key (the low bits would only
+// depend on the low bits of the IfIndex).
+unsigned long InterfaceHash(unsigned long Input, unsigned long LowerIfIndex, unsigned long Bits)
+{
+    unsigned long long Key = ((unsigned long long)Input << 32) | LowerIfIndex;
+    return (unsigned long)((Key * 0x9e3779b97f4a7c15ull) >> (64 - Bits));
+}
+
+struct INTERFACE* GetInterface(struct CONVERSION* Conv, unsigned long Input, unsigned long LowerIfIndex)
+{
+    struct INTERFACE_SLOT* Slot;
+    unsigned long Mask = Conv->InterfaceTableSize - 1;
+    unsigned long i;
+
+    // Consecutive events are usually for the same interface.
+    if (Conv->LastInterface != NULL &&
+        Conv->LastInterface->LowerIfIndex == LowerIfIndex &&
+        Conv->LastInterface->Input == Input) {
+        return Conv->LastInterface;
+    }
+
+    if (Conv->InterfaceTableSize == 0) {
+        return NULL;
+    }
+    for (i = InterfaceHash(Input, LowerIfIndex, Conv->InterfaceTableBits); ; i = (i + 1) & Mask) {
+        Slot = &Conv->InterfaceTable[i];
+        if (Slot->Iface == NULL) {
+            return NULL;
+        }
+        if (Slot->LowerIfIndex == LowerIfIndex && Slot->Input == Input) {
+            Conv->LastInterface = Slot->Iface;
+            return Slot->Iface;
+        }
+    }
+}
+
+// Puts Iface in a free slot of a table with room for it.
+void InsertInterface(struct INTERFACE_SLOT* Table, unsigned long Bits, struct INTERFACE* Iface)
+{
+    unsigned long Mask = (1ul << Bits) - 1;
+    unsigned long i = InterfaceHash(Iface->Input, Iface->LowerIfIndex, Bits);
+
+    while (Table[i].Iface != NULL) {
+        i = (i + 1) & Mask;
+    }
+    Table[i].Input = Iface->Input;
+    Table[i].LowerIfIndex = Iface->LowerIfIndex;
+    Table[i].Iface = Iface;
+}
+
+// Doubles the table once it is 3/4 full, to keep the probe sequences short.
+BOOLEAN GrowInterfaceTable(struct CONVERSION* Conv)
+{
+    struct INTERFACE_SLOT* NewTable;
+    unsigned long NewBits;
+    unsigned long i;
+
+    if ((Conv->NumInterfaces + 1) * 4 <= Conv->InterfaceTableSize * 3) {
+        return TRUE;
+    }
+    NewBits = Conv->InterfaceTableSize == 0 ? IFACE_HT_MIN_BITS : Conv->InterfaceTableBits + 1;
+    NewTable = ConvAlloc(Conv, (1ul << NewBits) * sizeof(struct INTERFACE_SLOT));
+    if (NewTable == NULL) {
+        return FALSE;
+    }
+    for (i = 0; i < Conv->InterfaceTableSize; i++) {
+        if (Conv->InterfaceTable[i].Iface != NULL) {
+            InsertInterface(NewTable, NewBits, Conv->InterfaceTable[i].Iface);
+        }
+    }
+    Conv->InterfaceTable = NewTable;
+    Conv->InterfaceTableSize = 1ul << NewBits;
+    Conv->InterfaceTableBits = NewBits;
+    return TRUE;
+}
+
+// Returns a UTF-8 copy of Str, or NULL if it's empty or on failure.
+char* DupUtf8(struct CONVERSION* Conv, const wchar_t* Str)
+{
+    char* Utf8;
+    int Length = WideCharToMultiByte(CP_UTF8, 0, Str, -1, NULL, 0, NULL, NULL);
+
+    if (Length <= 1) {
+        return NULL;
+    }
+    Utf8 = ConvAlloc(Conv, Length);
+    if (Utf8 == NULL) {
+        return NULL;
+    }
+    WideCharToMultiByte(CP_UTF8, 0, Str, -1, Utf8, Length, NULL, NULL);
+    return Utf8;
+}
+
+// The packet events only identify interfaces by IfIndex, so names can only
+// come from the interfaces of the machine we run on, which are only the
+// right ones if it's the one the capture was taken on.
+void GetInterfaceNames(struct CONVERSION* Conv, struct INTERFACE* Iface)
+{
+    MIB_IF_ROW2 Row;
+
+    memset(&Row, 0, sizeof(Row));
+    Row.InterfaceIndex = Iface->LowerIfIndex;
+    if (GetIfEntry2(&Row) != NO_ERROR) {
+        return;
+    }
+    Iface->Name = DupUtf8(Conv, Row.Alias);
+    Iface->Description = DupUtf8(Conv, Row.Description);
+}
+
+// Returns NULL if out of memory.
+struct INTERFACE* AddInterface(
+    struct CONVERSION* Conv,
+    unsigned long Input,
+    unsigned long LowerIfIndex,
+    unsigned long MiniportIfIndex,
+    short Type
+    )
+{
+    struct INTERFACE* NewIface = ConvAlloc(Conv, sizeof(struct INTERFACE));
+
+    if (NewIface == NULL || !GrowInterfaceTable(Conv)) {
+        return NULL;
+    }
+    NewIface->Input = Input;
+    NewIface->LowerIfIndex = LowerIfIndex;
+    NewIface->MiniportIfIndex = MiniportIfIndex;
+    NewIface->Type = Type;
+    if (Conv->Options.ResolveNames) {
+        GetInterfaceNames(Conv, NewIface);
+    }
+
+    InsertInterface(Conv->InterfaceTable, Conv->InterfaceTableBits, NewIface);
+    Conv->NumInterfaces++;
+    Conv->LastInterface = NewIface;
+    return NewIface;
+}
+
+void FreeInterfaces(struct CONVERSION* Conv)
+{
+    ArenaFree(&Conv->Arena);
+    Conv->InterfaceTable = NULL;
+    Conv->InterfaceTableSize = 0;
+    Conv->InterfaceTableBits = 0;
+    Conv->NumInterfaces = 0;
+    Conv->LastInterface = NULL;
+    Conv->OutputInterfaces = NULL;
+    Conv->NumOutputInterfaces = 0;
+    Conv->MaxOutputInterfaces = 0;
+}
+
+int __cdecl InterfaceCompareFn(const void* A, const void* B)
+{
+    // The input is the primary sort, then MiniportIfIndex and
+    // LowerIfIndex, except that inside a group of interfaces
+    // with the same MiniportIfIndex we want the one with
+    // MiniportIfIndex==LowerIfIndex (i.e. the miniport) to come
+    // first.
+
+    unsigned long IA = (*((struct INTERFACE**)A))->Input;
+    unsigned long IB = (*((struct INTERFACE**)B))->Input;
+    unsigned long MA = (*((struct INTERFACE**)A))->MiniportIfIndex;
+    unsigned long MB = (*((struct INTERFACE**)B))->MiniportIfIndex;
+    unsigned long LA = (*((struct INTERFACE**)A))->LowerIfIndex;
+    unsigned long LB = (*((struct INTERFACE**)B))->LowerIfIndex;
+
+    if (IA != IB) {
+        return IA < IB ? -1 : 1;
+    } else if (MA == MB) {
+        if (MA == LA) {
+            // A is the miniport.
+            return -1;
+        } else if (MB == LB) {
+            // B is the miniport.
+            return 1;
+        } else if (LA < LB) {
+            return -1;
+        } else if (LB < LA) {
+            return 1;
+        } else {
+            return 0;
+        }
+    } else if (MA < MB) {
+        return -1;
+    } else {
+        return 1;
+    }
+}
+
+short GetInterfaceLinkType(struct CONVERSION* Conv, struct INTERFACE* Interface)
+{
+    if (Interface->Type == PCAPNG_LINKTYPE_IEEE802_11 &&
+        Conv->Options.MetadataFormat == ETL2PCAPNG_METADATA_RADIOTAP) {
+        return PCAPNG_LINKTYPE_IEEE802_11_RADIOTAP;
+    }
+    return Interface->Type;
+}
+
+long GetInterfaceSnapLen(struct CONVERSION* Conv)
+{
+    return Conv->Options.SnapLen != 0 ? (long)Conv->Options.SnapLen : MAX_PACKET_SIZE;
+}
+
+// With several inputs, each IDB has a comment naming the input it came
+// from. With --if-names it has if_name/if_description, and with
+// --tsresol/--tsoffset if_tsresol/if_tsoffset.
+int WriteInterfaceDesc(struct CONVERSION* Conv, struct INTERFACE* Interface)
+{
+    struct PCAPNG_OPTION Options[5];
+    unsigned long NumOptions = 0;
+    LONGLONG Offset = -FILETIME_UNIX_EPOCH_SECONDS;
+
+    if (Conv->NumInputs > 1) {
+        Options[NumOptions].Code = PCAPNG_OPTIONCODE_COMMENT;
+        Options[NumOptions].Length = (USHORT)strlen(Conv->Inputs[Interface->Input].Name);
+        Options[NumOptions].Value = Conv->Inputs[Interface->Input].Name;
+        NumOptions++;
+    }
+    if (Interface->Name != NULL) {
+        Options[NumOptions].Code = PCAPNG_OPTIONCODE_IF_NAME;
+        Options[NumOptions].Length = (USHORT)strlen(Interface->Name);
+        Options[NumOptions].Value = Interface->Name;
+        NumOptions++;
+    }
+    if (Interface->Description != NULL) {
+        Options[NumOptions].Code = PCAPNG_OPTIONCODE_IF_DESCRIPTION;
+        Options[NumOptions].Length = (USHORT)strlen(Interface->Description);
+        Options[NumOptions].Value = Interface->Description;
+        NumOptions++;
+    }
+    if (Conv->Options.TsResol != ETL2PCAPNG_TSRESOL_USEC) {
+        Options[NumOptions].Code = PCAPNG_OPTIONCODE_IF_TSRESOL;
+        Options[NumOptions].Length = sizeof(Conv->Options.TsResol);
+        Options[NumOptions].Value = &Conv->Options.TsResol;
+        NumOptions++;
+    }
+    if (Conv->Options.TsOffset) {
+        Options[NumOptions].Code = PCAPNG_OPTIONCODE_IF_TSOFFSET;
+        Options[NumOptions].Length = sizeof(Offset);
+        Options[NumOptions].Value = &Offset;
+        NumOptions++;
+    }
+    return PcapNgWriteInterfaceDesc(
+        &Conv->Writer, GetInterfaceLinkType(Conv, Interface), GetInterfaceSnapLen(Conv),
+        Options, NumOptions);
+}
+
+// Writes the IDB of a new interface and remembers it for the next files of
+// a split output.
+int WriteInterface(struct CONVERSION* Conv, struct INTERFACE* Interface)
+{
+    struct INTERFACE** NewInterfaces;
+
+    if (Conv->NumOutputInterfaces == Conv->MaxOutputInterfaces) {
+        Conv->MaxOutputInterfaces = max(16, Conv->MaxOutputInterfaces * 2);
+        NewInterfaces = ConvAlloc(Conv, Conv->MaxOutputInterfaces * sizeof(struct INTERFACE*));
+        if (NewInterfaces == NULL) {
+            return ERROR_NOT_ENOUGH_MEMORY;
+        }
+        if (Conv->NumOutputInterfaces > 0) {
+            memcpy(NewInterfaces, Conv->OutputInterfaces,
+                Conv->NumOutputInterfaces * sizeof(struct INTERFACE*));
+        }
+        Conv->OutputInterfaces = NewInterfaces;
+    }
+    Conv->OutputInterfaces[Conv->NumOutputInterfaces++] = Interface;
+
+    return WriteInterfaceDesc(Conv, Interface);
+}
+
+void PrintInterface(struct CONVERSION* Conv, struct INTERFACE* Interface)
+{
+    switch (Interface->Type) {
+    case PCAPNG_LINKTYPE_ETHERNET:
+        printf("IF: medium=eth  ID=%u\tIfIndex=%u", Interface->PcapNgIfIndex, Interface->LowerIfIndex);
+        break;
+    case PCAPNG_LINKTYPE_IEEE802_11:
+        printf("IF: medium=wifi ID=%u\tIfIndex=%u", Interface->PcapNgIfIndex, Interface->LowerIfIndex);
+        break;
+    case PCAPNG_LINKTYPE_RAW:
+        printf("IF: medium=mbb  ID=%u\tIfIndex=%u", Interface->PcapNgIfIndex, Interface->LowerIfIndex);
+        break;
+    }
+    if (Interface->LowerIfIndex != Interface->MiniportIfIndex) {
+        printf("\t(LWF over IfIndex %u)", Interface->MiniportIfIndex);
+    }
+    if (Interface->Name != NULL) {
+        printf("\t%s", Interface->Name);
+    }
+    if (Conv->NumInputs > 1) {
+        printf("\tin %s", Conv->Inputs[Interface->Input].Name);
+    }
+    printf("\n");
+}
+
+int WriteInterfaces(struct CONVERSION* Conv)
+{
+    // Sorts the interfaces, writes them to the pcapng file, and prints them
+    // for user reference.
+
+    int Err;
+    struct INTERFACE** InterfaceArray;
+    struct INTERFACE* Interface;
+    unsigned int i, j;
+
+    InterfaceArray = ConvAlloc(Conv, Conv->NumInterfaces * sizeof(struct INTERFACE*));
+    if (InterfaceArray == NULL) {
+        return ERROR_NOT_ENOUGH_MEMORY;
+    }
+
+    j = 0;
+    for (i = 0; i < Conv->InterfaceTableSize; i++) {
+        if (Conv->InterfaceTable[i].Iface != NULL) {
+            InterfaceArray[j++] = Conv->InterfaceTable[i].Iface;
+        }
+    }
+
+    qsort(InterfaceArray, Conv->NumInterfaces, sizeof(struct INTERFACE*), InterfaceCompareFn);
+
+    for (i = 0; i < Conv->NumInterfaces; i++) {
+        Interface = InterfaceArray[i];
+        Interface->PcapNgIfIndex = i;
+        Err = WriteInterface(Conv, Interface);
+        if (Err != NO_ERROR) {
+            return Err;
+        }
+        if (!Conv->Options.Quiet) {
+            PrintInterface(Conv, Interface);
+        }
+    }
+    return NO_ERROR;
+}
+
+struct EVENT_SCHEMA FallbackSchema = {0}; // Usable == FALSE
+
+// Per-event view used to read ndiscap fields.
+struct NDISCAP_EVENT {
+    struct CONVERSION* Conv;
+    PEVENT_RECORD Record;
+    struct EVENT_SCHEMA* Schema;
+    BOOLEAN Walked;
+    unsigned long Offset[NDISCAP_PROP_COUNT];
+};
+
+// Computes the total size in bytes of property i, starting at Data. If Data
+// is NULL, succeeds only if the size doesn't depend on the event contents.
+// Values holds the values of previously walked integer properties, which is
+// how length and count references are resolved.
+BOOLEAN GetSchemaPropSize(
+    struct EVENT_SCHEMA* Schema,
+    unsigned long i,
+    const BYTE* Data,
+    unsigned long Remaining,
+    BOOLEAN Is32Bit,
+    unsigned long* Values,
+    unsigned long* Size
+    )
+{
+    struct SCHEMA_PROP* Prop = &Schema->Props[i];
+    unsigned long Count;
+    unsigned long Element;
+    unsigned long Total = 0;
+    unsigned long ElementSize;
+    unsigned long Length;
+    unsigned long m;
+
+    if (Prop->Flags & PropertyParamCount) {
+        if (Data == NULL || Prop->Count >= Schema->NumProps) {
+            return FALSE;
+        }
+        Count = Values[Prop->Count];
+    } else {
+        Count = Prop->Count;
+    }
+
+    if (Prop->Flags & PropertyParamLength) {
+        if (Data == NULL || Prop->Length >= Schema->NumProps) {
+            return FALSE;
+        }
+        Length = Values[Prop->Length];
+    } else {
+        Length = Prop->Length;
+    }
+
+    for (Element = 0; Element < Count; Element++) {
+        if (Prop->Flags & PropertyStruct) {
+            ElementSize = 0;
+            for (m = Prop->InType; m < (unsigned long)Prop->InType + Prop->NumMembers; m++) {
+                unsigned long MemberSize;
+                if (m >= Schema->NumProps ||
+                    !GetSchemaPropSize(
+                        Schema, m,
+                        Data == NULL ? NULL : Data + Total + ElementSize,
+                        Remaining - Total - ElementSize,
+                        Is32Bit, Values, &MemberSize)) {
+                    return FALSE;
+                }
+                ElementSize += MemberSize;
+            }
+        } else {
+            switch (Prop->InType) {
+            case TDH_INTYPE_INT8:
+            case TDH_INTYPE_UINT8:
+                ElementSize = 1;
+                break;
+            case TDH_INTYPE_INT16:
+            case TDH_INTYPE_UINT16:
+                ElementSize = 2;
+                break;
+            case TDH_INTYPE_INT32:
+            case TDH_INTYPE_UINT32:
+            case TDH_INTYPE_HEXINT32:
+            case TDH_INTYPE_FLOAT:
+            case TDH_INTYPE_BOOLEAN:
+                ElementSize = 4;
+                break;
+            case TDH_INTYPE_INT64:
+            case TDH_INTYPE_UINT64:
+            case TDH_INTYPE_HEXINT64:
+            case TDH_INTYPE_DOUBLE:
+            case TDH_INTYPE_FILETIME:
+                ElementSize = 8;
+                break;
+            case TDH_INTYPE_GUID:
+            case TDH_INTYPE_SYSTEMTIME:
+                ElementSize = 16;
+                break;
+            case TDH_INTYPE_POINTER:
+                ElementSize = Is32Bit ? 4 : 8;
+                break;
+            case TDH_INTYPE_BINARY:
+                ElementSize = Length;
+                break;
+            case TDH_INTYPE_UNICODESTRING:
+            case TDH_INTYPE_ANSISTRING:
+                {
+                    unsigned long CharSize = (Prop->InType == TDH_INTYPE_UNICODESTRING) ? 2 : 1;
+                    if (Length != 0) {
+                        ElementSize = Length * CharSize;
+                    } else {
+                        // Null-terminated; the size depends on the contents.
+                        const BYTE* Str;
+                        unsigned long Avail;
+                        if (Data == NULL) {
+                            return FALSE;
+                        }
+                        Str = Data + Total;
+                        Avail = Remaining - Total;
+                        for (ElementSize = 0; ; ElementSize += CharSize) {
+                            if (ElementSize + CharSize > Avail) {
+                                return FALSE;
+                            }
+                            if (Str[ElementSize] == 0 &&
+                                (CharSize == 1 || Str[ElementSize + 1] == 0)) {
+                                ElementSize += CharSize;
+                                break;
+                            }
+                        }
+                    }
+                }
+                break;
+            default:
+                // SIDs, counted strings etc. are not used by ndiscap.
+                return FALSE;
+            }
+        }
+
+        if (Data != NULL) {
+            if (ElementSize > Remaining - Total) {
+                return FALSE;
+            }
+            // Remember small integers in case later properties refer to them.
+            if (Count == 1 && !(Prop->Flags & PropertyStruct)) {
+                if (ElementSize == 4) {
+                    Values[i] = *(UNALIGNED const ULONG*)Data;
+                } else if (ElementSize == 2) {
+                    Values[i] = *(UNALIGNED const USHORT*)Data;
+                } else if (ElementSize == 1) {
+                    Values[i] = *Data;
+                }
+            }
+        }
+        Total += ElementSize;
+    }
+
+    *Size = Total;
+    return TRUE;
+}
+
+// Leaves the schema unusable if it can't be resolved; running out of memory
+// also stops the conversion.
+void ResolveEventSchema(struct CONVERSION* Conv, PEVENT_RECORD ev, struct EVENT_SCHEMA* Schema)
+{
+    ULONG Err;
+    ULONG InfoSize = 0;
+    PTRACE_EVENT_INFO Info = NULL;
+    BOOLEAN Is32Bit = !!(ev->EventHeader.Flags & EVENT_HEADER_FLAG_32_BIT_HEADER);
+    BOOLEAN Fixed = TRUE;
+    unsigned long Offset = 0;
+    unsigned long i, j;
+
+    Schema->Id = ev->EventHeader.EventDescriptor.Id;
+    Schema->Version = ev->EventHeader.EventDescriptor.Version;
+    Schema->Usable = FALSE;
+    for (j = 0; j < NDISCAP_PROP_COUNT; j++) {
+        Schema->PropIndex[j] = -1;
+        Schema->FixedOffset[j] = -1;
+    }
+
+    Err = TdhGetEventInformation(ev, 0, NULL, NULL, &InfoSize);
+    if (Err != ERROR_INSUFFICIENT_BUFFER) {
+        if (Conv->Options.Scan != ETL2PCAPNG_SCAN_JSON) {
+            printf("TdhGetEventInformation failed with %u\n", Err);
+        }
+        goto Done;
+    }
+    Info = (PTRACE_EVENT_INFO)malloc(InfoSize);
+    if (Info == NULL) {
+        printf("out of memory\n");
+        if (Conv->Err == NO_ERROR) {
+            Conv->Err = ERROR_NOT_ENOUGH_MEMORY;
+        }
+        goto Done;
+    }
+    Err = TdhGetEventInformation(ev, 0, NULL, Info, &InfoSize);
+    if (Err != NO_ERROR) {
+        if (Conv->Options.Scan != ETL2PCAPNG_SCAN_JSON) {
+            printf("TdhGetEventInformation failed with %u\n", Err);
+        }
+        goto Done;
+    }
+
+    if (Info->PropertyCount > MAX_SCHEMA_PROPS) {
+        goto Done;
+    }
+    Schema->NumProps = Info->PropertyCount;
+    Schema->NumTopLevelProps = Info->TopLevelPropertyCount;
+
+    for (i = 0; i < Info->PropertyCount; i++) {
+        EVENT_PROPERTY_INFO* PropInfo = &Info->EventPropertyInfoArray[i];
+        struct SCHEMA_PROP* Prop = &Schema->Props[i];
+        Prop->Flags = PropInfo->Flags;
+        if (PropInfo->Flags & PropertyStruct) {
+            Prop->InType = PropInfo->structType.StructStartIndex;
+            Prop->NumMembers = PropInfo->structType.NumOfStructMembers;
+        } else {
+            Prop->InType = PropInfo->nonStructType.InType;
+            Prop->NumMembers = 0;
+        }
+        Prop->Count = PropInfo->count;
+        Prop->Length = PropInfo->length;
+    }
+
+    for (i = 0; i < Info->TopLevelPropertyCount; i++) {
+        const wchar_t* Name = (const wchar_t*)((PBYTE)Info + Info->EventPropertyInfoArray[i].NameOffset);
+        unsigned long Size;
+        for (j = 0; j < NDISCAP_PROP_COUNT; j++) {
+            if (!wcscmp(Name, NdisCapPropNames[j])) {
+                Schema->PropIndex[j] = i;
+                if (Fixed) {
+                    Schema->FixedOffset[j] = Offset;
+                }
+            }
+        }
+        if (Fixed) {
+            if (GetSchemaPropSize(Schema, i, NULL, 0, Is32Bit, NULL, &Size)) {
+                Offset += Size;
+            } else {
+                Fixed = FALSE;
+            }
+        }
+    }
+
+    Schema->Usable = TRUE;
+
+Done:
+    if (Info != NULL) {
+        free(Info);
+    }
+}
+
+struct EVENT_SCHEMA* GetEventSchema(struct CONVERSION* Conv, PEVENT_RECORD ev)
+{
+    USHORT Id = ev->EventHeader.EventDescriptor.Id;
+    UCHAR Version = ev->EventHeader.EventDescriptor.Version;
+    struct EVENT_SCHEMA* Schema;
+    unsigned long i;
+
+    for (i = 0; i < Conv->NumEventSchemas; i++) {
+        Schema = &Conv->EventSchemas[i];
+        if (Schema->Id == Id && Schema->Version == Version) {
+            return Schema;
+        }
+    }
+
+    if (Conv->NumEventSchemas == MAX_EVENT_SCHEMAS) {
+        return &FallbackSchema;
+    }
+
+    Schema = &Conv->EventSchemas[Conv->NumEventSchemas++];
+    ResolveEventSchema(Conv, ev, Schema);
+    return Schema;
+}
+
+void NdisCapEventInit(struct CONVERSION* Conv, struct NDISCAP_EVENT* Event, PEVENT_RECORD ev)
+{
+    Event->Conv = Conv;
+    Event->Record = ev;
+    Event->Schema = GetEventSchema(Conv, ev);
+    Event->Walked = FALSE;
+}
+
+// Finds the offset of a property within UserData. Returns FALSE if the
+// caller should fall back to TdhGetProperty.
+BOOLEAN NdisCapGetOffset(struct NDISCAP_EVENT* Event, int Prop, unsigned long* Offset)
+{
+    struct EVENT_SCHEMA* Schema = Event->Schema;
+    PEVENT_RECORD ev = Event->Record;
+    unsigned long Values[MAX_SCHEMA_PROPS];
+    unsigned long Walk = 0;
+    unsigned long i, j;
+
+    if (!Schema->Usable || Schema->PropIndex[Prop] < 0) {
+        return FALSE;
+    }
+
+    if (Schema->FixedOffset[Prop] >= 0) {
+        *Offset = Schema->FixedOffset[Prop];
+        return TRUE;
+    }
+
+    if (!Event->Walked) {
+        for (j = 0; j < NDISCAP_PROP_COUNT; j++) {
+            Event->Offset[j] = ULONG_MAX;
+        }
+        for (i = 0; i < Schema->NumTopLevelProps; i++) {
+            unsigned long Size;
+            for (j = 0; j < NDISCAP_PROP_COUNT; j++) {
+                if (Schema->PropIndex[j] == (long)i) {
+                    Event->Offset[j] = Walk;
+                }
+            }
+            if (!GetSchemaPropSize(
+                    Schema, i, (const BYTE*)ev->UserData + Walk,
+                    ev->UserDataLength - Walk,
+                    !!(ev->EventHeader.Flags & EVENT_HEADER_FLAG_32_BIT_HEADER),
+                    Values, &Size)) {
+                break;
+            }
+            Walk += Size;
+        }
+        Event->Walked = TRUE;
+    }
+
+    if (Event->Offset[Prop] == ULONG_MAX) {
+        return FALSE;
+    }
+    *Offset = Event->Offset[Prop];
+    return TRUE;
+}
+
+int NdisCapGetUlong(struct NDISCAP_EVENT* Event, int Prop, unsigned long* Value)
+{
+    PEVENT_RECORD ev = Event->Record;
+    unsigned long Offset;
+    PROPERTY_DATA_DESCRIPTOR Desc;
+
+    if (NdisCapGetOffset(Event, Prop, &Offset)) {
+        if (Offset > ev->UserDataLength ||
+            ev->UserDataLength - Offset < sizeof(ULONG)) {
+            return ERROR_INVALID_DATA;
+        }
+        *Value = *(UNALIGNED ULONG*)((PBYTE)ev->UserData + Offset);
+        return NO_ERROR;
+    }
+
+    Desc.PropertyName = (ULONGLONG)NdisCapPropNames[Prop];
+    Desc.ArrayIndex = ULONG_MAX;
+    return TdhGetProperty(ev, 0, NULL, 1, &Desc, sizeof(*Value), (PBYTE)Value);
+}
+
+// Returns a pointer to Length bytes of property data. The data normally
+// points into UserData and is valid for the duration of the event callback.
+int NdisCapGetData(struct NDISCAP_EVENT* Event, int Prop, unsigned long Length, const BYTE** Data)
+{
+    PEVENT_RECORD ev = Event->Record;
+    unsigned long Offset;
+    PROPERTY_DATA_DESCRIPTOR Desc;
+    int Err;
+
+    if (NdisCapGetOffset(Event, Prop, &Offset)) {
+        if (Offset > ev->UserDataLength ||
+            ev->UserDataLength - Offset < Length) {
+            return ERROR_INVALID_DATA;
+        }
+        *Data = (PBYTE)ev->UserData + Offset;
+        return NO_ERROR;
+    }
+
+    if (Length > sizeof(Event->Conv->FallbackBuf)) {
+        return ERROR_INSUFFICIENT_BUFFER;
+    }
+    Desc.PropertyName = (ULONGLONG)NdisCapPropNames[Prop];
+    Desc.ArrayIndex = ULONG_MAX;
+    Err = TdhGetProperty(ev, 0, NULL, 1, &Desc, Length, (PBYTE)Event->Conv->FallbackBuf);
+    if (Err == NO_ERROR) {
+        *Data = (const BYTE*)Event->Conv->FallbackBuf;
+    }
+    return Err;
+}
+
+struct FORMATTER {
+    char* Buf;
+    unsigned long Size;
+    unsigned long Length;
+};
+
+void FmtInit(struct FORMATTER* Fmt, char* Buf, unsigned long Size)
+{
+    Fmt->Buf = Buf;
+    Fmt->Size = Size;
+    Fmt->Length = 0;
+}
+
+void FmtString(struct FORMATTER* Fmt, const char* Str)
+{
+    while (*Str != '\0' && Fmt->Length < Fmt->Size) {
+        Fmt->Buf[Fmt->Length++] = *Str++;
+    }
+}
+
+void FmtRadix(struct FORMATTER* Fmt, unsigned long Value, unsigned long Radix)
+{
+    char Digits[16];
+    int i = 0;
+
+    do {
+        Digits[i++] = "0123456789abcdef"[Value % Radix];
+        Value /= Radix;
+    } while (Value != 0);
+
+    while (i > 0 && Fmt->Length < Fmt->Size) {
+        Fmt->Buf[Fmt->Length++] = Digits[--i];
+    }
+}
+
+void FmtUlong(struct FORMATTER* Fmt, unsigned long Value)
+{
+    FmtRadix(Fmt, Value, 10);
+}
+
+void FmtLong(struct FORMATTER* Fmt, long Value)
+{
+    if (Value < 0) {
+        FmtString(Fmt, "-");
+        FmtRadix(Fmt, 0 - (unsigned long)Value, 10);
+    } else {
+        FmtRadix(Fmt, (unsigned long)Value, 10);
+    }
+}
+
+void FmtHex(struct FORMATTER* Fmt, unsigned long Value)
+{
+    FmtRadix(Fmt, Value, 16);
+}
+
+void FormatMetadataComment(struct FORMATTER* Fmt, PDOT11_EXTSTA_RECV_CONTEXT Metadata)
+{
+    FmtString(Fmt, "Packet Metadata: ReceiveFlags:0x");
+    FmtHex(Fmt, Metadata->uReceiveFlags);
+    FmtString(Fmt, ", PhyType:");
+    FmtString(Fmt,
+        Metadata->uPhyId < RTL_NUMBER_OF(DOT11_PHY_TYPE_NAMES) ?
+            DOT11_PHY_TYPE_NAMES[Metadata->uPhyId] : DOT11_PHY_TYPE_NAMES[0]);
+    FmtString(Fmt, ", CenterCh:");
+    FmtUlong(Fmt, Metadata->uChCenterFrequency);
+    FmtString(Fmt, ", NumMPDUsReceived:");
+    FmtUlong(Fmt, Metadata->usNumberOfMPDUsReceived);
+    FmtString(Fmt, ", RSSI:");
+    FmtLong(Fmt, Metadata->lRSSI);
+    FmtString(Fmt, ", DataRate:");
+    FmtUlong(Fmt, Metadata->ucDataRate);
+    FmtString(Fmt, ", ");
+}
+
+void FillRadiotapHeader(struct RADIOTAP_DOT11_METADATA* Radiotap, PDOT11_EXTSTA_RECV_CONTEXT Metadata)
+{
+    ZeroMemory(Radiotap, sizeof(*Radiotap));
+    if (Metadata == NULL) {
+        Radiotap->Header.Length = sizeof(Radiotap->Header);
+        return;
+    }
+    Radiotap->Header.Length = sizeof(*Radiotap);
+    Radiotap->Header.Present =
+        RADIOTAP_PRESENT_RATE | RADIOTAP_PRESENT_CHANNEL | RADIOTAP_PRESENT_DBM_ANTSIGNAL;
+    Radiotap->Rate = Metadata->ucDataRate;
+    Radiotap->ChannelFrequency = (USHORT)Metadata->uChCenterFrequency;
+    Radiotap->ChannelFlags =
+        Metadata->uChCenterFrequency < 3000 ? RADIOTAP_CHANNEL_2GHZ : RADIOTAP_CHANNEL_5GHZ;
+    Radiotap->AntennaSignal = (CHAR)Metadata->lRSSI;
+}
+
+// --split-size/--split-seconds: start a new output file once the current
+// one has reached SplitSize bytes or spans SplitSeconds of packets. The
+// check is made before each packet is written, on whichever thread writes
+// the packets, so with --pipeline switching files doesn't hold up
+// ProcessTrace.
+int SplitOutput(struct CONVERSION* Conv);
+
+// --index: makes room for the ranges of Conv's output interfaces.
+int GrowIndexInterfaces(struct CONVERSION* Conv)
+{
+    unsigned long NewMax = Conv->NumOutputInterfaces;
+    struct ETL2PCAPNG_INDEX_INTERFACE* New;
+
+    if (NewMax <= Conv->MaxIndexInterfaces) {
+        return NO_ERROR;
+    }
+    New = realloc(Conv->IndexInterfaces, NewMax * sizeof(struct ETL2PCAPNG_INDEX_INTERFACE));
+    if (New == NULL) {
+        printf("out of memory\n");
+        return ERROR_NOT_ENOUGH_MEMORY;
+    }
+    ZeroMemory(
+        New + Conv->MaxIndexInterfaces,
+        (NewMax - Conv->MaxIndexInterfaces) * sizeof(struct ETL2PCAPNG_INDEX_INTERFACE));
+    Conv->IndexInterfaces = New;
+    Conv->MaxIndexInterfaces = NewMax;
+    return NO_ERROR;
+}
+
+// --index: records a packet about to be written at the writer's current
+// position.
+int IndexPacket(struct CONVERSION* Conv, struct INTERFACE* Iface, ULARGE_INTEGER TimeStamp)
+{
+    unsigned long long Offset = Conv->Writer.Offset + Conv->Writer.BufferUsed;
+    struct ETL2PCAPNG_INDEX_INTERFACE* IndexIface;
+    struct ETL2PCAPNG_INDEX_ENTRY* Entry;
+    unsigned long NewMax;
+    void* New;
+    int Err;
+
+    // The interface's IDB has been written, so it's among them.
+    Err = GrowIndexInterfaces(Conv);
+    if (Err != NO_ERROR) {
+        return Err;
+    }
+    IndexIface = &Conv->IndexInterfaces[Iface->PcapNgIfIndex];
+    if (IndexIface->Packets == 0) {
+        IndexIface->FirstOffset = Offset;
+        IndexIface->FirstTimeStamp = TimeStamp.QuadPart;
+    }
+    IndexIface->LastTimeStamp = TimeStamp.QuadPart;
+    IndexIface->Packets++;
+
+    if (Conv->IndexPackets % Conv->Options.IndexInterval == 0) {
+        if (Conv->NumIndexEntries == Conv->MaxIndexEntries) {
+            NewMax = Conv->MaxIndexEntries == 0 ? 1024 : Conv->MaxIndexEntries * 2;
+            New = realloc(Conv->IndexEntries, NewMax * sizeof(struct ETL2PCAPNG_INDEX_ENTRY));
+            if (New == NULL) {
+                printf("out of memory\n");
+                return ERROR_NOT_ENOUGH_MEMORY;
+            }
+            Conv->IndexEntries = New;
+            Conv->MaxIndexEntries = NewMax;
+        }
+        Entry = &Conv->IndexEntries[Conv->NumIndexEntries++];
+        Entry->Offset = Offset;
+        Entry->TimeStamp = TimeStamp.QuadPart;
+        Entry->InterfaceId = Iface->PcapNgIfIndex;
+        Entry->PacketNumber = (unsigned long)Conv->IndexPackets;
+    }
+    Conv->IndexPackets++;
+    return NO_ERROR;
+}
+
+// Writes one packet, attaching the PID and (for 802.11) the metadata from
+// the preceding tidPacketMetadata event in the format selected by
+// MetadataFormat.
+int WritePacket(struct CONVERSION* Conv, const struct PACKET_RECORD* Packet)
+{
+    struct INTERFACE* Iface = Packet->Iface;
+    const BYTE* PacketData = Packet->Data;
+    unsigned long PacketLength = Packet->Length;
+    ULARGE_INTEGER TimeStamp = Packet->TimeStamp;
+    PDOT11_EXTSTA_RECV_CONTEXT Metadata = Packet->Metadata;
+    struct PCAPNG_PACKET_FRAGMENT Frags[3];
+    unsigned long NumFrags = 0;
+    struct PCAPNG_OPTION Options[2];
+    unsigned long NumOptions = 0;
+    BYTE FrameControl[2];
+    struct RADIOTAP_DOT11_METADATA Radiotap;
+    struct CUSTOM_OPTION_PID PidOption;
+    struct CUSTOM_OPTION_DOT11_METADATA MetadataOption;
+    struct FORMATTER Fmt;
+    LONGLONG Start;
+    LONGLONG FormatStart;
+    LONGLONG WriteTicks;
+    int Err;
+
+    if (Conv->Options.SplitSize != 0 || Conv->Options.SplitSeconds != 0) {
+        if (Conv->SplitHasPackets &&
+            ((Conv->Options.SplitSize != 0 &&
+              Conv->Writer.Offset + Conv->Writer.BufferUsed >= Conv->Options.SplitSize) ||
+             (Conv->Options.SplitSeconds != 0 &&
+              TimeStamp.QuadPart - Conv->SplitStart >= Conv->Options.SplitSeconds * Conv->TimeStampsPerSecond))) {
+            Err = SplitOutput(Conv);
+            if (Err != NO_ERROR) {
+                return Err;
+            }
+        }
+        if (!Conv->SplitHasPackets) {
+            Conv->SplitHasPackets = TRUE;
+            Conv->SplitStart = TimeStamp.QuadPart;
+        }
+        if (Iface->FilePackets == 0) {
+            Iface->FileFirstTimeStamp = TimeStamp;
+        }
+        Iface->FileLastTimeStamp = TimeStamp;
+        Iface->FilePackets++;
+    }
+
+    if (Conv->Options.IndexInterval != 0) {
+        Err = IndexPacket(Conv, Iface, TimeStamp);
+        if (Err != NO_ERROR) {
+            return Err;
+        }
+    }
+
+    // Writes that happen while the block is built are counted separately.
+    Start = StatsNow(Conv);
+    WriteTicks = Conv->Stats.WriteTicks;
+
+    if (Iface->Type == PCAPNG_LINKTYPE_IEEE802_11) {
+        if (Conv->Options.MetadataFormat == ETL2PCAPNG_METADATA_RADIOTAP) {
+            FillRadiotapHeader(&Radiotap, Metadata);
+            Frags[NumFrags].Data = &Radiotap;
+            Frags[NumFrags].Length = Radiotap.Header.Length;
+            NumFrags++;
+        }
+
+        if (PacketLength >= sizeof(FrameControl) && PacketData[1] & 0x40) {
+            // Clear Protected bit in the case of 802.11
+            // Ndis captures will be decrypted in the etl file
+            //
+            // The packet data may point into the event itself, so write a
+            // patched copy of the frame control field followed by the rest
+            // of the frame rather than modifying it in place.
+
+            FrameControl[0] = PacketData[0];
+            FrameControl[1] = PacketData[1] & 0xBF; // _1011_1111_ - Clear "Protected Flag"
+            Frags[NumFrags].Data = FrameControl;
+            Frags[NumFrags].Length = sizeof(FrameControl);
+            NumFrags++;
+            PacketData += sizeof(FrameControl);
+            PacketLength -= sizeof(FrameControl);
+        }
+    }
+
+    Frags[NumFrags].Data = PacketData;
+    Frags[NumFrags].Length = PacketLength;
+    NumFrags++;
+
+    FormatStart = StatsNow(Conv);
+    if (Conv->Options.MetadataFormat == ETL2PCAPNG_METADATA_COMMENT) {
+        FmtInit(&Fmt, Conv->CommentBuf, sizeof(Conv->CommentBuf));
+        if (Metadata != NULL) {
+            FormatMetadataComment(&Fmt, Metadata);
+        }
+        FmtString(&Fmt, "PID=");
+        FmtLong(&Fmt, (long)Packet->ProcessId);
+        Options[NumOptions].Code = PCAPNG_OPTIONCODE_COMMENT;
+        Options[NumOptions].Length = (USHORT)Fmt.Length;
+        Options[NumOptions].Value = Fmt.Buf;
+        NumOptions++;
+    } else {
+        PidOption.Pen = ETL2PCAPNG_PEN;
+        PidOption.Type = CUSTOM_OPTION_TYPE_PID;
+        PidOption.ProcessId = Packet->ProcessId;
+        Options[NumOptions].Code = PCAPNG_OPTIONCODE_CUSTOM_BINARY;
+        Options[NumOptions].Length = sizeof(PidOption);
+        Options[NumOptions].Value = &PidOption;
+        NumOptions++;
+
+        // With radiotap the metadata is already in the radiotap header.
+        if (Metadata != NULL && Conv->Options.MetadataFormat == ETL2PCAPNG_METADATA_CUSTOM) {
+            MetadataOption.Pen = ETL2PCAPNG_PEN;
+            MetadataOption.Type = CUSTOM_OPTION_TYPE_DOT11_METADATA;
+            MetadataOption.ReceiveFlags = Metadata->uReceiveFlags;
+            MetadataOption.PhyId = Metadata->uPhyId;
+            MetadataOption.ChCenterFrequency = Metadata->uChCenterFrequency;
+            MetadataOption.NumMPDUsReceived = Metadata->usNumberOfMPDUsReceived;
+            MetadataOption.Rssi = Metadata->lRSSI;
+            MetadataOption.DataRate = Metadata->ucDataRate;
+            Options[NumOptions].Code = PCAPNG_OPTIONCODE_CUSTOM_BINARY;
+            Options[NumOptions].Length = sizeof(MetadataOption);
+            Options[NumOptions].Value = &MetadataOption;
+            NumOptions++;
+        }
+    }
+    Conv->Stats.FormatTicks += StatsNow(Conv) - FormatStart;
+
+    Err = PcapNgWriteEnhancedPacket(
+        &Conv->Writer,
+        Frags,
+        NumFrags,
+        Iface->PcapNgIfIndex,
+        Packet->IsSend,
+        TimeStamp.HighPart,
+        TimeStamp.LowPart,
+        Conv->Options.SnapLen,
+        Options,
+        NumOptions);
+
+    Conv->Stats.EncodeTicks += StatsNow(Conv) - Start - (Conv->Stats.WriteTicks - WriteTicks);
+    return Err;
+}
+
+// With --pipeline, EventCallback only parses events: it copies each packet
+// (and each new interface, so that the IDB stays ahead of the interface's
+// first packet) into PacketRing. EncoderThread takes the records off the
+// ring in order and builds the pcapng blocks, and a THREAD_SINK does the
+// writes on a third thread, so ProcessTrace never waits for encoding or I/O
+// unless the ring fills up.
+//
+// Packets are put in the ring in batches of up to PIPELINE_BATCH_PACKETS,
+// built in place in a reservation of PIPELINE_BATCH_SIZE bytes that is
+// trimmed to what was used when the batch is committed. That way the two
+// threads only synchronize once per batch, and the encoder works through
+// a batch at a time. A batch is committed when it's full and before
+// anything else (an interface, a flush or the end) is put in the ring.
+#define PIPELINE_RECORD_INTERFACE 0
+#define PIPELINE_RECORD_BATCH     1
+#define PIPELINE_RECORD_FLUSH     2
+
+#define PIPELINE_BATCH_PACKETS 256
+#define PIPELINE_BATCH_SIZE (256 * 1024) // more than the largest packet
+
+struct PIPELINE_RECORD {
+    BYTE Type;
+    unsigned long NumPackets; // PIPELINE_RECORD_BATCH, the PACKET_RECORDs that follow
+    struct INTERFACE* Iface; // PIPELINE_RECORD_INTERFACE
+};
+
+// The encoder won't look past the snap length, except at the 802.11 frame
+// control field, so only that much of a packet's data is copied.
+unsigned long BatchCopyLength(struct CONVERSION* Conv, const struct PACKET_RECORD* Packet)
+{
+    if (Conv->Options.SnapLen != 0 && Packet->Length > max(Conv->Options.SnapLen, 2)) {
+        return max(Conv->Options.SnapLen, 2);
+    }
+    return Packet->Length;
+}
+
+// The size of a packet in a batch: the record, the metadata and the data,
+// padded to 8 bytes.
+unsigned long BatchPacketSize(struct CONVERSION* Conv, const struct PACKET_RECORD* Packet)
+{
+    unsigned long Size = sizeof(struct PACKET_RECORD) + BatchCopyLength(Conv, Packet);
+
+    if (Packet->Metadata != NULL) {
+        Size += sizeof(DOT11_EXTSTA_RECV_CONTEXT);
+    }
+    return (Size + 7) & ~7ul;
+}
+
+#define BATCH_HEADER_SIZE ((sizeof(struct PIPELINE_RECORD) + 7) & ~7ul)
+
+DWORD WINAPI EncoderThread(LPVOID Context)
+{
+    struct PIPELINE_RECORD* Record;
+    const struct PACKET_RECORD* Packet;
+    unsigned long Length;
+    unsigned long i;
+    int Err = NO_ERROR;
+    struct CONVERSION* Conv = (struct CONVERSION*)Context;
+
+    while ((Record = (struct PIPELINE_RECORD*)RingPeek(&Conv->PacketRing, &Length)) != NULL) {
+        if (Record->Type == PIPELINE_RECORD_INTERFACE) {
+            Err = WriteInterface(Conv, Record->Iface);
+        } else if (Record->Type == PIPELINE_RECORD_FLUSH) {
+            Err = PcapNgWriterFlush(&Conv->Writer);
+        } else {
+            Packet = (const struct PACKET_RECORD*)((const BYTE*)Record + BATCH_HEADER_SIZE);
+            for (i = 0; i < Record->NumPackets && Err == NO_ERROR; i++) {
+                Err = WritePacket(Conv, Packet);
+                Packet = (const struct PACKET_RECORD*)((const BYTE*)Packet + BatchPacketSize(Conv, Packet));
+            }
+        }
+        RingRelease(&Conv->PacketRing, Length);
+        if (Err != NO_ERROR) {
+            // Makes RingReserve fail, so the parse side stops queueing.
+            RingClose(&Conv->PacketRing);
+            break;
+        }
+    }
+
+    return Err;
+}
+
+// Hands the batch being filled to the encoder.
+void CommitBatch(struct CONVERSION* Conv)
+{
+    if (Conv->Batch != NULL) {
+        RingTrim(&Conv->PacketRing, Conv->BatchUsed);
+        RingCommit(&Conv->PacketRing);
+        Conv->Batch = NULL;
+    }
+}
+
+int StartPipeline(struct CONVERSION* Conv)
+{
+    int Err;
+
+    Err = RingInit(&Conv->PacketRing, PIPELINE_RING_SIZE);
+    if (Err != NO_ERROR) {
+        printf("RingInit failed with %u\n", Err);
+        return Err;
+    }
+
+    Conv->Encoder = CreateThread(NULL, 0, EncoderThread, Conv, 0, NULL);
+    if (Conv->Encoder == NULL) {
+        Err = GetLastError();
+        printf("CreateThread failed with %u\n", Err);
+        RingCleanup(&Conv->PacketRing);
+        return Err;
+    }
+
+    return NO_ERROR;
+}
+
+// Waits for the encoder to drain the ring and returns its result.
+int StopPipeline(struct CONVERSION* Conv)
+{
+    DWORD ExitCode = NO_ERROR;
+
+    if (Conv->Encoder == NULL) {
+        return NO_ERROR;
+    }
+
+    CommitBatch(Conv);
+    RingClose(&Conv->PacketRing);
+    WaitForSingleObject(Conv->Encoder, INFINITE);
+    GetExitCodeThread(Conv->Encoder, &ExitCode);
+    CloseHandle(Conv->Encoder);
+    Conv->Encoder = NULL;
+    RingCleanup(&Conv->PacketRing);
+
+    return (int)ExitCode;
+}
+
+// Records the first error that stops the conversion of events; the trace
+// callbacks then stop ProcessTrace like for the limits.
+void FailConversion(struct CONVERSION* Conv, int Err)
+{
+    if (Err != NO_ERROR && Conv->Err == NO_ERROR) {
+        Conv->Err = Err;
+    }
+}
+
+void EmitInterface(struct CONVERSION* Conv, struct INTERFACE* Iface)
+{
+    struct PIPELINE_RECORD* Record;
+
+    if (Conv->Encoder == NULL) {
+        FailConversion(Conv, WriteInterface(Conv, Iface));
+        return;
+    }
+
+    CommitBatch(Conv);
+    Record = (struct PIPELINE_RECORD*)RingReserve(&Conv->PacketRing, sizeof(*Record));
+    if (Record == NULL) {
+        return; // the encoder failed; StopPipeline reports it
+    }
+    Record->Type = PIPELINE_RECORD_INTERFACE;
+    Record->Iface = Iface;
+    RingCommit(&Conv->PacketRing);
+}
+
+// Pushes everything converted so far to the output.
+int EmitFlush(struct CONVERSION* Conv)
+{
+    struct PIPELINE_RECORD* Record;
+
+    if (Conv->Encoder == NULL) {
+        return PcapNgWriterFlush(&Conv->Writer);
+    }
+
+    CommitBatch(Conv);
+    Record = (struct PIPELINE_RECORD*)RingReserve(&Conv->PacketRing, sizeof(*Record));
+    if (Record == NULL) {
+        return ERROR_CANCELLED; // the encoder failed; StopPipeline reports it
+    }
+    Record->Type = PIPELINE_RECORD_FLUSH;
+    RingCommit(&Conv->PacketRing);
+    return NO_ERROR;
+}
+
+void EmitPacket(struct CONVERSION* Conv, const struct PACKET_RECORD* Packet)
+{
+    struct PACKET_RECORD* Copy;
+    BYTE* Data;
+    unsigned long Size;
+
+    if (Conv->Encoder == NULL) {
+        FailConversion(Conv, WritePacket(Conv, Packet));
+        return;
+    }
+
+    Size = BatchPacketSize(Conv, Packet);
+    if (Conv->Batch != NULL &&
+        (Conv->Batch->NumPackets == PIPELINE_BATCH_PACKETS || PIPELINE_BATCH_SIZE - Conv->BatchUsed < Size)) {
+        CommitBatch(Conv);
+    }
+    if (Conv->Batch == NULL) {
+        Conv->Batch = (struct PIPELINE_RECORD*)RingReserve(&Conv->PacketRing, PIPELINE_BATCH_SIZE);
+        if (Conv->Batch == NULL) {
+            return; // the encoder failed; StopPipeline reports it
+        }
+        Conv->Batch->Type = PIPELINE_RECORD_BATCH;
+        Conv->Batch->NumPackets = 0;
+        Conv->BatchUsed = BATCH_HEADER_SIZE;
+    }
+
+    Copy = (struct PACKET_RECORD*)((BYTE*)Conv->Batch + Conv->BatchUsed);
+    *Copy = *Packet;
+    Data = (BYTE*)(Copy + 1);
+    if (Packet->Metadata != NULL) {
+        memcpy(Data, Packet->Metadata, sizeof(DOT11_EXTSTA_RECV_CONTEXT));
+        Copy->Metadata = (PDOT11_EXTSTA_RECV_CONTEXT)Data;
+        Data += sizeof(DOT11_EXTSTA_RECV_CONTEXT);
+    }
+    memcpy(Data, Packet->Data, BatchCopyLength(Conv, Packet));
+    Copy->Data = Data;
+    Conv->BatchUsed += Size;
+    Conv->Batch->NumPackets++;
+}
+
+// Conversion-time filters (struct ETL2PCAPNG_FILTER).
+BOOLEAN FilterEventHeader(const struct ETL2PCAPNG_FILTER* Filter, PEVENT_RECORD ev)
+{
+    BOOLEAN IsSend = !!(ev->EventHeader.EventDescriptor.Keyword & KW_SEND);
+
+    if ((Filter->Direction == ETL2PCAPNG_DIRECTION_SEND && !IsSend) ||
+        (Filter->Direction == ETL2PCAPNG_DIRECTION_RECV && IsSend)) {
+        return FALSE;
+    }
+    if (Filter->MatchPid && ev->EventHeader.ProcessId != Filter->Pid) {
+        return FALSE;
+    }
+    if (ev->EventHeader.TimeStamp.QuadPart < Filter->Start ||
+        ev->EventHeader.TimeStamp.QuadPart >= Filter->End) {
+        return FALSE;
+    }
+    return TRUE;
+}
+
+BOOLEAN FilterIfIndex(const struct ETL2PCAPNG_FILTER* Filter, unsigned long LowerIfIndex)
+{
+    unsigned long i;
+
+    if (Filter->NumIfIndex == 0) {
+        return TRUE;
+    }
+    for (i = 0; i < Filter->NumIfIndex; i++) {
+        if (Filter->IfIndex[i] == LowerIfIndex) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+// --parallel: whether the event is from the margin before the segment's
+// range, or with --dedup from the DEDUP_WINDOW after it, which are read but
+// belong to the neighbouring segments.
+BOOLEAN OutsideRange(struct CONVERSION* Conv, PEVENT_RECORD ev)
+{
+    return Conv->HasRange &&
+        (ev->EventHeader.TimeStamp.QuadPart < Conv->RangeStart ||
+         ev->EventHeader.TimeStamp.QuadPart >= Conv->RangeEnd);
+}
+
+// --parallel: where a segment stops reading. With --dedup, the copies of
+// the packets held at the end of the range can still be logged during the
+// next DEDUP_WINDOW, and a copy that is to be kept instead of a held one
+// (see DedupPacket) is written by the next segment, so the held one must
+// be dropped here too.
+LONGLONG RangeReadEnd(struct CONVERSION* Conv)
+{
+    if (Conv->Options.Dedup == ETL2PCAPNG_DEDUP_NONE || Conv->RangeEnd > MAXLONGLONG - DEDUP_WINDOW) {
+        return Conv->RangeEnd;
+    }
+    return Conv->RangeEnd + DEDUP_WINDOW;
+}
+
+// Drops the state of a packet whose event was filtered out: metadata is
+// only ever for the packet that follows it, and a fragment that's kept
+// without the rest of its packet would be written as a truncated frame.
+void RejectEvent(struct INPUT* Input, PEVENT_RECORD ev)
+{
+    struct EVENT_ID_STATS* Counts;
+
+    if (CountEvents(Input->Conv)) {
+        Counts = GetEventIdStats(Input->Conv, ev->EventHeader.EventDescriptor.Id);
+        if (Counts != NULL) {
+            Counts->Filtered++;
+        }
+    }
+    Input->AddMetadata = FALSE;
+    Input->AuxFragBufOffset = 0;
+    if (Input->Conv->Pass2 && !OutsideRange(Input->Conv, ev) &&
+        ev->EventHeader.EventDescriptor.Id != tidPacketMetadata &&
+        !!(ev->EventHeader.EventDescriptor.Keyword & KW_PACKET_END)) {
+        Input->Conv->NumFramesFiltered++;
+    }
+}
+
+// --max-packets/--max-bytes, 0 for no limit. Once a limit is reached no
+// more packets are converted, and ProcessTrace is stopped at the end of the
+// current buffer (see BufferCallback).
+BOOLEAN CheckLimits(struct CONVERSION* Conv, unsigned long PacketLength)
+{
+    unsigned long CapturedLength = PacketLength;
+    const struct ETL2PCAPNG_OPTIONS* Options = &Conv->Options;
+
+    if (Options->SnapLen != 0 && CapturedLength > Options->SnapLen) {
+        CapturedLength = Options->SnapLen;
+    }
+    if ((Options->MaxPackets != 0 && Conv->NumFramesConverted >= Options->MaxPackets) ||
+        (Options->MaxBytes != 0 && Conv->NumBytesConverted + CapturedLength > Options->MaxBytes)) {
+        Conv->LimitReached = TRUE;
+    }
+    if (!Conv->LimitReached) {
+        Conv->NumBytesConverted += CapturedLength;
+    }
+    return !Conv->LimitReached;
+}
+
+// Writes a complete packet, unless a limit has been reached.
+void ConvertPacket(struct CONVERSION* Conv, const struct PACKET_RECORD* Packet)
+{
+    struct INTERFACE* Iface = Packet->Iface;
+    LONGLONG Start;
+
+    if (Conv->LimitReached || !CheckLimits(Conv, Packet->Length)) {
+        return;
+    }
+
+    Start = StatsNow(Conv);
+    EmitPacket(Conv, Packet);
+    Conv->Stats.EmitTicks += StatsNow(Conv) - Start;
+
+    if (Iface->Packets == 0) {
+        Iface->FirstTimeStamp = Packet->TimeStamp;
+    }
+    Iface->LastTimeStamp = Packet->TimeStamp;
+    Iface->Packets++;
+    Iface->Bytes += Packet->Length;
+    if (Packet->IsSend) {
+        Iface->PacketsSent++;
+    }
+    Conv->NumFramesConverted++;
+}
+
+// --dedup: ndiscap logs a packet once on every layer of the stack that it
+// goes through (the miniport and each filter bound over it), so the same
+// frame shows up on several interfaces of the same MiniportIfIndex, a few
+// microseconds apart. Packets are held back for DEDUP_WINDOW, and a packet
+// with the same contents, direction and length on another interface of the
+// same miniport within that time is taken to be the same frame, of which
+// only one copy is written. Sends go down through the layers and receives
+// up, so the copy closest to the miniport (ETL2PCAPNG_DEDUP_MINIPORT) is
+// the last one of a send and the first one of a receive, and the top-most
+// one (ETL2PCAPNG_DEDUP_TOP) the other way around.
+//
+// The held packets are found through a chained hash table of their
+// sequence numbers, newest first, so that nothing has to be removed from
+// it: a chain ends at the first packet that has been released. Their data
+// is kept in a circular buffer. Both are of a fixed size; when either is
+// full, the oldest packet is released early.
+unsigned long long DedupHash(const BYTE* Data, unsigned long Length, unsigned long long Seed)
+{
+    unsigned long long Hash = Seed ^ (Length * 0x9e3779b97f4a7c15ull);
+    unsigned long long Word;
+    unsigned long i;
+
+    for (i = 0; i < Length; i += sizeof(Word)) {
+        Word = 0;
+        memcpy(&Word, Data + i, min(sizeof(Word), Length - i));
+        Hash = (Hash ^ Word) * 0xff51afd7ed558ccdull;
+        Hash ^= Hash >> 32;
+    }
+    return Hash;
+}
+
+// Writes out the oldest held packet, unless it was replaced by another copy.
+void DedupRelease(struct CONVERSION* Conv)
+{
+    struct DEDUP_PACKET* Held = &Conv->DedupPackets[Conv->DedupHead % DEDUP_MAX_PACKETS];
+
+    Conv->DedupHead++;
+    if (!Held->Dropped && !Held->OutsideRange) {
+        ConvertPacket(Conv, &Held->Packet);
+    }
+    if (Conv->DedupHead < Conv->DedupTail) {
+        Conv->DedupDataHead = Conv->DedupPackets[Conv->DedupHead % DEDUP_MAX_PACKETS].Offset;
+    } else {
+        Conv->DedupDataHead = 0;
+        Conv->DedupDataTail = 0;
+    }
+}
+
+// Releases the packets logged before Time - DEDUP_WINDOW (a FILETIME).
+void DedupExpire(struct CONVERSION* Conv, LONGLONG Time)
+{
+    while (Conv->DedupHead < Conv->DedupTail &&
+           Conv->DedupPackets[Conv->DedupHead % DEDUP_MAX_PACKETS].Time < Time - DEDUP_WINDOW) {
+        DedupRelease(Conv);
+    }
+}
+
+// Releases all held packets, e.g. at the end of the input.
+void DedupFlush(struct CONVERSION* Conv)
+{
+    while (Conv->DedupHead < Conv->DedupTail) {
+        DedupRelease(Conv);
+    }
+}
+
+// Returns the offset in DedupData of Length free bytes, releasing the
+// oldest packets until there is room.
+unsigned long DedupReserve(struct CONVERSION* Conv, unsigned long Length)
+{
+    for (;;) {
+        if (Conv->DedupDataTail >= Conv->DedupDataHead) {
+            if (DEDUP_BUFFER_SIZE - Conv->DedupDataTail >= Length) {
+                return Conv->DedupDataTail;
+            }
+            if (Conv->DedupDataHead > Length) {
+                return 0;
+            }
+        } else if (Conv->DedupDataHead - Conv->DedupDataTail > Length) {
+            return Conv->DedupDataTail;
+        }
+        DedupRelease(Conv);
+    }
+}
+
+void DedupPacket(struct CONVERSION* Conv, const struct PACKET_RECORD* Packet, LONGLONG Time, BOOLEAN OutsideRange)
+{
+    struct DEDUP_PACKET* Held;
+    struct INTERFACE* Iface = Packet->Iface;
+    unsigned long long Hash;
+    unsigned long long* Bucket;
+    unsigned long long Seq;
+    BOOLEAN KeepLater = (Conv->Options.Dedup == ETL2PCAPNG_DEDUP_MINIPORT) == Packet->IsSend;
+
+    DedupExpire(Conv, Time);
+
+    Hash = DedupHash(
+        Packet->Data, Packet->Length,
+        ((unsigned long long)Iface->Input << 33) | ((unsigned long long)Iface->MiniportIfIndex << 1) | Packet->IsSend);
+    Bucket = &Conv->DedupTable[Hash & (DEDUP_TABLE_SIZE - 1)];
+
+    for (Seq = *Bucket; Seq >= Conv->DedupHead; Seq = Held->Older) {
+        Held = &Conv->DedupPackets[Seq % DEDUP_MAX_PACKETS];
+        if (Held->Dropped || Held->Hash != Hash || Held->Packet.Length != Packet->Length ||
+            Held->Packet.IsSend != Packet->IsSend || Held->Packet.Iface == Iface ||
+            Held->Packet.Iface->Input != Iface->Input ||
+            Held->Packet.Iface->MiniportIfIndex != Iface->MiniportIfIndex ||
+            memcmp(Held->Packet.Data, Packet->Data, Packet->Length)) {
+            continue;
+        }
+        // Another copy of the same frame.
+        if (!KeepLater) {
+            if (!OutsideRange) {
+                Conv->NumFramesDuplicate++;
+            }
+            return;
+        }
+        if (!Held->OutsideRange) {
+            Conv->NumFramesDuplicate++;
+        }
+        Held->Dropped = TRUE;
+        break;
+    }
+
+    if (Conv->DedupTail - Conv->DedupHead == DEDUP_MAX_PACKETS) {
+        DedupRelease(Conv);
+    }
+    Held = &Conv->DedupPackets[Conv->DedupTail % DEDUP_MAX_PACKETS];
+    Held->Offset = DedupReserve(Conv, Packet->Length);
+    Conv->DedupDataTail = Held->Offset + Packet->Length;
+    memcpy(Conv->DedupData + Held->Offset, Packet->Data, Packet->Length);
+    Held->Packet = *Packet;
+    Held->Packet.Data = Conv->DedupData + Held->Offset;
+    if (Packet->Metadata != NULL) {
+        Held->Metadata = *Packet->Metadata;
+        Held->Packet.Metadata = &Held->Metadata;
+    }
+    Held->Older = *Bucket;
+    Held->Hash = Hash;
+    Held->Time = Time;
+    Held->Dropped = FALSE;
+    Held->OutsideRange = OutsideRange;
+    *Bucket = Conv->DedupTail++;
+}
+
+// A field of a packet event couldn't be read, so the event is skipped.
+// With --scan --json nothing but the JSON object may go to stdout, so this
+// is only counted (in the summary).
+void BadEventField(struct CONVERSION* Conv, const char* Field, int Err)
+{
+    Conv->Stats.BadEvents++;
+    if (Conv->Options.Scan != ETL2PCAPNG_SCAN_JSON) {
+        printf("Reading %s failed with %u\n", Field, Err);
+    }
+}
+
+// --scan: counts a packet event without reading the packet data, only its
+// FragmentSize. AuxFragBufOffset is the length so far of a multi-event
+// packet (nothing is copied to AuxFragBuf), and packets that a conversion
+// would drop as too large aren't counted either.
+void ScanEvent(struct INPUT* Input, struct INTERFACE* Iface, struct NDISCAP_EVENT* Event, PEVENT_RECORD ev)
+{
+    int Err;
+    unsigned long FragLength;
+    unsigned long PacketLength;
+    ULARGE_INTEGER TimeStamp;
+    struct CONVERSION* Conv = Input->Conv;
+
+    if (ev->EventHeader.EventDescriptor.Id == tidPacketMetadata) {
+        return;
+    }
+
+    Err = NdisCapGetUlong(Event, NDISCAP_PROP_FRAGMENT_SIZE, &FragLength);
+    if (Err != NO_ERROR) {
+        BadEventField(Conv, "FragmentSize", Err);
+        return;
+    }
+
+    if (FragLength > MAX_PACKET_SIZE - Input->AuxFragBufOffset) {
+        Conv->Stats.TooLarge++;
+        return;
+    }
+    PacketLength = Input->AuxFragBufOffset + FragLength;
+    if (!(ev->EventHeader.EventDescriptor.Keyword & KW_PACKET_END)) {
+        Input->AuxFragBufOffset = PacketLength;
+        return;
+    }
+    Input->AuxFragBufOffset = 0;
+
+    TimeStamp.QuadPart = ev->EventHeader.TimeStamp.QuadPart;
+    if (Iface->Packets == 0) {
+        Iface->FirstTimeStamp = TimeStamp;
+    }
+    Iface->LastTimeStamp = TimeStamp;
+    Iface->Packets++;
+    Iface->Bytes += PacketLength;
+    Iface->MaxLength = max(Iface->MaxLength, PacketLength);
+    if (!!(ev->EventHeader.EventDescriptor.Keyword & KW_SEND)) {
+        Iface->PacketsSent++;
+    }
+    Conv->NumFramesConverted++;
+    if (Conv->Options.SnapLen != 0 && PacketLength > Conv->Options.SnapLen) {
+        PacketLength = Conv->Options.SnapLen;
+    }
+    Conv->NumBytesConverted += PacketLength;
+}
+
+void ConvertEvent(struct INPUT* Input, PEVENT_RECORD ev)
+{
+    int Err;
+    unsigned long LowerIfIndex;
+    struct INTERFACE* Iface;
+    unsigned long FragLength;
+    const BYTE* Fragment;
+    struct NDISCAP_EVENT Event;
+    ULARGE_INTEGER TimeStamp;
+    struct CONVERSION* Conv = Input->Conv;
+    struct EVENT_ID_STATS* Counts;
+    struct PACKET_RECORD Packet;
+    LONGLONG Start;
+    USHORT Id;
+    ULONGLONG Keyword;
+
+    if (!IsEqualGUID(&ev->EventHeader.ProviderId, &NdisCapId)) {
+        if (CountEvents(Conv)) {
+            Conv->Stats.OtherEvents++;
+        }
+        return;
+    }
+
+    // The descriptor is read once, here.
+    Id = ev->EventHeader.EventDescriptor.Id;
+    Keyword = ev->EventHeader.EventDescriptor.Keyword;
+
+    if (CountEvents(Conv)) {
+        Counts = GetEventIdStats(Conv, Id);
+        if (Counts != NULL) {
+            Counts->Seen++;
+        }
+    }
+
+    if (Id != tidPacketFragment && Id != tidPacketMetadata && Id != tidVMSwitchPacketFragment) {
+        return;
+    }
+
+    // --parallel: the packets still in progress at the end of the range
+    // are left to the next segment.
+    if (Conv->HasRange && ev->EventHeader.TimeStamp.QuadPart >= RangeReadEnd(Conv)) {
+        Conv->RangeDone = TRUE;
+        return;
+    }
+
+    if (!FilterEventHeader(&Conv->Options.Filter, ev)) {
+        RejectEvent(Input, ev);
+        return;
+    }
+
+    NdisCapEventInit(Conv, &Event, ev);
+
+    Err = NdisCapGetUlong(&Event, NDISCAP_PROP_LOWER_IFINDEX, &LowerIfIndex);
+    if (Err != NO_ERROR) {
+        BadEventField(Conv, "LowerIfIndex", Err);
+        return;
+    }
+
+    if (!FilterIfIndex(&Conv->Options.Filter, LowerIfIndex)) {
+        RejectEvent(Input, ev);
+        return;
+    }
+
+    Iface = GetInterface(Conv, Input->Index, LowerIfIndex);
+
+    if (!Conv->Pass2 || Iface == NULL) {
+        short Type;
+        if (!!(Keyword & KW_MEDIA_NATIVE_802_11)) {
+            Type = PCAPNG_LINKTYPE_IEEE802_11;
+        } else if (!!(Keyword & KW_MEDIA_WIRELESS_WAN)) {
+            Type = PCAPNG_LINKTYPE_RAW;
+        } else {
+            Type = PCAPNG_LINKTYPE_ETHERNET;
+        }
+        // Record the IfIndex if it's a new one.
+        if (Iface == NULL) {
+            unsigned long MiniportIfIndex;
+            if (Conv->Pass2 && Conv->Options.SortInterfaces) {
+                // We generated the list of interfaces directly from the
+                // packet traces themselves, so there must be a bug.
+                printf("ERROR: packet with unrecognized IfIndex\n");
+                FailConversion(Conv, ERROR_INVALID_DATA);
+                return;
+            }
+            Err = NdisCapGetUlong(&Event, NDISCAP_PROP_MINIPORT_IFINDEX, &MiniportIfIndex);
+            if (Err != NO_ERROR) {
+                BadEventField(Conv, "MiniportIfIndex", Err);
+                return;
+            }
+            Iface = AddInterface(Conv, Input->Index, LowerIfIndex, MiniportIfIndex, Type);
+            if (Iface == NULL) {
+                return; // out of memory, see ConvAlloc
+            }
+            if (Conv->Options.Scan != ETL2PCAPNG_SCAN_NONE) {
+                // Listed by PrintScan at the end.
+                Iface->PcapNgIfIndex = Conv->NumInterfaces - 1;
+            } else if (!Conv->Options.SortInterfaces) {
+                // Single-pass mode: pcapng only requires an IDB to precede
+                // the first packet that references it, so write it now.
+                Iface->PcapNgIfIndex = Conv->NumInterfaces - 1;
+                Start = StatsNow(Conv);
+                EmitInterface(Conv, Iface);
+                Conv->Stats.EmitTicks += StatsNow(Conv) - Start;
+                if (!Conv->Options.Quiet) {
+                    PrintInterface(Conv, Iface);
+                }
+            }
+        } else if (Iface->Type != Type && Conv->Options.Scan != ETL2PCAPNG_SCAN_JSON) {
+            printf("WARNING: inconsistent media type in packet events!\n");
+        }
+        if (!Conv->Pass2) {
+            return;
+        }
+    }
+
+    if (Conv->Options.Scan != ETL2PCAPNG_SCAN_NONE) {
+        ScanEvent(Input, Iface, &Event, ev);
+        return;
+    }
+
+    //Save off Ndis/Wlan metadata to be added to the next packet
+    if (Id == tidPacketMetadata)
+    {
+        unsigned long MetadataLength = 0;
+        const BYTE* Metadata;
+        Err = NdisCapGetUlong(&Event, NDISCAP_PROP_METADATA_SIZE, &MetadataLength);
+        if (Err != NO_ERROR) {
+            BadEventField(Conv, "MetadataSize", Err);
+            return;
+        }
+
+        if (MetadataLength != sizeof(Input->PacketMetadata))
+        {
+            printf("Unknown Metadata length. Expected %u, got %u\n", sizeof(DOT11_EXTSTA_RECV_CONTEXT), MetadataLength);
+            Conv->Stats.BadMetadataLength++;
+            return;
+        }
+
+        Err = NdisCapGetData(&Event, NDISCAP_PROP_METADATA, MetadataLength, &Metadata);
+        if (Err != NO_ERROR) {
+            BadEventField(Conv, "Metadata", Err);
+            return;
+        }
+        memcpy(&Input->PacketMetadata, Metadata, MetadataLength);
+
+        Input->AddMetadata = TRUE;
+        return;
+    }
+
+    // N.B.: Here we are reading the FragmentSize property to get the
+    // total size of the packet, and then reading that many bytes from
+    // the start of the Fragment property. This is unorthodox (normally
+    // the size of a property comes from its schema) but required due to
+    // the way ndiscap puts packet contents in multiple adjacent properties
+    // (which happen to be contiguous in memory).
+
+    Err = NdisCapGetUlong(&Event, NDISCAP_PROP_FRAGMENT_SIZE, &FragLength);
+    if (Err != NO_ERROR) {
+        BadEventField(Conv, "FragmentSize", Err);
+        return;
+    }
+
+    if (FragLength > RTL_NUMBER_OF(Input->AuxFragBuf) - Input->AuxFragBufOffset) {
+        printf("Packet too large (size = %u) and skipped\n", Input->AuxFragBufOffset + FragLength);
+        Conv->Stats.TooLarge++;
+        return;
+    }
+
+    Err = NdisCapGetData(&Event, NDISCAP_PROP_FRAGMENT, FragLength, &Fragment);
+    if (Err != NO_ERROR) {
+        BadEventField(Conv, "Fragment", Err);
+        return;
+    }
+
+    // 100ns since 1/1/1601 -> usec since 1/1/1970, or 100ns units (see
+    // TsResol).
+    if (Conv->Options.TsResol == ETL2PCAPNG_TSRESOL_100NS) {
+        TimeStamp.QuadPart = ev->EventHeader.TimeStamp.QuadPart - Conv->TimeStampBias;
+    } else {
+        TimeStamp.QuadPart = (ev->EventHeader.TimeStamp.QuadPart / 10) - FILETIME_UNIX_EPOCH_SECONDS * 1000000;
+    }
+
+    // The KW_PACKET_START and KW_PACKET_END keywords are used as follows:
+    // -A single-event packet has both KW_PACKET_START and KW_PACKET_END.
+    // -A multi-event packet consists of an event with KW_PACKET_START followed
+    //  by an event with KW_PACKET_END, with zero or more events with neither
+    //  keyword in between.
+    //
+    // So, we accumulate fragments in AuxFragBuf until KW_PACKET_END is
+    // encountered, then call PcapNgWriteEnhancedPacket and start over. There's
+    // no need for us to even look for KW_PACKET_START. A packet that arrives
+    // in a single event is written straight from the event's UserData
+    // without going through AuxFragBuf.
+    //
+    // NB: Starting with Windows 8.1, only single-event packets are traced.
+    // This logic is here to support packet captures from older systems.
+
+    if (!!(Keyword & KW_PACKET_END)) {
+        const BYTE* PacketData;
+        unsigned long PacketLength;
+
+        if (Input->AuxFragBufOffset == 0) {
+            PacketData = Fragment;
+            PacketLength = FragLength;
+        } else {
+            memcpy(Input->AuxFragBuf + Input->AuxFragBufOffset, Fragment, FragLength);
+            PacketData = (const BYTE*)Input->AuxFragBuf;
+            PacketLength = Input->AuxFragBufOffset + FragLength;
+        }
+
+        Packet.Iface = Iface;
+        Packet.Data = PacketData;
+        Packet.Metadata = Input->AddMetadata ? &Input->PacketMetadata : NULL;
+        Packet.TimeStamp = TimeStamp;
+        Packet.Length = PacketLength;
+        Packet.ProcessId = ev->EventHeader.ProcessId;
+        Packet.IsSend = !!(Keyword & KW_SEND);
+
+        if (Conv->Options.Dedup != ETL2PCAPNG_DEDUP_NONE) {
+            DedupPacket(Conv, &Packet, ev->EventHeader.TimeStamp.QuadPart, OutsideRange(Conv, ev));
+        } else if (!OutsideRange(Conv, ev)) {
+            ConvertPacket(Conv, &Packet);
+        }
+
+        Input->AddMetadata = FALSE;
+        memset(&Input->PacketMetadata, 0, sizeof(DOT11_EXTSTA_RECV_CONTEXT));
+
+        Input->AuxFragBufOffset = 0;
+    } else {
+        memcpy(Input->AuxFragBuf + Input->AuxFragBufOffset, Fragment, FragLength);
+        Input->AuxFragBufOffset += FragLength;
+    }
+}
+
+void WINAPI EventCallback(PEVENT_RECORD ev)
+{
+    struct INPUT* Input = (struct INPUT*)ev->UserContext;
+    LONGLONG Start = StatsNow(Input->Conv);
+
+    Input->Conv->NumEvents++;
+    ConvertEvent(Input, ev);
+    Input->Conv->Stats.CallbackTicks += StatsNow(Input->Conv) - Start;
+}
+
+// Total size of the input files, or 0 if it can't be determined (e.g. with
+// --live).
+unsigned long long GetInputSize(struct CONVERSION* Conv)
+{
+    WIN32_FILE_ATTRIBUTE_DATA InFileInfo;
+    ULARGE_INTEGER InFileSize;
+    unsigned long long Total = 0;
+    unsigned long i;
+
+    for (i = 0; i < Conv->NumInputs; i++) {
+        if (Conv->Inputs[i].FileName == NULL ||
+            !GetFileAttributesEx(Conv->Inputs[i].FileName, GetFileExInfoStandard, &InFileInfo)) {
+            return 0;
+        }
+        InFileSize.HighPart = InFileInfo.nFileSizeHigh;
+        InFileSize.LowPart = InFileInfo.nFileSizeLow;
+        Total += InFileSize.QuadPart;
+    }
+    return Total;
+}
+
+// --progress: prints a status line about once a second while the input is
+// read. Fraction is the part of the input read so far, or negative if it
+// isn't known.
+#define PROGRESS_INTERVAL_MS 1000
+
+void PrintProgress(struct CONVERSION* Conv, double Fraction)
+{
+    ULONGLONG Now = GetTickCount64();
+    ULONGLONG Elapsed = Now - Conv->ProgressTime;
+
+    if (Conv->Options.Quiet || Elapsed < PROGRESS_INTERVAL_MS) {
+        return;
+    }
+
+    if (Conv->Options.SortInterfaces) {
+        printf("\rPass %u: ", Conv->Pass2 ? 2 : 1);
+    } else {
+        printf("\r");
+    }
+    if (Fraction >= 0) {
+        printf("%5.1f%% read, ", min(Fraction, 1.0) * 100);
+    }
+    printf("%llu events/s, %llu frames converted   ",
+        (Conv->NumEvents - Conv->ProgressEvents) * 1000 / Elapsed, Conv->NumFramesConverted);
+    fflush(stdout);
+
+    Conv->ProgressTime = Now;
+    Conv->ProgressEvents = Conv->NumEvents;
+    Conv->ProgressShown = TRUE;
+}
+
+// Number of overlapped writes kept in flight by --overlapped.
+#define OVERLAPPED_WRITES 4
+
+// Reserves disk space for the output up front so that NTFS doesn't have to
+// keep extending the file while we write it. The pcapng output is usually a
+// bit smaller than the ETL input, so the input size is a good estimate; the
+// overlapped sink sets the real end of file when it's closed.
+void PreallocateOutput(struct CONVERSION* Conv)
+{
+    FILE_ALLOCATION_INFO AllocationInfo;
+
+    AllocationInfo.AllocationSize.QuadPart = GetInputSize(Conv);
+    if (AllocationInfo.AllocationSize.QuadPart == 0) {
+        return;
+    }
+
+    if (!SetFileInformationByHandle(Conv->OutFile, FileAllocationInfo, &AllocationInfo, sizeof(AllocationInfo))) {
+        printf("WARNING: preallocating the output failed with %u\n", GetLastError());
+    }
+}
+
+// --live: instead of reading an ETL file, start a real-time ETW session with
+// the packet capture provider enabled and convert its events as they are
+// delivered. ProcessTrace returns once the session is stopped (by
+// Etl2PcapngStopLive). Every live conversion has a session of its own,
+// named etl2pcapng-<pid>-<n> (see AllocConversion), so that several can run
+// on the machine at the same time.
+struct LIVE_SESSION_PROPERTIES {
+    EVENT_TRACE_PROPERTIES Properties;
+    wchar_t LoggerName[LIVE_SESSION_NAME_SIZE];
+};
+
+void InitLiveSessionProperties(struct LIVE_SESSION_PROPERTIES* Props)
+{
+    ZeroMemory(Props, sizeof(*Props));
+    Props->Properties.Wnode.BufferSize = sizeof(*Props);
+    Props->Properties.Wnode.Flags = WNODE_FLAG_TRACED_GUID;
+    Props->Properties.Wnode.ClientContext = 1; // QPC timestamps
+    Props->Properties.LogFileMode = EVENT_TRACE_REAL_TIME_MODE;
+    Props->Properties.BufferSize = 256; // KB
+    Props->Properties.MinimumBuffers = 64;
+    Props->Properties.MaximumBuffers = 256;
+    Props->Properties.FlushTimer = 1; // deliver partly filled buffers every second
+    Props->Properties.LoggerNameOffset = FIELD_OFFSET(struct LIVE_SESSION_PROPERTIES, LoggerName);
+}
+
+void StopLiveSession(struct CONVERSION* Conv)
+{
+    struct LIVE_SESSION_PROPERTIES Props;
+
+    InitLiveSessionProperties(&Props);
+    ControlTrace(0, Conv->LiveSessionName, &Props.Properties, EVENT_TRACE_CONTROL_STOP);
+}
+
+int StartLiveSession(struct CONVERSION* Conv)
+{
+    struct LIVE_SESSION_PROPERTIES Props;
+    int Err;
+
+    InitLiveSessionProperties(&Props);
+    Err = StartTrace(&Conv->LiveSession, Conv->LiveSessionName, &Props.Properties);
+    if (Err != NO_ERROR) {
+        printf("StartTrace failed with %u\n", Err);
+        if (Err == ERROR_ALREADY_EXISTS) {
+            // Only if an earlier process with the same PID didn't exit
+            // cleanly; the session may still be in use, so it's left alone.
+            printf("A session named %ws already exists (logman stop %ws -ets ends it).\n",
+                Conv->LiveSessionName, Conv->LiveSessionName);
+        } else if (Err == ERROR_ACCESS_DENIED) {
+            printf("Live conversion has to be run as administrator.\n");
+        }
+        Conv->LiveSession = 0;
+        return Err;
+    }
+
+    Err = EnableTraceEx2(
+        Conv->LiveSession, &NdisCapId, EVENT_CONTROL_CODE_ENABLE_PROVIDER,
+        TRACE_LEVEL_VERBOSE, 0, 0, 0, NULL);
+    if (Err != NO_ERROR) {
+        printf("EnableTraceEx2 failed with %u\n", Err);
+        StopLiveSession(Conv);
+        Conv->LiveSession = 0;
+        return Err;
+    }
+
+    return NO_ERROR;
+}
+
+void Etl2PcapngStopLive(struct CONVERSION* Conv)
+{
+    // ProcessTrace returns once the session is gone, and Etl2PcapngConvert
+    // then finishes the output as usual.
+    StopLiveSession(Conv);
+}
+
+// Called by ProcessTrace after each buffer of events. In live mode, flushing
+// here means a reader gets packets within about a second (the session's
+// FlushTimer) of them being logged. Returning FALSE stops ProcessTrace,
+// e.g. once the reader of a pipe has gone away, a limit is reached or the
+// conversion failed.
+ULONG WINAPI BufferCallback(PEVENT_TRACE_LOGFILE LogFile)
+{
+    struct INPUT* Input = (struct INPUT*)LogFile->Context;
+    struct CONVERSION* Conv = Input->Conv;
+    unsigned long long BytesRead = 0;
+    FILETIME Now;
+    unsigned long i;
+
+    if (Conv->Options.Live) {
+        // Don't hold packets back for --dedup longer than needed.
+        GetSystemTimeAsFileTime(&Now);
+        DedupExpire(Conv, ((LONGLONG)Now.dwHighDateTime << 32) | Now.dwLowDateTime);
+        if (EmitFlush(Conv) != NO_ERROR) {
+            return FALSE;
+        }
+    }
+
+    if (Conv->Options.ReportProgress) {
+        Input->BytesRead += LogFile->BufferSize;
+        for (i = 0; i < Conv->NumInputs; i++) {
+            BytesRead += Conv->Inputs[i].BytesRead;
+        }
+        PrintProgress(Conv, Conv->InputSize != 0 ? (double)BytesRead / Conv->InputSize : -1);
+    }
+
+    return !Conv->LimitReached && !Conv->RangeDone && Conv->Err == NO_ERROR;
+}
+
+// The same for the direct reader, which counts events instead of buffers.
+BOOLEAN DirectProgressCallback(PVOID Context, unsigned long long EventsDone, unsigned long long EventsTotal)
+{
+    struct CONVERSION* Conv = (struct CONVERSION*)Context;
+
+    if (Conv->Options.ReportProgress) {
+        PrintProgress(Conv, (double)EventsDone / EventsTotal);
+    }
+    return !Conv->LimitReached && !Conv->RangeDone && Conv->Err == NO_ERROR;
+}
+
+// The output can also be "-" for stdout or \\.\pipe\<name>, in which case
+// we create the pipe and wait for a reader (e.g. wireshark -k -i <pipe>).
+int OpenOutput(struct CONVERSION* Conv, wchar_t* OutFileName, DWORD Flags)
+{
+    int Err = NO_ERROR;
+
+    if (!wcscmp(OutFileName, L"-")) {
+        // Anything we print would corrupt the stream, so keep our own copy
+        // of the stdout handle and send the CRT's stdout to stderr instead.
+        if (!DuplicateHandle(
+                GetCurrentProcess(), GetStdHandle(STD_OUTPUT_HANDLE),
+                GetCurrentProcess(), &Conv->OutFile, 0, FALSE, DUPLICATE_SAME_ACCESS)) {
+            Err = GetLastError();
+            printf("DuplicateHandle failed with %u\n", Err);
+            Conv->OutFile = INVALID_HANDLE_VALUE;
+            return Err;
+        }
+        fflush(stdout);
+        _dup2(_fileno(stderr), _fileno(stdout));
+    } else if (!_wcsnicmp(OutFileName, L"\\\\.\\pipe\\", 9)) {
+        Conv->OutFile = CreateNamedPipe(
+            OutFileName, PIPE_ACCESS_OUTBOUND, PIPE_TYPE_BYTE | PIPE_WAIT,
+            1, PCAPNG_WRITER_MIN_BUFFER_SIZE, 0, 0, NULL);
+        if (Conv->OutFile == INVALID_HANDLE_VALUE) {
+            Err = GetLastError();
+            printf("CreateNamedPipe called on %ws failed with %u\n", OutFileName, Err);
+            return Err;
+        }
+        Conv->OutFileIsPipe = TRUE;
+        printf("Waiting for a reader to connect to %ws\n", OutFileName);
+        if (!ConnectNamedPipe(Conv->OutFile, NULL) && GetLastError() != ERROR_PIPE_CONNECTED) {
+            Err = GetLastError();
+            printf("ConnectNamedPipe failed with %u\n", Err);
+            return Err;
+        }
+    } else {
+        Conv->OutFile = CreateFile(OutFileName, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+                             Flags, NULL);
+        if (Conv->OutFile == INVALID_HANDLE_VALUE) {
+            Err = GetLastError();
+            printf("CreateFile called on %ws failed with %u\n", OutFileName, Err);
+            if (Err == ERROR_SHARING_VIOLATION) {
+                printf("The file appears to be open already.\n");
+            }
+        }
+    }
+
+    return Err;
+}
+
+void FreeConversion(struct CONVERSION* Conv)
+{
+    if (Conv != NULL) {
+        free(Conv->IndexEntries);
+        free(Conv->IndexInterfaces);
+        free(Conv->DedupPackets);
+        free(Conv->DedupTable);
+        free(Conv->DedupData);
+        free(Conv->Inputs);
+        free(Conv);
+    }
+}
+
+// Numbers the live sessions of this process.
+volatile LONG LiveSessionCount = 0;
+
+// Allocates the state for merging InFileNames into OutFileName (a single
+// input with a NULL name for --live and Etl2PcapngCreate). CONVERSION is
+// too big for the stack, so it's always on the heap; free it with
+// FreeConversion.
+struct CONVERSION* AllocConversion(
+    const struct ETL2PCAPNG_OPTIONS* Options,
+    wchar_t** InFileNames,
+    unsigned long NumInputs,
+    wchar_t* OutFileName)
+{
+    struct CONVERSION* Conv;
+    struct INPUT* Input;
+    wchar_t* BaseName;
+    wchar_t* p;
+    unsigned long i;
+
+    Conv = calloc(1, sizeof(struct CONVERSION));
+    if (Conv == NULL) {
+        return NULL;
+    }
+    Conv->Inputs = calloc(NumInputs, sizeof(struct INPUT));
+    if (Conv->Inputs == NULL) {
+        FreeConversion(Conv);
+        return NULL;
+    }
+    Conv->Options = *Options;
+    if (Options->TsResol == ETL2PCAPNG_TSRESOL_100NS) {
+        Conv->TimeStampsPerSecond = 10000000;
+        // --tsoffset: the IDB's if_tsoffset moves the epoch instead.
+        Conv->TimeStampBias = Options->TsOffset ? 0 : FILETIME_UNIX_EPOCH_SECONDS * 10000000;
+    } else {
+        Conv->TimeStampsPerSecond = 1000000;
+    }
+    Conv->NumInputs = NumInputs;
+    Conv->OutFileName = OutFileName;
+    Conv->OutFile = INVALID_HANDLE_VALUE;
+    ArenaInit(&Conv->Arena);
+
+    if (Options->Dedup != ETL2PCAPNG_DEDUP_NONE) {
+        Conv->DedupPackets = malloc(DEDUP_MAX_PACKETS * sizeof(struct DEDUP_PACKET));
+        Conv->DedupTable = calloc(DEDUP_TABLE_SIZE, sizeof(unsigned long long));
+        Conv->DedupData = malloc(DEDUP_BUFFER_SIZE);
+        if (Conv->DedupPackets == NULL || Conv->DedupTable == NULL || Conv->DedupData == NULL) {
+            FreeConversion(Conv);
+            return NULL;
+        }
+    }
+    Conv->DedupHead = 1;
+    Conv->DedupTail = 1;
+
+    if (Options->Live) {
+        // Named before the conversion starts, since Etl2PcapngStopLive can
+        // be called from another thread at any time.
+        StringCchPrintf(Conv->LiveSessionName, RTL_NUMBER_OF(Conv->LiveSessionName),
+            L"etl2pcapng-%u-%u", GetCurrentProcessId(), InterlockedIncrement(&LiveSessionCount));
+    }
+
+    for (i = 0; i < NumInputs; i++) {
+        Input = &Conv->Inputs[i];
+        Input->Conv = Conv;
+        Input->Index = i;
+        Input->FileName = InFileNames != NULL ? InFileNames[i] : NULL;
+        if (Input->FileName != NULL) {
+            BaseName = Input->FileName;
+            for (p = Input->FileName; *p != L'\0'; p++) {
+                if (*p == L'\\' || *p == L'/' || *p == L':') {
+                    BaseName = p + 1;
+                }
+            }
+            if (WideCharToMultiByte(
+                    CP_UTF8, 0, BaseName, -1, Input->Name, sizeof(Input->Name), NULL, NULL) == 0) {
+                Input->Name[0] = '\0';
+            }
+        }
+    }
+
+    return Conv;
+}
+
+double TicksToMs(LONGLONG Ticks)
+{
+    LARGE_INTEGER Frequency;
+
+    QueryPerformanceFrequency(&Frequency);
+    return (double)max(Ticks, 0) * 1000 / (double)Frequency.QuadPart;
+}
+
+// The counts of each ndiscap event id and of the other providers' events
+// (--stats and --scan).
+void PrintEventIdStats(struct CONVERSION* Conv)
+{
+    struct STATS* Stats = &Conv->Stats;
+    unsigned long i;
+
+    for (i = 0; i < Stats->NumEventIds; i++) {
+        printf("  id %u: %llu seen, %llu filtered out%s\n",
+            Stats->EventIds[i].Id, Stats->EventIds[i].Seen, Stats->EventIds[i].Filtered,
+            (Stats->EventIds[i].Id == tidPacketFragment ||
+             Stats->EventIds[i].Id == tidPacketMetadata ||
+             Stats->EventIds[i].Id == tidVMSwitchPacketFragment) ? "" : " (not packet events)");
+    }
+    printf("  other providers: %llu seen\n", Stats->OtherEvents);
+}
+
+void PrintStats(struct CONVERSION* Conv)
+{
+    struct STATS* Stats = &Conv->Stats;
+    struct INTERFACE* Iface;
+    unsigned long i;
+
+    printf("\nEvents:\n");
+    PrintEventIdStats(Conv);
+    printf("  packets dropped as too large: %llu\n", Stats->TooLarge);
+    printf("  metadata with an unexpected length: %llu\n", Stats->BadMetadataLength);
+    printf("  with fields that couldn't be read: %llu\n", Stats->BadEvents);
+
+    printf("\nInterfaces:\n");
+    for (i = 0; i < Conv->NumOutputInterfaces; i++) {
+        Iface = Conv->OutputInterfaces[i];
+        printf("  ID=%u IfIndex=%u: %llu packets (%llu sent, %llu received), %llu bytes\n",
+            Iface->PcapNgIfIndex, Iface->LowerIfIndex, Iface->Packets, Iface->PacketsSent,
+            Iface->Packets - Iface->PacketsSent, Iface->Bytes);
+    }
+
+    printf("  interface state: %llu KB\n", Conv->Arena.Size / 1024);
+
+    printf("\nTime (ms):\n");
+    printf("  reading the input (ETW)   %10.1f\n", TicksToMs(Stats->TraceTicks - Stats->CallbackTicks));
+    printf("  decoding events           %10.1f\n", TicksToMs(Stats->CallbackTicks - Stats->EmitTicks));
+    if (Conv->Options.Pipeline) {
+        // Encoding and writing overlap with the above.
+        printf("  queueing packets          %10.1f\n", TicksToMs(Stats->EmitTicks));
+        printf("  formatting (encoder thread) %8.1f\n", TicksToMs(Stats->FormatTicks));
+        printf("  encoding (encoder thread) %10.1f\n", TicksToMs(Stats->EncodeTicks - Stats->FormatTicks));
+        printf("  writing (encoder thread)  %10.1f\n", TicksToMs(Stats->WriteTicks));
+    } else {
+        printf("  formatting comments       %10.1f\n", TicksToMs(Stats->FormatTicks));
+        printf("  encoding pcapng blocks    %10.1f\n", TicksToMs(Stats->EncodeTicks - Stats->FormatTicks));
+        printf("  writing the output        %10.1f\n", TicksToMs(Stats->WriteTicks));
+    }
+    printf("  total                     %10.1f\n", TicksToMs(Stats->TraceTicks));
+}
+
+// --scan: prints a FILETIME in UTC, in the format that --start and --end
+// take.
+void PrintFileTime(LONGLONG Time)
+{
+    FILETIME FileTime;
+    SYSTEMTIME SystemTime;
+
+    FileTime.dwLowDateTime = (DWORD)Time;
+    FileTime.dwHighDateTime = (DWORD)(Time >> 32);
+    if (!FileTimeToSystemTime(&FileTime, &SystemTime)) {
+        printf("?");
+        return;
+    }
+    printf("%04u-%02u-%02uT%02u:%02u:%02u.%07lluZ",
+        SystemTime.wYear, SystemTime.wMonth, SystemTime.wDay,
+        SystemTime.wHour, SystemTime.wMinute, SystemTime.wSecond,
+        (unsigned long long)(Time % 10000000));
+}
+
+// A time as a JSON string, or null if it isn't known.
+void PrintJsonTime(LONGLONG Time)
+{
+    if (Time == 0) {
+        printf("null");
+        return;
+    }
+    printf("\"");
+    PrintFileTime(Time);
+    printf("\"");
+}
+
+// A UTF-8 string as a JSON string, or null.
+void PrintJsonString(const char* Str)
+{
+    if (Str == NULL) {
+        printf("null");
+        return;
+    }
+    printf("\"");
+    for (; *Str != '\0'; Str++) {
+        if (*Str == '"' || *Str == '\\') {
+            printf("\\%c", *Str);
+        } else if ((unsigned char)*Str < 0x20) {
+            printf("\\u%04x", (unsigned char)*Str);
+        } else {
+            putchar(*Str);
+        }
+    }
+    printf("\"");
+}
+
+const char* MediumName(short Type)
+{
+    switch (Type) {
+    case PCAPNG_LINKTYPE_IEEE802_11:
+        return "wifi";
+    case PCAPNG_LINKTYPE_RAW:
+        return "mbb";
+    default:
+        return "eth";
+    }
+}
+
+// What --scan reports, gathered from the interfaces and the trace headers
+// once the input has been read. The times are FILETIMEs, 0 if unknown.
+struct SCAN_SUMMARY {
+    struct INTERFACE** Interfaces; // in PcapNgIfIndex order
+    LONGLONG TraceStart;
+    LONGLONG TraceEnd;
+    LONGLONG FirstPacket;
+    LONGLONG LastPacket;
+};
+
+void PrintScanText(struct CONVERSION* Conv, struct SCAN_SUMMARY* Summary)
+{
+    struct STATS* Stats = &Conv->Stats;
+    struct INTERFACE* Iface;
+    unsigned long i;
+
+    if (Summary->TraceStart != 0 && Summary->TraceEnd > Summary->TraceStart) {
+        printf("Trace: ");
+        PrintFileTime(Summary->TraceStart);
+        printf(" - ");
+        PrintFileTime(Summary->TraceEnd);
+        printf(" (%.1f s)\n", (double)(Summary->TraceEnd - Summary->TraceStart) / 10000000);
+    }
+    if (Conv->NumFramesConverted > 0) {
+        printf("Packets: ");
+        PrintFileTime(Summary->FirstPacket);
+        printf(" - ");
+        PrintFileTime(Summary->LastPacket);
+        printf("\n");
+    }
+
+    printf("\nInterfaces:\n");
+    for (i = 0; i < Conv->NumInterfaces; i++) {
+        Iface = Summary->Interfaces[i];
+        PrintInterface(Conv, Iface);
+        printf("    %llu packets (%llu sent, %llu received), %llu bytes",
+            Iface->Packets, Iface->PacketsSent, Iface->Packets - Iface->PacketsSent, Iface->Bytes);
+        if (Iface->Packets > 0) {
+            printf(", largest %u, ", Iface->MaxLength);
+            PrintFileTime((LONGLONG)Iface->FirstTimeStamp.QuadPart);
+            printf(" - ");
+            PrintFileTime((LONGLONG)Iface->LastTimeStamp.QuadPart);
+        }
+        printf("\n");
+    }
+
+    printf("\nEvents:\n");
+    PrintEventIdStats(Conv);
+
+    printf("\n%llu frames, %llu bytes", Conv->NumFramesConverted, Conv->NumBytesConverted);
+    if (Conv->Options.SnapLen != 0) {
+        printf(" with --snaplen %u", Conv->Options.SnapLen);
+    }
+    printf("\n");
+    if (Conv->NumFramesFiltered > 0) {
+        printf("%llu frames don't match the filters\n", Conv->NumFramesFiltered);
+    }
+    if (Stats->TooLarge > 0) {
+        printf("%llu packets are too large to convert\n", Stats->TooLarge);
+    }
+    if (Stats->BadEvents > 0) {
+        printf("%llu events have fields that couldn't be read\n", Stats->BadEvents);
+    }
+}
+
+void PrintScanJson(struct CONVERSION* Conv, struct SCAN_SUMMARY* Summary)
+{
+    struct STATS* Stats = &Conv->Stats;
+    struct INTERFACE* Iface;
+    unsigned long i;
+
+    printf("{\n  \"inputs\": [");
+    for (i = 0; i < Conv->NumInputs; i++) {
+        printf(i == 0 ? "" : ", ");
+        PrintJsonString(Conv->Inputs[i].Name);
+    }
+    printf("],\n  \"trace_start\": ");
+    PrintJsonTime(Summary->TraceStart);
+    printf(",\n  \"trace_end\": ");
+    PrintJsonTime(Summary->TraceEnd);
+    printf(",\n  \"first_packet\": ");
+    PrintJsonTime(Summary->FirstPacket);
+    printf(",\n  \"last_packet\": ");
+    PrintJsonTime(Summary->LastPacket);
+    printf(",\n  \"packets\": %llu,\n  \"bytes\": %llu,\n  \"snaplen\": %u,\n",
+        Conv->NumFramesConverted, Conv->NumBytesConverted, Conv->Options.SnapLen);
+    printf("  \"filtered\": %llu,\n  \"too_large\": %llu,\n  \"bad_events\": %llu,\n",
+        Conv->NumFramesFiltered, Stats->TooLarge, Stats->BadEvents);
+
+    printf("  \"interfaces\": [");
+    for (i = 0; i < Conv->NumInterfaces; i++) {
+        Iface = Summary->Interfaces[i];
+        printf(i == 0 ? "\n" : ",\n");
+        printf("    {\"id\": %u, \"input\": ", Iface->PcapNgIfIndex);
+        PrintJsonString(Conv->Inputs[Iface->Input].Name);
+        printf(", \"ifindex\": %u, \"miniport_ifindex\": %u, \"medium\": \"%s\", \"name\": ",
+            Iface->LowerIfIndex, Iface->MiniportIfIndex, MediumName(Iface->Type));
+        PrintJsonString(Iface->Name);
+        printf(", \"description\": ");
+        PrintJsonString(Iface->Description);
+        printf(", \"packets\": %llu, \"sent\": %llu, \"received\": %llu, \"bytes\": %llu, \"largest\": %u, \"first_packet\": ",
+            Iface->Packets, Iface->PacketsSent, Iface->Packets - Iface->PacketsSent, Iface->Bytes, Iface->MaxLength);
+        PrintJsonTime(Iface->Packets > 0 ? (LONGLONG)Iface->FirstTimeStamp.QuadPart : 0);
+        printf(", \"last_packet\": ");
+        PrintJsonTime(Iface->Packets > 0 ? (LONGLONG)Iface->LastTimeStamp.QuadPart : 0);
+        printf("}");
+    }
+    printf(Conv->NumInterfaces > 0 ? "\n  ],\n" : "],\n");
+
+    printf("  \"events\": [");
+    for (i = 0; i < Stats->NumEventIds; i++) {
+        printf(i == 0 ? "\n" : ",\n");
+        printf("    {\"id\": %u, \"seen\": %llu, \"filtered\": %llu}",
+            Stats->EventIds[i].Id, Stats->EventIds[i].Seen, Stats->EventIds[i].Filtered);
+    }
+    printf(Stats->NumEventIds > 0 ? "\n  ],\n" : "],\n");
+    printf("  \"other_events\": %llu\n}\n", Stats->OtherEvents);
+}
+
+// --scan: prints what was found in the inputs, whose trace headers give the
+// time span of the capture.
+int PrintScan(struct CONVERSION* Conv, const TRACE_LOGFILE_HEADER* Headers, unsigned long NumHeaders)
+{
+    struct SCAN_SUMMARY Summary = {0};
+    struct INTERFACE* Iface;
+    unsigned long i;
+
+    Summary.Interfaces = ConvAlloc(Conv, max(Conv->NumInterfaces, 1) * sizeof(struct INTERFACE*));
+    if (Summary.Interfaces == NULL) {
+        return ERROR_NOT_ENOUGH_MEMORY;
+    }
+    for (i = 0; i < Conv->InterfaceTableSize; i++) {
+        Iface = Conv->InterfaceTable[i].Iface;
+        if (Iface == NULL) {
+            continue;
+        }
+        Summary.Interfaces[Iface->PcapNgIfIndex] = Iface;
+        if (Iface->Packets > 0) {
+            if (Summary.FirstPacket == 0 || (LONGLONG)Iface->FirstTimeStamp.QuadPart < Summary.FirstPacket) {
+                Summary.FirstPacket = (LONGLONG)Iface->FirstTimeStamp.QuadPart;
+            }
+            Summary.LastPacket = max(Summary.LastPacket, (LONGLONG)Iface->LastTimeStamp.QuadPart);
+        }
+    }
+
+    for (i = 0; i < NumHeaders; i++) {
+        if (Headers[i].StartTime.QuadPart != 0 &&
+            (Summary.TraceStart == 0 || Headers[i].StartTime.QuadPart < Summary.TraceStart)) {
+            Summary.TraceStart = Headers[i].StartTime.QuadPart;
+        }
+        Summary.TraceEnd = max(Summary.TraceEnd, Headers[i].EndTime.QuadPart);
+    }
+
+    if (Conv->Options.Scan == ETL2PCAPNG_SCAN_JSON) {
+        PrintScanJson(Conv, &Summary);
+    } else {
+        PrintScanText(Conv, &Summary);
+    }
+    return NO_ERROR;
+}
+
+// Puts the compression, writer thread and timing sinks (as the options
+// require) in front of BaseSink, points the writer at them and writes the
+// section header.
+int StackSinks(struct CONVERSION* Conv, struct PCAPNG_SINK* BaseSink)
+{
+    int Err;
+    const struct ETL2PCAPNG_OPTIONS* Options = &Conv->Options;
+
+    Conv->Sink = BaseSink;
+
+    if (Options->Compress) {
+        Err = GzipSinkInit(&Conv->GzipSink, Conv->Sink, Options->CompressLevel, Conv->Writer.BufferSize);
+        if (Err != NO_ERROR) {
+            return Err;
+        }
+        Conv->Sink = &Conv->GzipSink.Sink;
+    }
+
+    // Compression always gets its own thread, so that it doesn't slow
+    // down the conversion.
+    if (Options->Compress || (Options->Pipeline && !Options->Overlapped)) {
+        Err = ThreadSinkInit(
+            &Conv->ThreadSink, Conv->Sink, Conv->Writer.BufferSize,
+            PIPELINE_WRITE_BUFFERS);
+        if (Err != NO_ERROR) {
+            return Err;
+        }
+        Conv->Sink = &Conv->ThreadSink.Sink;
+    }
+
+    if (Options->ReportStats) {
+        TimedSinkInit(&Conv->TimedSink, Conv->Sink, &Conv->Stats.WriteTicks);
+        Conv->Sink = &Conv->TimedSink.Sink;
+    }
+    Conv->Writer.Sink = Conv->Sink;
+    Conv->Writer.Offset = 0;
+
+    return PcapNgWriteSectionHeader(&Conv->Writer);
+}
+
+// Opens an output file (or connection), sets up its sinks and writes the
+// section header.
+int OpenSink(struct CONVERSION* Conv, wchar_t* FileName)
+{
+    int Err;
+    DWORD OutFileFlags = FILE_ATTRIBUTE_NORMAL;
+    struct PCAPNG_SINK* BaseSink;
+
+    if (!_wcsnicmp(FileName, L"tcp://", 6)) {
+        Err = SocketSinkInit(&Conv->SocketSink, FileName + 6, Conv->Writer.BufferSize);
+        if (Err != NO_ERROR) {
+            return Err;
+        }
+        return StackSinks(Conv, &Conv->SocketSink.Sink);
+    }
+
+    if (Conv->Options.Overlapped) {
+        OutFileFlags |= FILE_FLAG_OVERLAPPED;
+    }
+    if (Conv->Options.NoBuffering) {
+        OutFileFlags |= FILE_FLAG_NO_BUFFERING;
+    }
+
+    Err = OpenOutput(Conv, FileName, OutFileFlags);
+    if (Err != NO_ERROR) {
+        return Err;
+    }
+
+    if (Conv->Options.Overlapped) {
+        // The overlapped sink already keeps writes off the calling thread,
+        // so with --pipeline the encoder thread issues the writes itself.
+        // The input size says nothing about the size of one piece of a
+        // split output, so only a whole output is preallocated.
+        if (Conv->SplitIndex == 0) {
+            PreallocateOutput(Conv);
+        }
+        Err = OverlappedSinkInit(
+            &Conv->OverlappedSink, Conv->OutFile, Conv->Options.NoBuffering,
+            Conv->Writer.BufferSize, OVERLAPPED_WRITES);
+        if (Err != NO_ERROR) {
+            return Err;
+        }
+        BaseSink = &Conv->OverlappedSink.Sink;
+    } else {
+        PcapNgFileSinkInit(&Conv->FileSink, Conv->OutFile);
+        BaseSink = &Conv->FileSink.Sink;
+    }
+
+    return StackSinks(Conv, BaseSink);
+}
+
+// --if-stats: an ISB for each interface of the current output file, with
+// the number of packets written for it and the time of its first and last
+// packet. An ISB describes the interface within its own section, so with a
+// split output each file gets the counts of its own packets (see
+// SplitOutput).
+int WriteInterfaceStats(struct CONVERSION* Conv)
+{
+    int Err;
+    struct INTERFACE* Iface;
+    struct PCAPNG_OPTION Options[3];
+    unsigned long NumOptions;
+    struct PCAPNG_TIMESTAMP StartTime;
+    struct PCAPNG_TIMESTAMP EndTime;
+    ULARGE_INTEGER Now = {0};
+    BOOLEAN Split = Conv->Options.SplitSize != 0 || Conv->Options.SplitSeconds != 0;
+    unsigned long long Packets;
+    ULARGE_INTEGER First;
+    ULARGE_INTEGER Last;
+    unsigned long i;
+
+    // The counters are as of the last packet in the file.
+    for (i = 0; i < Conv->NumOutputInterfaces; i++) {
+        Iface = Conv->OutputInterfaces[i];
+        Packets = Split ? Iface->FilePackets : Iface->Packets;
+        Last = Split ? Iface->FileLastTimeStamp : Iface->LastTimeStamp;
+        if (Packets > 0 && Last.QuadPart > Now.QuadPart) {
+            Now = Last;
+        }
+    }
+
+    for (i = 0; i < Conv->NumOutputInterfaces; i++) {
+        Iface = Conv->OutputInterfaces[i];
+        Packets = Split ? Iface->FilePackets : Iface->Packets;
+        First = Split ? Iface->FileFirstTimeStamp : Iface->FirstTimeStamp;
+        Last = Split ? Iface->FileLastTimeStamp : Iface->LastTimeStamp;
+        NumOptions = 0;
+        if (Packets > 0) {
+            StartTime.High = First.HighPart;
+            StartTime.Low = First.LowPart;
+            Options[NumOptions].Code = PCAPNG_OPTIONCODE_ISB_STARTTIME;
+            Options[NumOptions].Length = sizeof(StartTime);
+            Options[NumOptions].Value = &StartTime;
+            NumOptions++;
+            EndTime.High = Last.HighPart;
+            EndTime.Low = Last.LowPart;
+            Options[NumOptions].Code = PCAPNG_OPTIONCODE_ISB_ENDTIME;
+            Options[NumOptions].Length = sizeof(EndTime);
+            Options[NumOptions].Value = &EndTime;
+            NumOptions++;
+        }
+        Options[NumOptions].Code = PCAPNG_OPTIONCODE_ISB_USRDELIV;
+        Options[NumOptions].Length = sizeof(Packets);
+        Options[NumOptions].Value = &Packets;
+        NumOptions++;
+
+        Err = PcapNgWriteInterfaceStats(
+            &Conv->Writer, Iface->PcapNgIfIndex, Now.HighPart, Now.LowPart,
+            Options, NumOptions);
+        if (Err != NO_ERROR) {
+            return Err;
+        }
+    }
+    return NO_ERROR;
+}
+
+// Writes the index of the output file FileName, which has just been
+// closed, and starts over for the next one.
+int WriteIndex(struct CONVERSION* Conv, const wchar_t* FileName)
+{
+    int Err = NO_ERROR;
+    wchar_t IndexFileName[MAX_PATH + 4];
+    HANDLE File;
+    struct ETL2PCAPNG_INDEX_HEADER Header;
+    DWORD Sizes[3];
+    const void* Parts[3];
+    unsigned long i;
+
+    ZeroMemory(&Header, sizeof(Header));
+    memcpy(Header.Magic, ETL2PCAPNG_INDEX_MAGIC, sizeof(Header.Magic));
+    Header.Version = ETL2PCAPNG_INDEX_VERSION;
+    Header.Interval = Conv->Options.IndexInterval;
+    Header.TsResol = Conv->Options.TsResol;
+    Header.NumPackets = Conv->IndexPackets;
+    Header.NumEntries = Conv->NumIndexEntries;
+    // Interfaces without packets in this file are still in its IDBs.
+    Header.NumInterfaces = Conv->NumOutputInterfaces;
+    Err = GrowIndexInterfaces(Conv);
+    if (Err != NO_ERROR) {
+        return Err;
+    }
+
+    if (FAILED(StringCchPrintf(IndexFileName, RTL_NUMBER_OF(IndexFileName), L"%ws.idx", FileName))) {
+        printf("%ws is too long\n", FileName);
+        return ERROR_FILENAME_EXCED_RANGE;
+    }
+    File = CreateFile(IndexFileName, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (File == INVALID_HANDLE_VALUE) {
+        Err = GetLastError();
+        printf("CreateFile called on %ws failed with %u\n", IndexFileName, Err);
+        return Err;
+    }
+
+    Parts[0] = &Header;
+    Sizes[0] = sizeof(Header);
+    Parts[1] = Conv->IndexEntries;
+    Sizes[1] = Conv->NumIndexEntries * sizeof(struct ETL2PCAPNG_INDEX_ENTRY);
+    Parts[2] = Conv->IndexInterfaces;
+    Sizes[2] = Conv->NumOutputInterfaces * sizeof(struct ETL2PCAPNG_INDEX_INTERFACE);
+    for (i = 0; i < RTL_NUMBER_OF(Parts); i++) {
+        if (Sizes[i] > 0 && !WriteFile(File, Parts[i], Sizes[i], NULL, NULL)) {
+            Err = GetLastError();
+            printf("WriteFile failed with %u\n", Err);
+            break;
+        }
+    }
+    CloseHandle(File);
+
+    Conv->NumIndexEntries = 0;
+    Conv->IndexPackets = 0;
+    ZeroMemory(Conv->IndexInterfaces, Conv->MaxIndexInterfaces * sizeof(struct ETL2PCAPNG_INDEX_INTERFACE));
+    return Err;
+}
+
+// Writes out everything buffered for the output and closes it.
+int CloseOutput(struct CONVERSION* Conv)
+{
+    int Err = NO_ERROR;
+    int CloseErr;
+    BOOLEAN WasOpen = Conv->Sink != NULL;
+
+    if (Conv->Sink != NULL) {
+        Err = PcapNgWriterFlush(&Conv->Writer);
+        CloseErr = Conv->Sink->Close(Conv->Sink);
+        if (Err == NO_ERROR) {
+            Err = CloseErr;
+        }
+        Conv->Sink = NULL;
+        Conv->Writer.Sink = NULL;
+    }
+
+    if (Conv->OutFile != INVALID_HANDLE_VALUE) {
+        if (Conv->OutFileIsPipe) {
+            // Closing the pipe would discard whatever the reader hasn't
+            // read yet.
+            FlushFileBuffers(Conv->OutFile);
+        }
+        CloseHandle(Conv->OutFile);
+        Conv->OutFile = INVALID_HANDLE_VALUE;
+    }
+
+    // Also after a failure, for whatever was converted.
+    if (WasOpen && Conv->Options.IndexInterval != 0) {
+        CloseErr = WriteIndex(Conv, Conv->SplitIndex != 0 ? Conv->SplitFileName : Conv->OutFileName);
+        if (Err == NO_ERROR) {
+            Err = CloseErr;
+        }
+    }
+
+    return Err;
+}
+
+// out.pcapng -> out_00001.pcapng, out_00002.pcapng...
+// (and out.pcapng.gz -> out_00001.pcapng.gz)
+int GetSplitFileName(struct CONVERSION* Conv)
+{
+    wchar_t* Ext = NULL;
+    wchar_t* PrevExt = NULL;
+    wchar_t* p;
+
+    for (p = Conv->OutFileName; *p != L'\0'; p++) {
+        if (*p == L'.') {
+            PrevExt = Ext;
+            Ext = p;
+        } else if (*p == L'\\' || *p == L'/') {
+            Ext = NULL;
+            PrevExt = NULL;
+        }
+    }
+    if (Ext == NULL) {
+        Ext = p;
+    } else if (PrevExt != NULL && !_wcsicmp(Ext, L".gz")) {
+        Ext = PrevExt;
+    }
+
+    if (FAILED(StringCchPrintf(
+            Conv->SplitFileName, RTL_NUMBER_OF(Conv->SplitFileName), L"%.*ws_%05u%ws",
+            (int)(Ext - Conv->OutFileName), Conv->OutFileName, Conv->SplitIndex, Ext))) {
+        printf("%ws is too long\n", Conv->OutFileName);
+        return ERROR_FILENAME_EXCED_RANGE;
+    }
+    return NO_ERROR;
+}
+
+// Closes the current piece of a split output and starts the next one with
+// the IDBs of all the interfaces seen so far, so that the interface IDs stay
+// the same in every file.
+int SplitOutput(struct CONVERSION* Conv)
+{
+    int Err;
+    unsigned long i;
+
+    if (Conv->Options.WriteStatsBlocks) {
+        Err = WriteInterfaceStats(Conv);
+        if (Err != NO_ERROR) {
+            printf("Writing interface statistics failed with %u\n", Err);
+            return Err;
+        }
+        for (i = 0; i < Conv->NumOutputInterfaces; i++) {
+            Conv->OutputInterfaces[i]->FilePackets = 0;
+        }
+    }
+
+    Err = CloseOutput(Conv);
+    if (Err != NO_ERROR) {
+        return Err;
+    }
+
+    Conv->SplitIndex++;
+    Err = GetSplitFileName(Conv);
+    if (Err != NO_ERROR) {
+        return Err;
+    }
+    Err = OpenSink(Conv, Conv->SplitFileName);
+    if (Err != NO_ERROR) {
+        return Err;
+    }
+
+    for (i = 0; i < Conv->NumOutputInterfaces; i++) {
+        Err = WriteInterfaceDesc(Conv, Conv->OutputInterfaces[i]);
+        if (Err != NO_ERROR) {
+            return Err;
+        }
+    }
+
+    Conv->SplitHasPackets = FALSE;
+    return NO_ERROR;
+}
+
+void CloseDirect(struct CONVERSION* Conv)
+{
+    unsigned long i;
+
+    if (Conv->EtlFiles != NULL && !Conv->SharedEtlFiles) {
+        for (i = 0; i < Conv->NumInputs; i++) {
+            EtlClose(&Conv->EtlFiles[i]);
+        }
+        free(Conv->EtlFiles);
+    }
+    Conv->EtlFiles = NULL;
+}
+
+// --direct: maps and indexes the inputs. If any of them can't be read
+// directly, all of them are read with ProcessTrace instead, so that they
+// are still merged in one pass.
+int OpenDirect(struct CONVERSION* Conv, const TRACE_LOGFILE_HEADER* Headers)
+{
+    int Err = NO_ERROR;
+    SYSTEM_INFO SystemInfo;
+    unsigned long i;
+
+    Conv->EtlFiles = calloc(Conv->NumInputs, sizeof(struct ETL_FILE));
+    if (Conv->EtlFiles == NULL) {
+        printf("out of memory\n");
+        return ERROR_NOT_ENOUGH_MEMORY;
+    }
+
+    GetSystemInfo(&SystemInfo);
+    for (i = 0; i < Conv->NumInputs; i++) {
+        Err = EtlOpen(&Conv->EtlFiles[i], Conv->Inputs[i].FileName, &Headers[i], &Conv->Inputs[i]);
+        if (Err == NO_ERROR) {
+            Err = EtlScan(&Conv->EtlFiles[i], Conv->Inputs[i].FileName, &NdisCapId, SystemInfo.dwNumberOfProcessors);
+        }
+        if (Err != NO_ERROR) {
+            break;
+        }
+    }
+
+    if (Err == ERROR_NOT_SUPPORTED) {
+        if (!Conv->Options.Quiet) {
+            printf("Reading %ws with ProcessTrace: %s\n", Conv->Inputs[i].FileName, Conv->EtlFiles[i].Problem);
+        }
+        Err = NO_ERROR;
+        CloseDirect(Conv);
+    } else if (Err != NO_ERROR) {
+        printf("Reading %ws failed with %u\n", Conv->Inputs[i].FileName, Err);
+    }
+    return Err;
+}
+
+// Delivers the events of all inputs to EventCallback, through ProcessTrace
+// or the direct reader.
+int ProcessInputs(struct CONVERSION* Conv, PTRACEHANDLE TraceHandles, unsigned long NumTraces, LPFILETIME StartTime, LPFILETIME EndTime)
+{
+    int Err;
+    unsigned long i;
+    LONGLONG Start = StatsNow(Conv);
+    PVOID Contexts[ETL2PCAPNG_MAX_INPUTS];
+
+    Conv->NumEvents = 0;
+    Conv->ProgressEvents = 0;
+    Conv->ProgressTime = GetTickCount64();
+    for (i = 0; i < Conv->NumInputs; i++) {
+        Conv->Inputs[i].BytesRead = 0;
+    }
+
+    if (Conv->EtlFiles != NULL) {
+        // The files can be shared with other segments of a --parallel
+        // conversion, so the events are pointed at our inputs here.
+        for (i = 0; i < Conv->NumInputs; i++) {
+            Contexts[i] = &Conv->Inputs[i];
+        }
+        Err = EtlProcessRange(
+            Conv->EtlFiles, Conv->NumInputs, Contexts,
+            StartTime != NULL ? (LONGLONG)(((ULONGLONG)StartTime->dwHighDateTime << 32) | StartTime->dwLowDateTime) : 0,
+            EndTime != NULL ? (LONGLONG)(((ULONGLONG)EndTime->dwHighDateTime << 32) | EndTime->dwLowDateTime) : MAXLONGLONG,
+            EventCallback, DirectProgressCallback, Conv);
+        if (Conv->Pass2) {
+            for (i = 0; i < Conv->NumInputs; i++) {
+                Conv->Stats.OtherEvents += Conv->EtlFiles[i].NumOther;
+            }
+        }
+    } else {
+        Err = ProcessTrace(TraceHandles, NumTraces, StartTime, EndTime);
+    }
+    Conv->Stats.TraceTicks += StatsNow(Conv) - Start;
+
+    if (Conv->ProgressShown) {
+        printf("\n");
+        Conv->ProgressShown = FALSE;
+    }
+    if (Conv->Err != NO_ERROR) {
+        Err = Conv->Err; // stopped by BufferCallback
+    } else if (Err == ERROR_CANCELLED && (Conv->LimitReached || Conv->RangeDone)) {
+        Err = NO_ERROR; // stopped by BufferCallback
+    }
+    return Err;
+}
+
+// --parallel: the inputs are split into time ranges, each converted at the
+// same time by a conversion of its own (a segment) to a temporary file,
+// and the segments are then concatenated into the output.
+//
+// A packet belongs to the range its last event (the one with
+// KW_PACKET_END, whose timestamp the EPB gets) is in, so that every packet
+// is written by exactly one segment. A segment also reads the events of
+// the RANGE_MARGIN before its range, without writing their packets, to
+// pick up the first fragments and the metadata of the packets that end in
+// its range, and stops at the first event after it (with --dedup, after
+// the DEDUP_WINDOW after it, see RangeReadEnd), leaving the packets still
+// in progress to the next segment.
+//
+// Each segment numbers the interfaces in the order it sees them. When the
+// segments are concatenated, an interface gets the ID that it has in the
+// first segment it appears in, with its IDB written before that segment's
+// packets, and the interface IDs of the EPBs are mapped to the output's.
+// Since interfaces are numbered in order of first appearance anyway, they
+// end up with the same IDs as in a sequential conversion.
+#define RANGE_MARGIN 10000000ll // 1s, in FILETIME units
+#define SEGMENT_BUFFER_SIZE (1024 * 1024) // more than the largest block
+
+struct SEGMENT {
+    struct CONVERSION* Conv;
+    HANDLE Thread;
+    wchar_t FileName[MAX_PATH];
+};
+
+// Converts Conv->Inputs (or the live session) to Conv->OutFileName, or
+// summarizes them with --scan.
+int Convert(struct CONVERSION* Conv)
+{
+    int Err;
+    EVENT_TRACE_LOGFILE LogFile;
+    TRACEHANDLE TraceHandles[ETL2PCAPNG_MAX_INPUTS];
+    unsigned long NumTraces = 0;
+    unsigned long i;
+    FILETIME StartTime;
+    FILETIME EndTime;
+    LPFILETIME TraceStartTime = NULL;
+    LPFILETIME TraceEndTime = NULL;
+    LONGLONG TraceStart = Conv->Options.Filter.Start;
+    LONGLONG TraceEnd = Conv->Options.Filter.End;
+    TRACE_LOGFILE_HEADER LogfileHeaders[ETL2PCAPNG_MAX_INPUTS];
+
+    // The sinks are set up by OpenSink: buffers are swapped between the
+    // writer and the sinks, so they all need the writer's (possibly rounded
+    // up) size.
+    Err = PcapNgWriterInit(&Conv->Writer, NULL, Conv->Options.WriteBufferSize);
+    if (Err != NO_ERROR) {
+        goto Done;
+    }
+
+    if (Conv->Options.Scan != ETL2PCAPNG_SCAN_NONE) {
+        // Nothing is written.
+    } else if (Conv->Options.SplitSize != 0 || Conv->Options.SplitSeconds != 0) {
+        Conv->SplitIndex = 1;
+        Err = GetSplitFileName(Conv);
+        if (Err != NO_ERROR) {
+            goto Done;
+        }
+        Err = OpenSink(Conv, Conv->SplitFileName);
+    } else {
+        Err = OpenSink(Conv, Conv->OutFileName);
+    }
+    if (Err != NO_ERROR) {
+        goto Done;
+    }
+
+    ZeroMemory(&LogFile, sizeof(LogFile));
+    LogFile.ProcessTraceMode = PROCESS_TRACE_MODE_EVENT_RECORD;
+    LogFile.EventRecordCallback = EventCallback;
+
+    if (Conv->Options.Live) {
+        // Let the reader see the section header right away.
+        Err = PcapNgWriterFlush(&Conv->Writer);
+        if (Err != NO_ERROR) {
+            goto Done;
+        }
+
+        Err = StartLiveSession(Conv);
+        if (Err != NO_ERROR) {
+            goto Done;
+        }
+        if (!Conv->Options.Quiet) {
+            printf("Converting live packet capture events\n");
+        }
+
+        LogFile.LoggerName = Conv->LiveSessionName;
+        LogFile.ProcessTraceMode |= PROCESS_TRACE_MODE_REAL_TIME;
+    }
+    LogFile.BufferCallback = BufferCallback;
+    Conv->InputSize = Conv->Options.ReportProgress ? GetInputSize(Conv) : 0;
+
+    // With several inputs, ProcessTrace delivers the events of all of them
+    // in timestamp order, so they are merged in a single pass.
+    for (i = 0; i < Conv->NumInputs; i++) {
+        LogFile.LogFileName = Conv->Inputs[i].FileName;
+        LogFile.Context = &Conv->Inputs[i];
+        TraceHandles[NumTraces] = OpenTrace(&LogFile);
+        if (TraceHandles[NumTraces] == INVALID_PROCESSTRACE_HANDLE) {
+            Err = GetLastError();
+            if (Conv->Inputs[i].FileName != NULL) {
+                printf("OpenTrace called on %ws failed with %u\n", Conv->Inputs[i].FileName, Err);
+            } else {
+                printf("OpenTrace failed with %u\n", Err);
+            }
+            goto Done;
+        }
+        LogfileHeaders[NumTraces] = LogFile.LogfileHeader;
+        NumTraces++;
+    }
+
+    if (Conv->Options.Direct && !Conv->SharedEtlFiles) {
+        Err = OpenDirect(Conv, LogfileHeaders);
+        if (Err != NO_ERROR) {
+            goto Done;
+        }
+    }
+
+    // Let ETW skip the events outside of --start/--end, or of a --parallel
+    // segment's range and the margin before it (it can't for a real-time
+    // session). EventCallback checks the time range too, so this is only an
+    // optimization.
+    if (Conv->HasRange) {
+        TraceStart = max(TraceStart, Conv->RangeStart - RANGE_MARGIN);
+        TraceEnd = RangeReadEnd(Conv);
+    }
+    if (TraceStart != 0 && !Conv->Options.Live) {
+        StartTime.dwLowDateTime = (DWORD)TraceStart;
+        StartTime.dwHighDateTime = (DWORD)(TraceStart >> 32);
+        TraceStartTime = &StartTime;
+    }
+    if (TraceEnd != MAXLONGLONG && !Conv->Options.Live) {
+        EndTime.dwLowDateTime = (DWORD)TraceEnd;
+        EndTime.dwHighDateTime = (DWORD)(TraceEnd >> 32);
+        TraceEndTime = &EndTime;
+    }
+
+    if (Conv->Options.SortInterfaces) {
+        // Read the ETL file twice.
+        // Pass1: Gather interface information.
+        // Pass2: Convert packet traces.
+        // Otherwise interfaces are written as they are first seen and the
+        // file is only read once.
+
+        Err = ProcessInputs(Conv, TraceHandles, NumTraces, TraceStartTime, TraceEndTime);
+        if (Err != NO_ERROR) {
+            printf("ProcessTrace failed with %u\n", Err);
+            goto Done;
+        }
+
+        Err = WriteInterfaces(Conv);
+        if (Err != NO_ERROR) {
+            goto Done;
+        }
+    }
+
+    Conv->Pass2 = TRUE;
+
+    if (Conv->Options.Pipeline) {
+        Err = StartPipeline(Conv);
+        if (Err != NO_ERROR) {
+            goto Done;
+        }
+    }
+
+    Err = ProcessInputs(Conv, TraceHandles, NumTraces, TraceStartTime, TraceEndTime);
+    // Also after a failure, for whatever was converted.
+    DedupFlush(Conv);
+    if (Err != NO_ERROR) {
+        printf("ProcessTrace failed with %u\n", Err);
+        goto Done;
+    }
+
+    if (Conv->Options.Scan != ETL2PCAPNG_SCAN_NONE) {
+        Err = PrintScan(Conv, LogfileHeaders, NumTraces);
+        goto Done;
+    }
+
+    Err = StopPipeline(Conv);
+    if (Err != NO_ERROR) {
+        goto Done;
+    }
+
+    if (Conv->Options.WriteStatsBlocks) {
+        Err = WriteInterfaceStats(Conv);
+        if (Err != NO_ERROR) {
+            printf("Writing interface statistics failed with %u\n", Err);
+            goto Done;
+        }
+    }
+
+    Err = CloseOutput(Conv);
+    if (Err != NO_ERROR) {
+        goto Done;
+    }
+
+    if (!Conv->Options.Quiet) {
+        printf("Converted %llu frames\n", Conv->NumFramesConverted);
+        if (Conv->LimitReached) {
+            printf("Stopped early at the --max-packets/--max-bytes limit\n");
+        }
+        if (Conv->NumFramesFiltered > 0) {
+            printf("Skipped %llu frames that didn't match the filters\n", Conv->NumFramesFiltered);
+        }
+        if (Conv->NumFramesDuplicate > 0) {
+            printf("Skipped %llu copies of frames on other layers (--dedup)\n", Conv->NumFramesDuplicate);
+        }
+        if (Conv->SplitIndex > 1) {
+            printf("Wrote %u files\n", Conv->SplitIndex);
+        }
+        if (Conv->Options.ReportStats) {
+            PrintStats(Conv);
+        }
+    }
+
+Done:
+    if (Conv->LiveSession != 0) {
+        StopLiveSession(Conv);
+        Conv->LiveSession = 0;
+    }
+    StopPipeline(Conv);
+    // Keep whatever was converted before a failure.
+    CloseOutput(Conv);
+    PcapNgWriterCleanup(&Conv->Writer);
+    CloseDirect(Conv);
+    for (i = 0; i < NumTraces; i++) {
+        CloseTrace(TraceHandles[i]);
+    }
+    return Err;
+}
+
+DWORD WINAPI SegmentThread(LPVOID Context)
+{
+    return (DWORD)Convert((struct CONVERSION*)Context);
+}
+
+// Next to the output file (which is where the space for it is expected to
+// be), or in the temp directory for a stream.
+int GetSegmentFileName(struct CONVERSION* Conv, unsigned long Index, wchar_t* FileName)
+{
+    int Err;
+    wchar_t TempDir[MAX_PATH];
+
+    if (Etl2PcapngIsStreamOutput(Conv->OutFileName)) {
+        if (GetTempPath(RTL_NUMBER_OF(TempDir), TempDir) == 0 ||
+            GetTempFileName(TempDir, L"e2p", 0, FileName) == 0) {
+            Err = GetLastError();
+            printf("Creating a temporary file failed with %u\n", Err);
+            return Err;
+        }
+        return NO_ERROR;
+    }
+    if (FAILED(StringCchPrintf(FileName, MAX_PATH, L"%ws.%u.tmp", Conv->OutFileName, Index))) {
+        printf("%ws is too long\n", Conv->OutFileName);
+        return ERROR_FILENAME_EXCED_RANGE;
+    }
+    return NO_ERROR;
+}
+
+// Appends the blocks of a segment's file to the output, except for its
+// section header and IDBs, with the interface IDs of its EPBs mapped to
+// the output's.
+int CopySegment(struct CONVERSION* Conv, struct SEGMENT* Seg, const unsigned long* IdMap)
+{
+    int Err = NO_ERROR;
+    HANDLE File;
+    char* Buffer = NULL;
+    unsigned long Used = 0; // bytes in Buffer
+    unsigned long Pos = 0; // of the next block in Buffer
+    DWORD Read;
+    BOOLEAN Eof = FALSE;
+    struct PCAPNG_BLOCK_HEAD* Head;
+    struct PCAPNG_ENHANCED_PACKET_BODY* Packet;
+
+    File = CreateFile(Seg->FileName, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                      FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (File == INVALID_HANDLE_VALUE) {
+        Err = GetLastError();
+        printf("CreateFile called on %ws failed with %u\n", Seg->FileName, Err);
+        return Err;
+    }
+    Buffer = malloc(SEGMENT_BUFFER_SIZE);
+    if (Buffer == NULL) {
+        printf("out of memory\n");
+        Err = ERROR_NOT_ENOUGH_MEMORY;
+        goto Done;
+    }
+
+    for (;;) {
+        Head = (struct PCAPNG_BLOCK_HEAD*)(Buffer + Pos);
+        if (Used - Pos >= sizeof(*Head) &&
+            (Head->Length < sizeof(*Head) + sizeof(DWORD) || Head->Length % 4 != 0 ||
+             Head->Length > SEGMENT_BUFFER_SIZE)) {
+            Err = ERROR_INVALID_DATA;
+            break;
+        }
+        if (Used - Pos < sizeof(*Head) || Used - Pos < Head->Length) {
+            if (Eof) {
+                if (Used != Pos) {
+                    Err = ERROR_INVALID_DATA;
+                }
+                break;
+            }
+            // Move the start of the block to the front and read the rest.
+            memmove(Buffer, Buffer + Pos, Used - Pos);
+            Used -= Pos;
+            Pos = 0;
+            if (!ReadFile(File, Buffer + Used, SEGMENT_BUFFER_SIZE - Used, &Read, NULL)) {
+                Err = GetLastError();
+                printf("ReadFile called on %ws failed with %u\n", Seg->FileName, Err);
+                goto Done;
+            }
+            Eof = Read == 0;
+            Used += Read;
+            continue;
+        }
+
+        if (Head->Type == PCAPNG_BLOCKTYPE_ENHANCED_PACKET) {
+            Packet = (struct PCAPNG_ENHANCED_PACKET_BODY*)(Head + 1);
+            if (Head->Length < sizeof(*Head) + sizeof(*Packet) + sizeof(DWORD) ||
+                Packet->InterfaceId >= Seg->Conv->NumOutputInterfaces) {
+                Err = ERROR_INVALID_DATA;
+                break;
+            }
+            Packet->InterfaceId = IdMap[Packet->InterfaceId];
+        }
+        if (Head->Type != PCAPNG_BLOCKTYPE_SECTION_HEADER &&
+            Head->Type != PCAPNG_BLOCKTYPE_INTERFACEDESC) {
+            Err = PcapNgWriterBeginBlock(&Conv->Writer, Head->Length);
+            if (Err == NO_ERROR) {
+                Err = PcapNgWriterAppend(&Conv->Writer, Head, Head->Length);
+            }
+            if (Err != NO_ERROR) {
+                goto Done;
+            }
+        }
+        Pos += Head->Length;
+    }
+    if (Err == ERROR_INVALID_DATA) {
+        printf("%ws is not a valid segment\n", Seg->FileName);
+    }
+
+Done:
+    free(Buffer);
+    CloseHandle(File);
+    return Err;
+}
+
+// Writes the IDBs of the interfaces that a segment is the first to have,
+// and maps the segment's interface IDs to the output's. The segment's
+// counts are added to the output's interfaces for --if-stats.
+int MergeSegmentInterfaces(struct CONVERSION* Conv, struct SEGMENT* Seg, unsigned long* IdMap)
+{
+    int Err;
+    struct INTERFACE* SegIface;
+    struct INTERFACE* Iface;
+    unsigned long i;
+
+    for (i = 0; i < Seg->Conv->NumOutputInterfaces; i++) {
+        SegIface = Seg->Conv->OutputInterfaces[i];
+        Iface = GetInterface(Conv, SegIface->Input, SegIface->LowerIfIndex);
+        if (Iface == NULL) {
+            Iface = AddInterface(
+                Conv, SegIface->Input, SegIface->LowerIfIndex, SegIface->MiniportIfIndex, SegIface->Type);
+            if (Iface == NULL) {
+                return ERROR_NOT_ENOUGH_MEMORY;
+            }
+            Iface->PcapNgIfIndex = Conv->NumInterfaces - 1;
+            Err = WriteInterface(Conv, Iface);
+            if (Err != NO_ERROR) {
+                return Err;
+            }
+            if (!Conv->Options.Quiet) {
+                PrintInterface(Conv, Iface);
+            }
+        }
+        IdMap[i] = Iface->PcapNgIfIndex;
+
+        if (SegIface->Packets > 0) {
+            if (Iface->Packets == 0) {
+                Iface->FirstTimeStamp = SegIface->FirstTimeStamp;
+            }
+            Iface->LastTimeStamp = SegIface->LastTimeStamp;
+            Iface->Packets += SegIface->Packets;
+            Iface->PacketsSent += SegIface->PacketsSent;
+            Iface->Bytes += SegIface->Bytes;
+        }
+    }
+    return NO_ERROR;
+}
+
+// Converts Conv->Inputs to Conv->OutFileName as Options.ParallelRanges
+// segments (see SEGMENT).
+int ConvertParallel(struct CONVERSION* Conv)
+{
+    int Err = NO_ERROR;
+    DWORD ExitCode;
+    EVENT_TRACE_LOGFILE LogFile;
+    TRACEHANDLE TraceHandle;
+    TRACE_LOGFILE_HEADER LogfileHeaders[ETL2PCAPNG_MAX_INPUTS];
+    wchar_t* InFileNames[ETL2PCAPNG_MAX_INPUTS];
+    LONGLONG Bounds[ETL2PCAPNG_MAX_PARALLEL_RANGES + 1];
+    LONGLONG Start = MAXLONGLONG;
+    LONGLONG End = 0;
+    unsigned long NumRanges = Conv->Options.ParallelRanges;
+    struct ETL2PCAPNG_OPTIONS Options;
+    struct SEGMENT* Segments;
+    struct SEGMENT* Seg;
+    unsigned long* IdMap;
+    unsigned long i;
+
+    Segments = calloc(NumRanges, sizeof(struct SEGMENT));
+    if (Segments == NULL) {
+        printf("out of memory\n");
+        return ERROR_NOT_ENOUGH_MEMORY;
+    }
+
+    // The time span of the inputs, from their headers.
+    ZeroMemory(&LogFile, sizeof(LogFile));
+    LogFile.ProcessTraceMode = PROCESS_TRACE_MODE_EVENT_RECORD;
+    LogFile.EventRecordCallback = EventCallback;
+    for (i = 0; i < Conv->NumInputs; i++) {
+        InFileNames[i] = Conv->Inputs[i].FileName;
+        LogFile.LogFileName = Conv->Inputs[i].FileName;
+        TraceHandle = OpenTrace(&LogFile);
+        if (TraceHandle == INVALID_PROCESSTRACE_HANDLE) {
+            Err = GetLastError();
+            printf("OpenTrace called on %ws failed with %u\n", Conv->Inputs[i].FileName, Err);
+            goto Done;
+        }
+        LogfileHeaders[i] = LogFile.LogfileHeader;
+        CloseTrace(TraceHandle);
+        Start = min(Start, LogfileHeaders[i].StartTime.QuadPart);
+        End = max(End, LogfileHeaders[i].EndTime.QuadPart);
+    }
+
+    // The segments share the direct reader's index of the inputs.
+    if (Conv->Options.Direct) {
+        Err = OpenDirect(Conv, LogfileHeaders);
+        if (Err != NO_ERROR) {
+            goto Done;
+        }
+    }
+
+    Start = max(Start, Conv->Options.Filter.Start);
+    End = min(End, Conv->Options.Filter.End);
+    if (Start >= End) {
+        // Nothing to split, e.g. a file that wasn't closed properly and
+        // has no end time.
+        CloseDirect(Conv);
+        Conv->Options.ParallelRanges = 0;
+        free(Segments);
+        return Convert(Conv);
+    }
+
+    // With the direct reader the ranges have about the same number of
+    // events, otherwise the same length.
+    Bounds[0] = Conv->Options.Filter.Start;
+    Bounds[NumRanges] = Conv->Options.Filter.End;
+    if (Conv->EtlFiles != NULL) {
+        EtlSplitRange(Conv->EtlFiles, Conv->NumInputs, Start, End, NumRanges, Bounds + 1);
+    } else {
+        for (i = 1; i < NumRanges; i++) {
+            Bounds[i] = Start + (End - Start) / NumRanges * i;
+        }
+    }
+
+    // The segments only write temporary files, and the concatenation
+    // does the rest.
+    Options = Conv->Options;
+    Options.Quiet = TRUE;
+    Options.ResolveNames = FALSE;
+    Options.WriteStatsBlocks = FALSE;
+    Options.Overlapped = FALSE;
+    Options.NoBuffering = FALSE;
+    Options.Compress = FALSE;
+    Options.Direct = Conv->EtlFiles != NULL; // not if it fell back to ProcessTrace
+    Options.ParallelRanges = 0;
+
+    if (!Conv->Options.Quiet) {
+        printf("Converting in %u time ranges\n", NumRanges);
+    }
+    for (i = 0; i < NumRanges; i++) {
+        Seg = &Segments[i];
+        Err = GetSegmentFileName(Conv, i, Seg->FileName);
+        if (Err != NO_ERROR) {
+            goto Done;
+        }
+        Seg->Conv = AllocConversion(&Options, InFileNames, Conv->NumInputs, Seg->FileName);
+        if (Seg->Conv == NULL) {
+            printf("out of memory\n");
+            Err = ERROR_NOT_ENOUGH_MEMORY;
+            goto Done;
+        }
+        Seg->Conv->HasRange = TRUE;
+        Seg->Conv->RangeStart = Bounds[i];
+        Seg->Conv->RangeEnd = Bounds[i + 1];
+        if (Conv->EtlFiles != NULL) {
+            Seg->Conv->EtlFiles = Conv->EtlFiles;
+            Seg->Conv->SharedEtlFiles = TRUE;
+        }
+        Seg->Thread = CreateThread(NULL, 0, SegmentThread, Seg->Conv, 0, NULL);
+        if (Seg->Thread == NULL) {
+            Err = GetLastError();
+            printf("CreateThread failed with %u\n", Err);
+            goto Done;
+        }
+    }
+
+    for (i = 0; i < NumRanges; i++) {
+        WaitForSingleObject(Segments[i].Thread, INFINITE);
+        GetExitCodeThread(Segments[i].Thread, &ExitCode);
+        if (Err == NO_ERROR) {
+            Err = (int)ExitCode;
+        }
+    }
+    if (Err != NO_ERROR) {
+        goto Done;
+    }
+
+    Err = PcapNgWriterInit(&Conv->Writer, NULL, Conv->Options.WriteBufferSize);
+    if (Err != NO_ERROR) {
+        goto Done;
+    }
+    Err = OpenSink(Conv, Conv->OutFileName);
+    if (Err != NO_ERROR) {
+        goto Done;
+    }
+
+    for (i = 0; i < NumRanges; i++) {
+        Seg = &Segments[i];
+        IdMap = ConvAlloc(Conv, max(Seg->Conv->NumOutputInterfaces, 1) * sizeof(unsigned long));
+        if (IdMap == NULL) {
+            Err = ERROR_NOT_ENOUGH_MEMORY;
+            goto Done;
+        }
+        Err = MergeSegmentInterfaces(Conv, Seg, IdMap);
+        if (Err != NO_ERROR) {
+            goto Done;
+        }
+        Err = CopySegment(Conv, Seg, IdMap);
+        if (Err != NO_ERROR) {
+            goto Done;
+        }
+        Conv->NumFramesConverted += Seg->Conv->NumFramesConverted;
+        Conv->NumFramesFiltered += Seg->Conv->NumFramesFiltered;
+        Conv->NumFramesDuplicate += Seg->Conv->NumFramesDuplicate;
+        Conv->NumBytesConverted += Seg->Conv->NumBytesConverted;
+    }
+
+    if (Conv->Options.WriteStatsBlocks) {
+        Err = WriteInterfaceStats(Conv);
+        if (Err != NO_ERROR) {
+            printf("Writing interface statistics failed with %u\n", Err);
+            goto Done;
+        }
+    }
+
+    Err = CloseOutput(Conv);
+    if (Err != NO_ERROR) {
+        goto Done;
+    }
+
+    if (!Conv->Options.Quiet) {
+        printf("Converted %llu frames\n", Conv->NumFramesConverted);
+        if (Conv->NumFramesFiltered > 0) {
+            printf("Skipped %llu frames that didn't match the filters\n", Conv->NumFramesFiltered);
+        }
+        if (Conv->NumFramesDuplicate > 0) {
+            printf("Skipped %llu copies of frames on other layers (--dedup)\n", Conv->NumFramesDuplicate);
+        }
+    }
+
+Done:
+    // The threads that did start have to finish before their conversions
+    // (and the direct reader's index) can be freed.
+    for (i = 0; i < NumRanges; i++) {
+        Seg = &Segments[i];
+        if (Seg->Thread != NULL) {
+            WaitForSingleObject(Seg->Thread, INFINITE);
+            CloseHandle(Seg->Thread);
+        }
+        if (Seg->Conv != NULL) {
+            FreeInterfaces(Seg->Conv);
+            FreeConversion(Seg->Conv);
+            DeleteFile(Seg->FileName);
+        } else if (Seg->FileName[0] != L'\0') {
+            DeleteFile(Seg->FileName); // from GetTempFileName
+        }
+    }
+    free(Segments);
+    CloseOutput(Conv);
+    PcapNgWriterCleanup(&Conv->Writer);
+    CloseDirect(Conv);
+    return Err;
+}
+
+void Etl2PcapngDefaultOptions(struct ETL2PCAPNG_OPTIONS* Options)
+{
+    ZeroMemory(Options, sizeof(*Options));
+    Options->WriteBufferSize = PCAPNG_WRITER_DEFAULT_BUFFER_SIZE;
+    Options->MetadataFormat = ETL2PCAPNG_METADATA_COMMENT;
+    Options->TsResol = ETL2PCAPNG_TSRESOL_USEC;
+    Options->CompressLevel = GZIP_DEFAULT_LEVEL;
+    Options->Filter.Direction = ETL2PCAPNG_DIRECTION_ANY;
+    Options->Filter.End = MAXLONGLONG;
+}
+
+BOOLEAN Etl2PcapngIsStreamOutput(const wchar_t* OutFileName)
+{
+    return !wcscmp(OutFileName, L"-") ||
+        !_wcsnicmp(OutFileName, L"\\\\.\\pipe\\", 9) ||
+        !_wcsnicmp(OutFileName, L"tcp://", 6);
+}
+
+int Etl2PcapngCheckOptions(const struct ETL2PCAPNG_OPTIONS* Options, const wchar_t* OutFileName)
+{
+    if (Options->WriteBufferSize == 0 ||
+        Options->CompressLevel < GZIP_MIN_LEVEL || Options->CompressLevel > GZIP_MAX_LEVEL ||
+        Options->Filter.NumIfIndex > ETL2PCAPNG_FILTER_MAX_IFINDEX ||
+        Options->ParallelRanges > ETL2PCAPNG_MAX_PARALLEL_RANGES ||
+        (Options->Dedup != ETL2PCAPNG_DEDUP_NONE &&
+         Options->Dedup != ETL2PCAPNG_DEDUP_MINIPORT &&
+         Options->Dedup != ETL2PCAPNG_DEDUP_TOP) ||
+        (Options->TsResol != ETL2PCAPNG_TSRESOL_USEC && Options->TsResol != ETL2PCAPNG_TSRESOL_100NS) ||
+        (Options->MetadataFormat != ETL2PCAPNG_METADATA_COMMENT &&
+         Options->MetadataFormat != ETL2PCAPNG_METADATA_CUSTOM &&
+         Options->MetadataFormat != ETL2PCAPNG_METADATA_RADIOTAP)) {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    if (Options->TsOffset && Options->TsResol != ETL2PCAPNG_TSRESOL_100NS) {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    if (Options->Scan != ETL2PCAPNG_SCAN_NONE) {
+        // Only the input is read, in one pass, and all of it is summarized.
+        if ((Options->Scan != ETL2PCAPNG_SCAN_TEXT && Options->Scan != ETL2PCAPNG_SCAN_JSON) ||
+            OutFileName != NULL || Options->Live || Options->SortInterfaces ||
+            Options->Pipeline || Options->Overlapped || Options->NoBuffering || Options->Compress ||
+            Options->SplitSize != 0 || Options->SplitSeconds != 0 ||
+            Options->IndexInterval != 0 || Options->ParallelRanges > 1 ||
+            Options->Dedup != ETL2PCAPNG_DEDUP_NONE || Options->WriteStatsBlocks ||
+            Options->MaxPackets != 0 || Options->MaxBytes != 0 || Options->ReportStats) {
+            return ERROR_INVALID_PARAMETER;
+        }
+        return NO_ERROR;
+    }
+
+    if (OutFileName == NULL) {
+        // Etl2PcapngCreate: the events come from the caller and the
+        // output is the caller's sink.
+        if (Options->Direct || Options->Live || Options->SortInterfaces ||
+            Options->Overlapped || Options->NoBuffering ||
+            Options->SplitSize != 0 || Options->SplitSeconds != 0 ||
+            Options->IndexInterval != 0 || Options->ParallelRanges > 1) {
+            return ERROR_INVALID_PARAMETER;
+        }
+        return NO_ERROR;
+    }
+
+    // The segments of a parallel conversion each see part of the events,
+    // so nothing that needs all of them in order (the interface sort, the
+    // limits, the statistics and progress) works with it, and the output is
+    // only written at the end, in one piece.
+    if (Options->ParallelRanges > 1 &&
+        (Options->Live || Options->SortInterfaces ||
+         Options->MaxPackets != 0 || Options->MaxBytes != 0 ||
+         Options->ReportStats || Options->ReportProgress ||
+         Options->SplitSize != 0 || Options->SplitSeconds != 0 ||
+         Options->IndexInterval != 0)) {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    if (Options->Live && (Options->SortInterfaces || Options->Direct)) {
+        // A real-time session can't be read twice, so interfaces are always
+        // written as they are first seen, and there is no file to map.
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    if ((Options->SplitSize != 0 || Options->SplitSeconds != 0) && Etl2PcapngIsStreamOutput(OutFileName)) {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    // Overlapped writes need a file: the last sector is padded and then cut
+    // off again by setting the end of the file.
+    if ((Options->Overlapped || Options->NoBuffering) && Etl2PcapngIsStreamOutput(OutFileName)) {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    // The offsets in a gzip file can't be seeked to.
+    if (Options->IndexInterval != 0 && (Options->Compress || Etl2PcapngIsStreamOutput(OutFileName))) {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    return NO_ERROR;
+}
+
+int Etl2PcapngOpenFiles(
+    const struct ETL2PCAPNG_OPTIONS* Options,
+    wchar_t** InFileNames,
+    unsigned long NumInputs,
+    wchar_t* OutFileName,
+    struct CONVERSION** Conv)
+{
+    *Conv = NULL;
+    if (NumInputs == 0 || NumInputs > ETL2PCAPNG_MAX_INPUTS ||
+        (Options->Live && NumInputs != 1) ||
+        Etl2PcapngCheckOptions(Options, OutFileName) != NO_ERROR) {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    *Conv = AllocConversion(Options, InFileNames, NumInputs, OutFileName);
+    if (*Conv == NULL) {
+        printf("out of memory\n");
+        return ERROR_NOT_ENOUGH_MEMORY;
+    }
+    return NO_ERROR;
+}
+
+int Etl2PcapngConvert(struct CONVERSION* Conv)
+{
+    if (Conv->Options.ParallelRanges > 1) {
+        return ConvertParallel(Conv);
+    }
+    return Convert(Conv);
+}
+
+int Etl2PcapngCreate(
+    const struct ETL2PCAPNG_OPTIONS* Options,
+    struct PCAPNG_SINK* Sink,
+    struct CONVERSION** Conv)
+{
+    int Err;
+
+    *Conv = NULL;
+    if (Options->Scan != ETL2PCAPNG_SCAN_NONE || Etl2PcapngCheckOptions(Options, NULL) != NO_ERROR) {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    *Conv = AllocConversion(Options, NULL, 1, NULL);
+    if (*Conv == NULL) {
+        printf("out of memory\n");
+        return ERROR_NOT_ENOUGH_MEMORY;
+    }
+    (*Conv)->CallerSink = Sink;
+    (*Conv)->Pass2 = TRUE;
+
+    Err = PcapNgWriterInit(&(*Conv)->Writer, NULL, Options->WriteBufferSize);
+    if (Err != NO_ERROR) {
+        return Err;
+    }
+    Err = StackSinks(*Conv, Sink);
+    if (Err != NO_ERROR) {
+        return Err;
+    }
+    if (Options->Pipeline) {
+        Err = StartPipeline(*Conv);
+    }
+    return Err;
+}
+
+int Etl2PcapngFeedEvent(struct CONVERSION* Conv, PEVENT_RECORD ev)
+{
+    struct INPUT* Input = &Conv->Inputs[0];
+    LONGLONG Start;
+
+    if (Conv->Err != NO_ERROR) {
+        return Conv->Err;
+    }
+    if (Conv->LimitReached) {
+        return ERROR_CANCELLED;
+    }
+
+    Start = StatsNow(Conv);
+    Conv->NumEvents++;
+    ConvertEvent(Input, ev);
+    Conv->Stats.CallbackTicks += StatsNow(Conv) - Start;
+
+    if (Conv->Err != NO_ERROR) {
+        return Conv->Err;
+    }
+    return Conv->LimitReached ? ERROR_CANCELLED : NO_ERROR;
+}
+
+int Etl2PcapngFlush(struct CONVERSION* Conv)
+{
+    if (Conv->Err != NO_ERROR) {
+        return Conv->Err;
+    }
+    DedupFlush(Conv);
+    return EmitFlush(Conv);
+}
+
+int Etl2PcapngFinish(struct CONVERSION* Conv)
+{
+    int Err;
+    int CloseErr;
+
+    DedupFlush(Conv);
+    Err = StopPipeline(Conv);
+    if (Err == NO_ERROR) {
+        Err = Conv->Err;
+    }
+    if (Err == NO_ERROR && Conv->Options.WriteStatsBlocks) {
+        Err = WriteInterfaceStats(Conv);
+    }
+    // The sink is closed even after a failure, as for an output file.
+    CloseErr = CloseOutput(Conv);
+    if (Err == NO_ERROR) {
+        Err = CloseErr;
+    }
+    if (Err == NO_ERROR && !Conv->Options.Quiet && Conv->Options.ReportStats) {
+        PrintStats(Conv);
+    }
+    return Err;
+}
+
+void Etl2PcapngGetCounters(struct CONVERSION* Conv, struct ETL2PCAPNG_COUNTERS* Counters)
+{
+    Counters->FramesConverted = Conv->NumFramesConverted;
+    Counters->FramesFiltered = Conv->NumFramesFiltered;
+    Counters->FramesDuplicate = Conv->NumFramesDuplicate;
+    Counters->BytesConverted = Conv->NumBytesConverted;
+    Counters->LimitReached = Conv->LimitReached;
+    Counters->NumFiles = max(Conv->SplitIndex, 1);
+}
+
+void Etl2PcapngFree(struct CONVERSION* Conv)
+{
+    if (Conv == NULL) {
+        return;
+    }
+    // Etl2PcapngConvert cleans up after itself except for the interfaces,
+    // so the rest is only for a conversion from Etl2PcapngCreate that
+    // wasn't finished.
+    StopPipeline(Conv);
+    CloseOutput(Conv);
+    PcapNgWriterCleanup(&Conv->Writer);
+    CloseDirect(Conv);
+    FreeInterfaces(Conv);
+    FreeConversion(Conv);
+}
@@ -0,0 +1,225 @@
+/*
+
+Copyright (c) Microsoft Corporation.
+Licensed under the MIT License.
+
+The conversion engine of etl2pcapng, usable without the command line tool.
+
+A conversion is described by an ETL2PCAPNG_OPTIONS (the command line
+options of etl2pcapng, see the README) and driven in one of two ways:
+
+-Etl2PcapngOpenFiles and Etl2PcapngConvert convert ETL files, or a live
+ capture session, to an output file, exactly as etl2pcapng.exe does.
+
+-Etl2PcapngCreate returns a conversion that the caller feeds one
+ EVENT_RECORD at a time (e.g. from its own ETW consumer) with
+ Etl2PcapngFeedEvent. The pcapng output goes to a PCAPNG_SINK supplied by
+ the caller: a PCAPNG_FILE_SINK on any handle, a MEMORY_SINK (sinks.h) to
+ get the bytes back, or the caller's own implementation.
+
+Every conversion is independent, so several can run on different threads.
+All functions return Win32 error codes; diagnostics are printed to stdout
+unless Quiet is set.
+
+Include after <windows.h>, <evntcons.h> and <pcapng.h>.
+
+*/
+
+#pragma once
+
+#define ETL2PCAPNG_METADATA_COMMENT  0
+#define ETL2PCAPNG_METADATA_CUSTOM   1
+#define ETL2PCAPNG_METADATA_RADIOTAP 2
+
+#define ETL2PCAPNG_TSRESOL_USEC  6
+#define ETL2PCAPNG_TSRESOL_100NS 7
+
+// Which copy of a packet logged on several layers of the stack (the
+// miniport and the filters bound over it) is kept.
+#define ETL2PCAPNG_DEDUP_NONE     0 // all of them
+#define ETL2PCAPNG_DEDUP_MINIPORT 1 // the one closest to the miniport
+#define ETL2PCAPNG_DEDUP_TOP      2 // the top-most one
+
+// Conversion-time filters. Everything except the IfIndex is checked
+// against the event header, and the IfIndex is read from its fixed offset
+// in the event, so rejected events are never decoded.
+#define ETL2PCAPNG_FILTER_MAX_IFINDEX 16
+#define ETL2PCAPNG_DIRECTION_ANY  0
+#define ETL2PCAPNG_DIRECTION_SEND 1
+#define ETL2PCAPNG_DIRECTION_RECV 2
+
+struct ETL2PCAPNG_FILTER {
+    unsigned long IfIndex[ETL2PCAPNG_FILTER_MAX_IFINDEX]; // LowerIfIndex
+    unsigned long NumIfIndex; // 0 matches all interfaces
+    int Direction;
+    BOOLEAN MatchPid;
+    unsigned long Pid;
+    LONGLONG Start; // FILETIME ticks, 0 if unset
+    LONGLONG End;   // FILETIME ticks, MAXLONGLONG if unset
+};
+
+// Options that only make sense for files (Direct, Live, SortInterfaces,
+// Overlapped, NoBuffering, SplitSize, SplitSeconds, IndexInterval,
+// ParallelRanges, Scan) can't be used with Etl2PcapngCreate.
+//
+// ParallelRanges converts the input in that many time ranges on as many
+// threads and concatenates the results; it can't be combined with Live,
+// SortInterfaces, splitting, the index, the limits or ReportStats and
+// ReportProgress.
+#define ETL2PCAPNG_MAX_PARALLEL_RANGES 64
+
+// Scan summarizes the input instead of converting it: Etl2PcapngConvert
+// reads only the event headers and the fixed-size fields of the packet
+// events (not the packet data) and prints the interfaces with their packet
+// and byte counts and time ranges, the time span of the trace and how many
+// events of each id it has, as text or as a JSON object. Nothing is
+// written, so there is no output file (OutFileName is NULL), and the
+// filters and --if-names apply but no option that only shapes the output
+// can be used; SnapLen only changes the BytesConverted counter.
+#define ETL2PCAPNG_SCAN_NONE 0
+#define ETL2PCAPNG_SCAN_TEXT 1
+#define ETL2PCAPNG_SCAN_JSON 2
+
+struct ETL2PCAPNG_OPTIONS {
+    BOOLEAN Quiet; // don't print the interface table, summary and progress
+    unsigned long WriteBufferSize;
+    BOOLEAN SortInterfaces;
+    int MetadataFormat; // ETL2PCAPNG_METADATA_*
+    unsigned long SnapLen; // 0 to write whole packets
+    int Dedup; // ETL2PCAPNG_DEDUP_*
+    UCHAR TsResol; // ETL2PCAPNG_TSRESOL_*
+    BOOLEAN TsOffset; // only with ETL2PCAPNG_TSRESOL_100NS
+    BOOLEAN ResolveNames; // --if-names
+    BOOLEAN WriteStatsBlocks; // --if-stats
+    BOOLEAN ReportStats;
+    BOOLEAN ReportProgress;
+    unsigned long MaxPackets; // 0 for no limit
+    unsigned long long MaxBytes; // 0 for no limit
+    BOOLEAN Direct;
+    BOOLEAN Pipeline;
+    BOOLEAN Live;
+    BOOLEAN Overlapped;
+    BOOLEAN NoBuffering; // implies Overlapped
+    BOOLEAN Compress; // gzip
+    unsigned long CompressLevel;
+    unsigned long SplitSize;
+    unsigned long SplitSeconds;
+    unsigned long IndexInterval; // --index, 0 for no index
+    unsigned long ParallelRanges; // --parallel, 0 or 1 to convert in one go
+    int Scan; // --scan, ETL2PCAPNG_SCAN_*
+    struct ETL2PCAPNG_FILTER Filter;
+};
+
+// --index: next to each output file <name>, an index <name>.idx with the
+// file offset of every IndexInterval-th Enhanced Packet Block and the range
+// of each interface's packets, so that tools can seek to the packets
+// around a time without reading the whole file. Offsets are from the start
+// of the file (the Section Header Block), timestamps are as in the EPBs
+// (in if_tsresol units, without if_tsoffset), and interface IDs are those
+// of the IDBs. The packets, and so the entries, are in the order the
+// events were logged, i.e. by timestamp. All fields are little endian.
+//
+// The file is an ETL2PCAPNG_INDEX_HEADER, NumEntries entries and then
+// NumInterfaces interfaces, in interface ID order.
+#define ETL2PCAPNG_INDEX_MAGIC "E2PI"
+#define ETL2PCAPNG_INDEX_VERSION 1
+#define ETL2PCAPNG_INDEX_DEFAULT_INTERVAL 1024
+
+struct ETL2PCAPNG_INDEX_HEADER {
+    char Magic[4]; // ETL2PCAPNG_INDEX_MAGIC
+    unsigned long Version;
+    unsigned long Interval;
+    unsigned long TsResol; // ETL2PCAPNG_TSRESOL_*
+    unsigned long long NumPackets; // in the file
+    unsigned long NumEntries;
+    unsigned long NumInterfaces;
+};
+
+struct ETL2PCAPNG_INDEX_ENTRY {
+    unsigned long long Offset; // of the EPB
+    unsigned long long TimeStamp;
+    unsigned long InterfaceId;
+    unsigned long PacketNumber; // in the file, from 0
+};
+
+struct ETL2PCAPNG_INDEX_INTERFACE {
+    unsigned long long Packets; // 0 if the interface has none in this file
+    unsigned long long FirstOffset; // of its first EPB
+    unsigned long long FirstTimeStamp;
+    unsigned long long LastTimeStamp;
+};
+
+// The same defaults as etl2pcapng.exe.
+void Etl2PcapngDefaultOptions(struct ETL2PCAPNG_OPTIONS* Options);
+
+// Checks the combination of options, given the output it will be used with
+// (NULL for Etl2PcapngCreate and Scan). Returns ERROR_INVALID_PARAMETER, without
+// printing anything, if they can't be used together.
+int Etl2PcapngCheckOptions(const struct ETL2PCAPNG_OPTIONS* Options, const wchar_t* OutFileName);
+
+// Whether OutFileName is a stream (stdout, a pipe or a TCP connection)
+// rather than a file, which rules out e.g. splitting the output.
+BOOLEAN Etl2PcapngIsStreamOutput(const wchar_t* OutFileName);
+
+struct CONVERSION;
+
+// ProcessTrace takes at most this many trace handles.
+#define ETL2PCAPNG_MAX_INPUTS 64
+
+struct ETL2PCAPNG_COUNTERS {
+    unsigned long long FramesConverted;
+    unsigned long long FramesFiltered; // didn't match the filters
+    unsigned long long FramesDuplicate; // copies dropped by Dedup
+    unsigned long long BytesConverted; // packet data, after SnapLen
+    BOOLEAN LimitReached; // MaxPackets/MaxBytes
+    unsigned long NumFiles; // written, with SplitSize/SplitSeconds
+};
+
+// Prepares the conversion of InFileNames (up to ETL2PCAPNG_MAX_INPUTS)
+// into OutFileName, which can also be "-" for stdout, \\.\pipe\<name> or
+// tcp://<host>:<port> to stream it to a collector (see SOCKET_SINK).
+// With Options->Live there is a single input with a NULL name, and with
+// Options->Scan OutFileName is NULL. The file names must stay valid until
+// Etl2PcapngFree.
+int Etl2PcapngOpenFiles(
+    const struct ETL2PCAPNG_OPTIONS* Options,
+    wchar_t** InFileNames,
+    unsigned long NumInputs,
+    wchar_t* OutFileName,
+    struct CONVERSION** Conv);
+
+// Runs a conversion from Etl2PcapngOpenFiles to its end (for a live
+// session, until Etl2PcapngStopLive is called).
+int Etl2PcapngConvert(struct CONVERSION* Conv);
+
+// Stops the live capture session of a conversion (each has its own, so
+// several live conversions can run at once), which makes Etl2PcapngConvert
+// finish the output and return. Can be called from any thread, e.g. a
+// console control handler, while Etl2PcapngConvert runs.
+void Etl2PcapngStopLive(struct CONVERSION* Conv);
+
+// Starts a conversion of events fed by the caller, and writes the section
+// header to Sink. The sink belongs to the caller, but is closed by
+// Etl2PcapngFinish. *Conv is to be freed even if this fails.
+int Etl2PcapngCreate(
+    const struct ETL2PCAPNG_OPTIONS* Options,
+    struct PCAPNG_SINK* Sink,
+    struct CONVERSION** Conv);
+
+// Converts one event; events from other providers are ignored. Returns
+// ERROR_CANCELLED once MaxPackets or MaxBytes has been reached.
+int Etl2PcapngFeedEvent(struct CONVERSION* Conv, PEVENT_RECORD ev);
+
+// Hands everything converted so far to the sink. With Pipeline this only
+// queues the flush behind the packets still being encoded.
+int Etl2PcapngFlush(struct CONVERSION* Conv);
+
+// Writes the end of the output (e.g. the WriteStatsBlocks ISBs) and closes
+// the sink. No more events can be fed afterwards.
+int Etl2PcapngFinish(struct CONVERSION* Conv);
+
+void Etl2PcapngGetCounters(struct CONVERSION* Conv, struct ETL2PCAPNG_COUNTERS* Counters);
+
+// Frees a conversion from Etl2PcapngOpenFiles or Etl2PcapngCreate (closing
+// its output first if it is still open).
+void Etl2PcapngFree(struct CONVERSION* Conv);
@@ -0,0 +1,587 @@
+/*
+
+Copyright (c) Microsoft Corporation.
+Licensed under the MIT License.
+
+Direct ETL file reader, see etlfile.h.
+
+An ETL file is a sequence of fixed-size buffers, each starting with a
+WMI_BUFFER_HEADER and followed by 8-byte aligned event records. Every
+record starts with a marker whose third byte is the header type; the rest
+of the buffer after the last record is filled with 0xFF. Buffers are
+written per processor, so events in different buffers interleave in time.
+
+*/
+
+#define WIN32_LEAN_AND_MEAN 1
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <evntrace.h>
+#include <evntcons.h>
+#include <etlfile.h>
+
+// Layout of WMI_BUFFER_HEADER (ntwmi.h).
+struct ETL_BUFFER_HEADER {
+    ULONG BufferSize;
+    ULONG SavedOffset;
+    ULONG CurrentOffset;
+    LONG ReferenceCount;
+    LONGLONG TimeStamp;
+    LONGLONG SequenceNumber;
+    ULONGLONG Clock;
+    ETW_BUFFER_CONTEXT ClientContext;
+    ULONG State;
+    ULONG Offset;
+    USHORT BufferFlag;
+    USHORT BufferType;
+    ULONG Reserved[4];
+};
+C_ASSERT(sizeof(struct ETL_BUFFER_HEADER) == 72);
+
+#define ETL_BUFFER_FLAG_COMPRESSED 0x40
+
+// Record header types (the third byte of the marker).
+#define TRACE_HEADER_TYPE_SYSTEM32       1
+#define TRACE_HEADER_TYPE_SYSTEM64       2
+#define TRACE_HEADER_TYPE_COMPACT32      3
+#define TRACE_HEADER_TYPE_COMPACT64      4
+#define TRACE_HEADER_TYPE_FULL_HEADER32  10
+#define TRACE_HEADER_TYPE_INSTANCE32     11
+#define TRACE_HEADER_TYPE_PERFINFO32     16
+#define TRACE_HEADER_TYPE_PERFINFO64     17
+#define TRACE_HEADER_TYPE_EVENT_HEADER32 18
+#define TRACE_HEADER_TYPE_EVENT_HEADER64 19
+#define TRACE_HEADER_TYPE_FULL_HEADER64  20
+#define TRACE_HEADER_TYPE_INSTANCE64     21
+
+#define TRACE_HEADER_FLAGS_MASK 0xC0 // the fourth byte of every marker
+
+#define ETL_FILLER 0xFFFFFFFF
+
+#ifndef EVENT_TRACE_COMPRESSED_MODE
+#define EVENT_TRACE_COMPRESSED_MODE 0x04000000
+#endif
+
+#define ETL_CLOCK_QPC         1
+#define ETL_CLOCK_SYSTEM_TIME 2
+
+int EtlOpen(struct ETL_FILE* Etl, const wchar_t* FileName, const TRACE_LOGFILE_HEADER* Header, PVOID Context)
+{
+    LARGE_INTEGER Size;
+    const struct ETL_BUFFER_HEADER* First;
+
+    ZeroMemory(Etl, sizeof(*Etl));
+    Etl->File = INVALID_HANDLE_VALUE;
+    Etl->Context = Context;
+    Etl->ClockType = Header->ReservedFlags;
+    Etl->PerfFreq = Header->PerfFreq.QuadPart;
+
+    if (Header->LogFileMode & EVENT_TRACE_COMPRESSED_MODE) {
+        Etl->Problem = "the file is compressed";
+        return ERROR_NOT_SUPPORTED;
+    }
+    if (Etl->ClockType != ETL_CLOCK_SYSTEM_TIME &&
+        (Etl->ClockType != ETL_CLOCK_QPC || Etl->PerfFreq <= 0)) {
+        Etl->Problem = "the file uses CPU cycle timestamps";
+        return ERROR_NOT_SUPPORTED;
+    }
+
+    Etl->File = CreateFile(FileName, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, NULL);
+    if (Etl->File == INVALID_HANDLE_VALUE) {
+        return GetLastError();
+    }
+    if (!GetFileSizeEx(Etl->File, &Size)) {
+        return GetLastError();
+    }
+    Etl->Size = Size.QuadPart;
+    if (Etl->Size < sizeof(struct ETL_BUFFER_HEADER) || Etl->Size > (SIZE_T)-1) {
+        Etl->Problem = "the file is too large to be memory mapped";
+        return ERROR_NOT_SUPPORTED;
+    }
+
+    Etl->Mapping = CreateFileMapping(Etl->File, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (Etl->Mapping != NULL) {
+        Etl->View = MapViewOfFile(Etl->Mapping, FILE_MAP_READ, 0, 0, 0);
+    }
+    if (Etl->View == NULL) {
+        // Most likely out of address space (x86).
+        Etl->Problem = "the file can't be memory mapped";
+        return ERROR_NOT_SUPPORTED;
+    }
+
+    // All buffers have the size of the first one.
+    First = (const struct ETL_BUFFER_HEADER*)Etl->View;
+    Etl->BufferSize = First->BufferSize;
+    if (Etl->BufferSize < sizeof(struct ETL_BUFFER_HEADER) || Etl->BufferSize % 8 != 0 ||
+        Etl->BufferSize > Etl->Size) {
+        Etl->Problem = "the first buffer header is invalid";
+        return ERROR_NOT_SUPPORTED;
+    }
+
+    return NO_ERROR;
+}
+
+void EtlClose(struct ETL_FILE* Etl)
+{
+    unsigned long i;
+
+    for (i = 0; i < Etl->NumRuns; i++) {
+        free(Etl->Runs[i].Events);
+    }
+    Etl->NumRuns = 0;
+    if (Etl->View != NULL) {
+        UnmapViewOfFile(Etl->View);
+        Etl->View = NULL;
+    }
+    if (Etl->Mapping != NULL) {
+        CloseHandle(Etl->Mapping);
+        Etl->Mapping = NULL;
+    }
+    if (Etl->File != INVALID_HANDLE_VALUE && Etl->File != NULL) {
+        CloseHandle(Etl->File);
+        Etl->File = INVALID_HANDLE_VALUE;
+    }
+}
+
+// Converts a raw timestamp to FILETIME ticks relative to the anchor event.
+LONGLONG EtlFileTime(struct ETL_FILE* Etl, LONGLONG Raw)
+{
+    unsigned long long Delta = (unsigned long long)(Raw - Etl->AnchorRaw);
+
+    if (Etl->ClockType == ETL_CLOCK_SYSTEM_TIME) {
+        return Etl->AnchorTime + (LONGLONG)Delta;
+    }
+    return Etl->AnchorTime +
+        (LONGLONG)((Delta / Etl->PerfFreq) * 10000000 + (Delta % Etl->PerfFreq) * 10000000 / Etl->PerfFreq);
+}
+
+void WINAPI EtlProbeCallback(PEVENT_RECORD ev)
+{
+    struct ETL_FILE* Etl = (struct ETL_FILE*)ev->UserContext;
+
+    if (Etl->ProbeFound || !IsEqualGUID(&ev->EventHeader.ProviderId, &Etl->ProviderId)) {
+        return;
+    }
+    Etl->ProbeFound = TRUE;
+    Etl->ProbeHeader = ev->EventHeader;
+    Etl->ProbeDataLength = ev->UserDataLength;
+    memcpy(Etl->ProbeData, ev->UserData, min(ev->UserDataLength, sizeof(Etl->ProbeData)));
+}
+
+ULONG WINAPI EtlProbeBufferCallback(PEVENT_TRACE_LOGFILE LogFile)
+{
+    return !((struct ETL_FILE*)LogFile->Context)->ProbeFound;
+}
+
+// Reads the file with ProcessTrace until the first event of the provider.
+int EtlProbe(struct ETL_FILE* Etl, const wchar_t* FileName)
+{
+    int Err;
+    EVENT_TRACE_LOGFILE LogFile;
+    TRACEHANDLE Trace;
+
+    ZeroMemory(&LogFile, sizeof(LogFile));
+    LogFile.LogFileName = (LPWSTR)FileName;
+    LogFile.ProcessTraceMode = PROCESS_TRACE_MODE_EVENT_RECORD;
+    LogFile.EventRecordCallback = EtlProbeCallback;
+    LogFile.BufferCallback = EtlProbeBufferCallback;
+    LogFile.Context = Etl;
+
+    Trace = OpenTrace(&LogFile);
+    if (Trace == INVALID_PROCESSTRACE_HANDLE) {
+        return GetLastError();
+    }
+    Err = ProcessTrace(&Trace, 1, NULL, NULL);
+    if (Err == ERROR_CANCELLED) {
+        Err = NO_ERROR; // stopped by EtlProbeBufferCallback
+    }
+    CloseTrace(Trace);
+    return Err;
+}
+
+BOOLEAN EtlAddEvent(struct ETL_RUN* Run, LONGLONG TimeStamp, unsigned long long Offset, USHORT ProcessorIndex)
+{
+    struct ETL_EVENT* Events;
+    unsigned long long MaxEvents;
+
+    if (Run->NumEvents == Run->MaxEvents) {
+        MaxEvents = max(Run->MaxEvents * 2, 4096);
+        if (MaxEvents > (SIZE_T)-1 / sizeof(struct ETL_EVENT)) {
+            return FALSE;
+        }
+        Events = realloc(Run->Events, (SIZE_T)MaxEvents * sizeof(struct ETL_EVENT));
+        if (Events == NULL) {
+            return FALSE;
+        }
+        Run->Events = Events;
+        Run->MaxEvents = MaxEvents;
+    }
+    Run->Events[Run->NumEvents].TimeStamp = TimeStamp;
+    Run->Events[Run->NumEvents].Offset = Offset;
+    Run->Events[Run->NumEvents].ProcessorIndex = ProcessorIndex;
+    Run->NumEvents++;
+    return TRUE;
+}
+
+int __cdecl EtlEventCompareFn(const void* A, const void* B)
+{
+    const struct ETL_EVENT* a = (const struct ETL_EVENT*)A;
+    const struct ETL_EVENT* b = (const struct ETL_EVENT*)B;
+
+    if (a->TimeStamp != b->TimeStamp) {
+        return a->TimeStamp < b->TimeStamp ? -1 : 1;
+    }
+    return a->Offset < b->Offset ? -1 : a->Offset > b->Offset ? 1 : 0;
+}
+
+// Walks the records of the buffers [FirstBuffer, EndBuffer) and indexes
+// the events of the provider.
+DWORD WINAPI EtlScanWorker(LPVOID Context)
+{
+    struct ETL_RUN* Run = (struct ETL_RUN*)Context;
+    struct ETL_FILE* Etl = Run->Etl;
+    const struct ETL_BUFFER_HEADER* Header;
+    const BYTE* Buffer;
+    const BYTE* Record;
+    const EVENT_HEADER* EventHeader;
+    unsigned long long BufferOffset;
+    unsigned long long i;
+    unsigned long Used;
+    unsigned long Offset;
+    unsigned long Size;
+
+    for (i = Run->FirstBuffer; i < Run->EndBuffer; i++) {
+        BufferOffset = i * Etl->BufferSize;
+        Buffer = Etl->View + BufferOffset;
+        Header = (const struct ETL_BUFFER_HEADER*)Buffer;
+        if (Header->BufferSize != Etl->BufferSize) {
+            Run->Problem = "the buffers have different sizes";
+            goto Done;
+        }
+        if (Header->BufferFlag & ETL_BUFFER_FLAG_COMPRESSED) {
+            Run->Problem = "the file has compressed buffers";
+            goto Done;
+        }
+
+        // Either offset can be the end of the data depending on how the
+        // buffer was flushed; anything after the last record is filler.
+        Used = 0;
+        if (Header->SavedOffset <= Etl->BufferSize) {
+            Used = Header->SavedOffset;
+        }
+        if (Header->Offset <= Etl->BufferSize) {
+            Used = max(Used, Header->Offset);
+        }
+
+        Offset = sizeof(struct ETL_BUFFER_HEADER);
+        while (Offset + 2 * sizeof(ULONG) <= Used) {
+            Record = Buffer + Offset;
+            if (*(UNALIGNED const ULONG*)Record == ETL_FILLER) {
+                break;
+            }
+            if ((Record[3] & TRACE_HEADER_FLAGS_MASK) != TRACE_HEADER_FLAGS_MASK) {
+                Run->Problem = "the file has an event record without a marker";
+                goto Done;
+            }
+
+            switch (Record[2]) {
+            case TRACE_HEADER_TYPE_EVENT_HEADER32:
+            case TRACE_HEADER_TYPE_EVENT_HEADER64:
+            case TRACE_HEADER_TYPE_FULL_HEADER32:
+            case TRACE_HEADER_TYPE_FULL_HEADER64:
+            case TRACE_HEADER_TYPE_INSTANCE32:
+            case TRACE_HEADER_TYPE_INSTANCE64:
+                Size = *(UNALIGNED const USHORT*)Record;
+                break;
+            case TRACE_HEADER_TYPE_SYSTEM32:
+            case TRACE_HEADER_TYPE_SYSTEM64:
+            case TRACE_HEADER_TYPE_COMPACT32:
+            case TRACE_HEADER_TYPE_COMPACT64:
+            case TRACE_HEADER_TYPE_PERFINFO32:
+            case TRACE_HEADER_TYPE_PERFINFO64:
+                Size = *(UNALIGNED const USHORT*)(Record + sizeof(ULONG));
+                break;
+            default:
+                Run->Problem = "the file has an unknown type of event record";
+                goto Done;
+            }
+            if (Size < 2 * sizeof(ULONG) || Size > Used - Offset) {
+                Run->Problem = "the file has an event record that runs past its buffer";
+                goto Done;
+            }
+
+            EventHeader = (const EVENT_HEADER*)Record;
+            if ((Record[2] == TRACE_HEADER_TYPE_EVENT_HEADER32 || Record[2] == TRACE_HEADER_TYPE_EVENT_HEADER64) &&
+                Size >= sizeof(EVENT_HEADER) &&
+                IsEqualGUID(&EventHeader->ProviderId, &Etl->ProviderId)) {
+                if (EventHeader->Flags & EVENT_HEADER_FLAG_EXTENDED_INFO) {
+                    Run->Problem = "the events have extended data";
+                    goto Done;
+                }
+                if (!EtlAddEvent(Run, EventHeader->TimeStamp.QuadPart, BufferOffset + Offset,
+                        Header->ClientContext.ProcessorIndex)) {
+                    Run->Err = ERROR_NOT_ENOUGH_MEMORY;
+                    goto Done;
+                }
+            } else {
+                Run->NumOther++;
+            }
+
+            Offset += (Size + 7) & ~7;
+        }
+    }
+
+    // Events within a buffer are almost always in order already.
+    qsort(Run->Events, (SIZE_T)Run->NumEvents, sizeof(struct ETL_EVENT), EtlEventCompareFn);
+
+Done:
+    return 0;
+}
+
+int EtlScan(struct ETL_FILE* Etl, const wchar_t* FileName, const GUID* ProviderId, unsigned long Jobs)
+{
+    int Err;
+    unsigned long long NumBuffers = Etl->Size / Etl->BufferSize;
+    HANDLE Threads[ETL_MAX_SCAN_JOBS];
+    unsigned long NumThreads = 0;
+    struct ETL_RUN* FirstRun = NULL;
+    const EVENT_HEADER* First;
+    unsigned long i;
+
+    Etl->ProviderId = *ProviderId;
+
+    Err = EtlProbe(Etl, FileName);
+    if (Err != NO_ERROR) {
+        return Err;
+    }
+
+    Jobs = (unsigned long)min(min(Jobs, ETL_MAX_SCAN_JOBS), max(NumBuffers, 1));
+    Etl->NumRuns = max(Jobs, 1);
+    for (i = 0; i < Etl->NumRuns; i++) {
+        Etl->Runs[i].Etl = Etl;
+        Etl->Runs[i].FirstBuffer = NumBuffers * i / Etl->NumRuns;
+        Etl->Runs[i].EndBuffer = NumBuffers * (i + 1) / Etl->NumRuns;
+    }
+
+    // The first range is scanned on this thread.
+    for (i = 1; i < Etl->NumRuns; i++) {
+        Threads[NumThreads] = CreateThread(NULL, 0, EtlScanWorker, &Etl->Runs[i], 0, NULL);
+        if (Threads[NumThreads] == NULL) {
+            Etl->Runs[i].Err = GetLastError();
+            break;
+        }
+        NumThreads++;
+    }
+    EtlScanWorker(&Etl->Runs[0]);
+    if (NumThreads > 0) {
+        WaitForMultipleObjects(NumThreads, Threads, TRUE, INFINITE);
+    }
+    for (i = 0; i < NumThreads; i++) {
+        CloseHandle(Threads[i]);
+    }
+
+    for (i = 0; i < Etl->NumRuns; i++) {
+        if (Etl->Runs[i].Err != NO_ERROR) {
+            return Etl->Runs[i].Err;
+        }
+        if (Etl->Runs[i].Problem != NULL) {
+            Etl->Problem = Etl->Runs[i].Problem;
+            return ERROR_NOT_SUPPORTED;
+        }
+        Etl->NumOther += Etl->Runs[i].NumOther;
+        if (Etl->Runs[i].NumEvents > 0 &&
+            (FirstRun == NULL || EtlEventCompareFn(&Etl->Runs[i].Events[0], &FirstRun->Events[0]) < 0)) {
+            FirstRun = &Etl->Runs[i];
+        }
+    }
+
+    // Our first event has to be the one ProcessTrace delivered first, and
+    // its timestamp is where we start converting from.
+    if (FirstRun == NULL || !Etl->ProbeFound) {
+        if (FirstRun != NULL || Etl->ProbeFound) {
+            Etl->Problem = "the events found differ from ProcessTrace's";
+            return ERROR_NOT_SUPPORTED;
+        }
+        return NO_ERROR;
+    }
+    First = (const EVENT_HEADER*)(Etl->View + FirstRun->Events[0].Offset);
+    if (First->ThreadId != Etl->ProbeHeader.ThreadId ||
+        First->ProcessId != Etl->ProbeHeader.ProcessId ||
+        memcmp(&First->EventDescriptor, &Etl->ProbeHeader.EventDescriptor, sizeof(EVENT_DESCRIPTOR)) ||
+        First->Size - sizeof(EVENT_HEADER) != Etl->ProbeDataLength ||
+        memcmp(First + 1, Etl->ProbeData, min(Etl->ProbeDataLength, sizeof(Etl->ProbeData)))) {
+        Etl->Problem = "the events found differ from ProcessTrace's";
+        return ERROR_NOT_SUPPORTED;
+    }
+    Etl->AnchorRaw = FirstRun->Events[0].TimeStamp;
+    Etl->AnchorTime = Etl->ProbeHeader.TimeStamp.QuadPart;
+
+    return NO_ERROR;
+}
+
+struct ETL_CURSOR {
+    struct ETL_FILE* Etl;
+    struct ETL_RUN* Run;
+    PVOID Context;
+    unsigned long long Next; // index in Run->Events
+    unsigned long long End;
+    LONGLONG TimeStamp; // FILETIME of the next event
+};
+
+// Index of the first event of Run at or after Time (a FILETIME). The
+// events are sorted by raw timestamp, which EtlFileTime preserves.
+unsigned long long EtlRunLowerBound(struct ETL_RUN* Run, LONGLONG Time)
+{
+    unsigned long long Low = 0;
+    unsigned long long High = Run->NumEvents;
+    unsigned long long Mid;
+
+    while (Low < High) {
+        Mid = Low + (High - Low) / 2;
+        if (EtlFileTime(Run->Etl, Run->Events[Mid].TimeStamp) < Time) {
+            Low = Mid + 1;
+        } else {
+            High = Mid;
+        }
+    }
+    return Low;
+}
+
+int EtlProcessTrace(
+    struct ETL_FILE* Files,
+    unsigned long NumFiles,
+    PEVENT_RECORD_CALLBACK Callback,
+    ETL_PROGRESS_CALLBACK Progress,
+    PVOID ProgressContext)
+{
+    return EtlProcessRange(Files, NumFiles, NULL, 0, MAXLONGLONG, Callback, Progress, ProgressContext);
+}
+
+int EtlProcessRange(
+    struct ETL_FILE* Files,
+    unsigned long NumFiles,
+    PVOID* Contexts,
+    LONGLONG Start,
+    LONGLONG End,
+    PEVENT_RECORD_CALLBACK Callback,
+    ETL_PROGRESS_CALLBACK Progress,
+    PVOID ProgressContext)
+{
+    int Err = NO_ERROR;
+    struct ETL_CURSOR* Cursors;
+    struct ETL_CURSOR* Cursor;
+    struct ETL_RUN* Run;
+    unsigned long NumCursors = 0;
+    unsigned long long EventsDone = 0;
+    unsigned long long EventsTotal = 0;
+    const BYTE* Record;
+    EVENT_RECORD ev;
+    unsigned long i, j;
+
+    Cursors = malloc(NumFiles * ETL_MAX_SCAN_JOBS * sizeof(struct ETL_CURSOR));
+    if (Cursors == NULL) {
+        return ERROR_NOT_ENOUGH_MEMORY;
+    }
+    for (i = 0; i < NumFiles; i++) {
+        for (j = 0; j < Files[i].NumRuns; j++) {
+            Run = &Files[i].Runs[j];
+            Cursor = &Cursors[NumCursors];
+            Cursor->Etl = &Files[i];
+            Cursor->Run = Run;
+            Cursor->Context = Contexts != NULL ? Contexts[i] : Files[i].Context;
+            Cursor->Next = Start != 0 ? EtlRunLowerBound(Run, Start) : 0;
+            Cursor->End = End != MAXLONGLONG ? EtlRunLowerBound(Run, End) : Run->NumEvents;
+            if (Cursor->Next < Cursor->End) {
+                EventsTotal += Cursor->End - Cursor->Next;
+                Cursor->TimeStamp = EtlFileTime(Cursor->Etl, Run->Events[Cursor->Next].TimeStamp);
+                NumCursors++;
+            }
+        }
+    }
+
+    while (NumCursors > 0) {
+        // Earliest next event; on a tie the earlier file and buffer win.
+        Cursor = &Cursors[0];
+        for (i = 1; i < NumCursors; i++) {
+            if (Cursors[i].TimeStamp < Cursor->TimeStamp) {
+                Cursor = &Cursors[i];
+            }
+        }
+
+        Record = Cursor->Etl->View + Cursor->Run->Events[Cursor->Next].Offset;
+        ZeroMemory(&ev, sizeof(ev));
+        memcpy(&ev.EventHeader, Record, sizeof(EVENT_HEADER));
+        ev.EventHeader.Size = sizeof(EVENT_HEADER);
+        ev.EventHeader.TimeStamp.QuadPart = Cursor->TimeStamp;
+        ev.BufferContext.ProcessorIndex = (USHORT)Cursor->Run->Events[Cursor->Next].ProcessorIndex;
+        ev.UserDataLength = (USHORT)(*(UNALIGNED const USHORT*)Record - sizeof(EVENT_HEADER));
+        ev.UserData = (PVOID)(Record + sizeof(EVENT_HEADER));
+        ev.UserContext = Cursor->Context;
+        Callback(&ev);
+
+        if (++EventsDone % ETL_PROGRESS_EVENTS == 0 && Progress != NULL &&
+            !Progress(ProgressContext, EventsDone, EventsTotal)) {
+            Err = ERROR_CANCELLED;
+            break;
+        }
+
+        if (++Cursor->Next < Cursor->End) {
+            Cursor->TimeStamp = EtlFileTime(Cursor->Etl, Cursor->Run->Events[Cursor->Next].TimeStamp);
+        } else {
+            // Keep the rest in order for the tie break.
+            NumCursors--;
+            memmove(Cursor, Cursor + 1, (Cursors + NumCursors - Cursor) * sizeof(struct ETL_CURSOR));
+        }
+    }
+
+    free(Cursors);
+    return Err;
+}
+
+// Bisects the time range of the indexed events for each split point:
+// counting the events before a time is a binary search in every run.
+void EtlSplitRange(
+    struct ETL_FILE* Files,
+    unsigned long NumFiles,
+    LONGLONG Start,
+    LONGLONG End,
+    unsigned long NumRanges,
+    LONGLONG* Bounds)
+{
+    unsigned long long Total = 0;
+    unsigned long long First = 0;
+    unsigned long long Target;
+    unsigned long long Count;
+    LONGLONG Low, High, Mid;
+    unsigned long i, j, k;
+
+    for (i = 0; i < NumFiles; i++) {
+        for (j = 0; j < Files[i].NumRuns; j++) {
+            First += EtlRunLowerBound(&Files[i].Runs[j], Start);
+            Total += EtlRunLowerBound(&Files[i].Runs[j], End);
+        }
+    }
+    Total -= First;
+
+    Low = Start;
+    for (k = 1; k < NumRanges; k++) {
+        Target = First + Total * k / NumRanges;
+        High = End;
+        while (Low < High) {
+            Mid = Low + (High - Low) / 2;
+            Count = 0;
+            for (i = 0; i < NumFiles; i++) {
+                for (j = 0; j < Files[i].NumRuns; j++) {
+                    Count += EtlRunLowerBound(&Files[i].Runs[j], Mid);
+                }
+            }
+            if (Count < Target) {
+                Low = Mid + 1;
+            } else {
+                High = Mid;
+            }
+        }
+        Bounds[k - 1] = Low;
+    }
+}
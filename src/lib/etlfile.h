@@ -0,0 +1,117 @@
+/*
+
+Copyright (c) Microsoft Corporation.
+Licensed under the MIT License.
+
+Reads the events of one provider straight out of an ETL file (--direct),
+as a faster alternative to OpenTrace/ProcessTrace for files on disk.
+
+The file is memory mapped and its buffers are split between several
+threads, which walk the event records and index the ones from the wanted
+provider. EtlProcessTrace then hands those to an EVENT_RECORD callback in
+timestamp order, merging several files the way ProcessTrace does.
+
+Only the plain file format is handled: anything unexpected (compressed
+buffers, unknown record types, events with extended data...) makes EtlOpen
+or EtlScan fail with ERROR_NOT_SUPPORTED and a description in Problem, so
+the caller can fall back to ProcessTrace. ProcessTrace is also used to read
+the first event of the provider, which both checks that we see the same
+events and anchors our timestamps to the ones it reports.
+
+*/
+
+#pragma once
+
+#define ETL_MAX_SCAN_JOBS 8
+
+struct ETL_EVENT {
+    LONGLONG TimeStamp; // raw, in the file's clock
+    unsigned long long Offset : 48; // of the event record in the file
+    unsigned long long ProcessorIndex : 16;
+};
+
+// The events found by one scan thread, sorted by timestamp.
+struct ETL_RUN {
+    struct ETL_FILE* Etl;
+    unsigned long long FirstBuffer;
+    unsigned long long EndBuffer;
+    struct ETL_EVENT* Events;
+    unsigned long long NumEvents;
+    unsigned long long MaxEvents;
+    unsigned long long NumOther; // records from other providers
+    const char* Problem;
+    int Err;
+};
+
+struct ETL_FILE {
+    HANDLE File;
+    HANDLE Mapping;
+    const BYTE* View;
+    unsigned long long Size;
+    unsigned long BufferSize;
+    unsigned long ClockType; // 1 QPC, 2 system time
+    LONGLONG PerfFreq;
+    PVOID Context; // UserContext of the events
+    GUID ProviderId;
+
+    // The first event of the provider as ProcessTrace reported it.
+    BOOLEAN ProbeFound;
+    EVENT_HEADER ProbeHeader;
+    BYTE ProbeData[64];
+    USHORT ProbeDataLength;
+    LONGLONG AnchorRaw; // raw timestamp of that event in the file
+    LONGLONG AnchorTime; // and its FILETIME
+
+    struct ETL_RUN Runs[ETL_MAX_SCAN_JOBS];
+    unsigned long NumRuns;
+    unsigned long long NumOther;
+    const char* Problem; // why the file can't be read directly
+};
+
+// Maps the file. Header is the LogfileHeader that OpenTrace filled in for
+// it. Context is passed to the callback as UserContext.
+int EtlOpen(struct ETL_FILE* Etl, const wchar_t* FileName, const TRACE_LOGFILE_HEADER* Header, PVOID Context);
+
+// Indexes the events from ProviderId, using up to Jobs threads.
+int EtlScan(struct ETL_FILE* Etl, const wchar_t* FileName, const GUID* ProviderId, unsigned long Jobs);
+
+// Called about every ETL_PROGRESS_EVENTS events. Returning FALSE stops
+// EtlProcessTrace, which then returns ERROR_CANCELLED (like a
+// BufferCallback returning FALSE stops ProcessTrace).
+#define ETL_PROGRESS_EVENTS 65536
+typedef BOOLEAN (*ETL_PROGRESS_CALLBACK)(PVOID Context, unsigned long long EventsDone, unsigned long long EventsTotal);
+
+// Calls Callback on the indexed events of all the files, in timestamp
+// order. Can be called more than once.
+int EtlProcessTrace(
+    struct ETL_FILE* Files,
+    unsigned long NumFiles,
+    PEVENT_RECORD_CALLBACK Callback,
+    ETL_PROGRESS_CALLBACK Progress,
+    PVOID ProgressContext);
+
+// The same for the events in [Start, End) (FILETIMEs), with Contexts[i]
+// (if not NULL) as the UserContext of the events of Files[i] instead of its
+// Context. Only reads the files, so several threads can process ranges of
+// the same files at the same time.
+int EtlProcessRange(
+    struct ETL_FILE* Files,
+    unsigned long NumFiles,
+    PVOID* Contexts,
+    LONGLONG Start,
+    LONGLONG End,
+    PEVENT_RECORD_CALLBACK Callback,
+    ETL_PROGRESS_CALLBACK Progress,
+    PVOID ProgressContext);
+
+// Splits [Start, End) into NumRanges ranges with about the same number of
+// indexed events, returning the NumRanges - 1 times in between in Bounds.
+void EtlSplitRange(
+    struct ETL_FILE* Files,
+    unsigned long NumFiles,
+    LONGLONG Start,
+    LONGLONG End,
+    unsigned long NumRanges,
+    LONGLONG* Bounds);
+
+void EtlClose(struct ETL_FILE* Etl);
@@ -0,0 +1,379 @@
+/*
+
+Copyright (c) Microsoft Corporation.
+Licensed under the MIT License.
+
+Streaming gzip (RFC 1952) compressor, see gzip.h.
+
+*/
+
+#define WIN32_LEAN_AND_MEAN 1
+#include <windows.h>
+#include <string.h>
+#include <gzip.h>
+
+#define GZIP_MIN_MATCH 3
+#define GZIP_MAX_MATCH 258
+#define GZIP_WINDOW_MASK (GZIP_WINDOW_SIZE - 1)
+#define GZIP_END_OF_BLOCK 256
+
+// The constant tables, shared by all streams and built once per process
+// (streams are started on several threads at once with --batch): the fixed
+// Huffman codes (RFC 1951 3.2.6) for literals/lengths and distances,
+// bit-reversed since Huffman codes are sent starting with their most
+// significant bit, and the CRC-32 table.
+struct GZIP_TABLES {
+    USHORT LitCode[288];
+    BYTE LitBits[288];
+    BYTE DistCode[30];
+    unsigned long Crc[256];
+};
+
+static struct GZIP_TABLES GzipTables;
+static INIT_ONCE GzipTablesOnce = INIT_ONCE_STATIC_INIT;
+
+static unsigned long GzipReverse(unsigned long Code, unsigned long Bits)
+{
+    unsigned long Reversed = 0;
+    unsigned long i;
+
+    for (i = 0; i < Bits; i++) {
+        Reversed = (Reversed << 1) | ((Code >> i) & 1);
+    }
+    return Reversed;
+}
+
+static BOOL CALLBACK GzipInitTables(PINIT_ONCE InitOnce, PVOID Parameter, PVOID* Context)
+{
+    struct GZIP_TABLES* Tables = &GzipTables;
+    unsigned long Crc;
+    unsigned long i;
+    unsigned long j;
+
+    UNREFERENCED_PARAMETER(InitOnce);
+    UNREFERENCED_PARAMETER(Parameter);
+    UNREFERENCED_PARAMETER(Context);
+
+    for (i = 0; i < 288; i++) {
+        if (i < 144) {
+            Tables->LitCode[i] = (USHORT)GzipReverse(0x30 + i, 8);
+            Tables->LitBits[i] = 8;
+        } else if (i < 256) {
+            Tables->LitCode[i] = (USHORT)GzipReverse(0x190 + i - 144, 9);
+            Tables->LitBits[i] = 9;
+        } else if (i < 280) {
+            Tables->LitCode[i] = (USHORT)GzipReverse(i - 256, 7);
+            Tables->LitBits[i] = 7;
+        } else {
+            Tables->LitCode[i] = (USHORT)GzipReverse(0xC0 + i - 280, 8);
+            Tables->LitBits[i] = 8;
+        }
+    }
+    for (i = 0; i < 30; i++) {
+        Tables->DistCode[i] = (BYTE)GzipReverse(i, 5);
+    }
+
+    for (i = 0; i < 256; i++) {
+        Crc = i;
+        for (j = 0; j < 8; j++) {
+            Crc = (Crc & 1) ? (Crc >> 1) ^ 0xEDB88320 : Crc >> 1;
+        }
+        Tables->Crc[i] = Crc;
+    }
+    return TRUE;
+}
+
+static unsigned long GzipHighBit(unsigned long Value)
+{
+    unsigned long Bit = 0;
+
+    while (Value >>= 1) {
+        Bit++;
+    }
+    return Bit;
+}
+
+static int GzipFlushOut(struct GZIP_STREAM* Gzip)
+{
+    int Err = NO_ERROR;
+
+    if (Gzip->OutUsed > 0) {
+        Err = Gzip->Output(Gzip->Context, Gzip->Out, Gzip->OutUsed);
+        Gzip->OutUsed = 0;
+    }
+    return Err;
+}
+
+// Callers make sure there's room in Out: at most 31 bits are added per
+// symbol, and whole bytes are moved to Out as soon as they're complete.
+static void GzipPutBits(struct GZIP_STREAM* Gzip, unsigned long Value, unsigned long Bits)
+{
+    Gzip->BitBuf |= (unsigned long long)Value << Gzip->BitCount;
+    Gzip->BitCount += Bits;
+    while (Gzip->BitCount >= 8) {
+        Gzip->Out[Gzip->OutUsed++] = (BYTE)Gzip->BitBuf;
+        Gzip->BitBuf >>= 8;
+        Gzip->BitCount -= 8;
+    }
+}
+
+static void GzipPutLiteral(struct GZIP_STREAM* Gzip, unsigned long Symbol)
+{
+    GzipPutBits(Gzip, GzipTables.LitCode[Symbol], GzipTables.LitBits[Symbol]);
+}
+
+static void GzipPutMatch(struct GZIP_STREAM* Gzip, unsigned long Length, unsigned long Distance)
+{
+    unsigned long Value;
+    unsigned long Bits;
+    unsigned long Code;
+
+    // Length codes 257-284 cover 3-257 with 0-5 extra bits, 285 is 258.
+    Value = Length - GZIP_MIN_MATCH;
+    if (Value < 8) {
+        GzipPutLiteral(Gzip, 257 + Value);
+    } else if (Length == GZIP_MAX_MATCH) {
+        GzipPutLiteral(Gzip, 285);
+    } else {
+        Bits = GzipHighBit(Value) - 2;
+        Code = 257 + 4 * (Bits + 1) + ((Value >> Bits) & 3);
+        GzipPutLiteral(Gzip, Code);
+        GzipPutBits(Gzip, Value & ((1ul << Bits) - 1), Bits);
+    }
+
+    // Distance codes 0-29 cover 1-32768 with 0-13 extra bits.
+    Value = Distance - 1;
+    if (Value < 4) {
+        GzipPutBits(Gzip, GzipTables.DistCode[Value], 5);
+    } else {
+        Bits = GzipHighBit(Value) - 1;
+        Code = 2 * (Bits + 1) + ((Value >> Bits) & 1);
+        GzipPutBits(Gzip, GzipTables.DistCode[Code], 5);
+        GzipPutBits(Gzip, Value & ((1ul << Bits) - 1), Bits);
+    }
+}
+
+static unsigned long GzipHash(const BYTE* Data)
+{
+    return ((Data[0] << 10) ^ (Data[1] << 5) ^ Data[2]) & ((1 << GZIP_HASH_BITS) - 1);
+}
+
+static void GzipInsert(struct GZIP_STREAM* Gzip, unsigned long Pos, unsigned long Hash)
+{
+    Gzip->Prev[Pos & GZIP_WINDOW_MASK] = Gzip->Head[Hash];
+    Gzip->Head[Hash] = (long)Pos;
+}
+
+// Returns the length of the longest match (of at most MaxLength bytes) for
+// the data at Pos among the earlier positions with the same hash, or 0.
+static unsigned long GzipFindMatch(
+    struct GZIP_STREAM* Gzip,
+    unsigned long Hash,
+    unsigned long MaxLength,
+    unsigned long* Distance
+    )
+{
+    const BYTE* Window = Gzip->Window;
+    unsigned long Pos = Gzip->Pos;
+    unsigned long Chain = Gzip->MaxChain;
+    unsigned long Best = GZIP_MIN_MATCH - 1;
+    unsigned long NiceLength = min(Gzip->NiceLength, MaxLength);
+    unsigned long Length;
+    long Cur = Gzip->Head[Hash];
+
+    while (Cur >= 0 && Pos - (unsigned long)Cur <= GZIP_WINDOW_SIZE && Chain-- > 0) {
+        if (Window[Cur + Best] == Window[Pos + Best] && Window[Cur] == Window[Pos]) {
+            Length = 1;
+            while (Length < MaxLength && Window[Cur + Length] == Window[Pos + Length]) {
+                Length++;
+            }
+            if (Length > Best) {
+                Best = Length;
+                *Distance = Pos - (unsigned long)Cur;
+                if (Length >= NiceLength) {
+                    break;
+                }
+            }
+        }
+        Cur = Gzip->Prev[Cur & GZIP_WINDOW_MASK];
+    }
+
+    return Best >= GZIP_MIN_MATCH ? Best : 0;
+}
+
+// Encodes the window up to Limit. A match can extend past Limit, up to the
+// end of the window.
+static int GzipEncode(struct GZIP_STREAM* Gzip, unsigned long Limit)
+{
+    int Err;
+    unsigned long Avail;
+    unsigned long Hash;
+    unsigned long Length;
+    unsigned long Distance = 0;
+    unsigned long i;
+
+    while (Gzip->Pos < Limit) {
+        if (Gzip->OutUsed > GZIP_OUT_SIZE - 8) {
+            Err = GzipFlushOut(Gzip);
+            if (Err != NO_ERROR) {
+                return Err;
+            }
+        }
+
+        Avail = Gzip->WindowEnd - Gzip->Pos;
+        if (Avail < GZIP_MIN_MATCH) {
+            GzipPutLiteral(Gzip, Gzip->Window[Gzip->Pos]);
+            Gzip->Pos++;
+            continue;
+        }
+
+        Hash = GzipHash(Gzip->Window + Gzip->Pos);
+        Length = GzipFindMatch(Gzip, Hash, min(Avail, GZIP_MAX_MATCH), &Distance);
+        GzipInsert(Gzip, Gzip->Pos, Hash);
+
+        if (Length == 0) {
+            GzipPutLiteral(Gzip, Gzip->Window[Gzip->Pos]);
+            Gzip->Pos++;
+            continue;
+        }
+
+        GzipPutMatch(Gzip, Length, Distance);
+        if (Gzip->InsertAll) {
+            for (i = 1; i < Length && Gzip->Pos + i + GZIP_MIN_MATCH <= Gzip->WindowEnd; i++) {
+                GzipInsert(Gzip, Gzip->Pos + i, GzipHash(Gzip->Window + Gzip->Pos + i));
+            }
+        }
+        Gzip->Pos += Length;
+    }
+
+    return NO_ERROR;
+}
+
+// Drops the oldest half of the full window, which is no longer reachable.
+static void GzipSlide(struct GZIP_STREAM* Gzip)
+{
+    unsigned long i;
+
+    memmove(Gzip->Window, Gzip->Window + GZIP_WINDOW_SIZE, Gzip->WindowEnd - GZIP_WINDOW_SIZE);
+    Gzip->WindowEnd -= GZIP_WINDOW_SIZE;
+    Gzip->Pos -= GZIP_WINDOW_SIZE;
+
+    for (i = 0; i < RTL_NUMBER_OF(Gzip->Head); i++) {
+        Gzip->Head[i] = Gzip->Head[i] >= GZIP_WINDOW_SIZE ? Gzip->Head[i] - GZIP_WINDOW_SIZE : -1;
+    }
+    for (i = 0; i < RTL_NUMBER_OF(Gzip->Prev); i++) {
+        Gzip->Prev[i] = Gzip->Prev[i] >= GZIP_WINDOW_SIZE ? Gzip->Prev[i] - GZIP_WINDOW_SIZE : -1;
+    }
+}
+
+int GzipInit(struct GZIP_STREAM* Gzip, int Level, GZIP_OUTPUT Output, void* Context)
+{
+    static const BYTE Header[10] = {
+        0x1f, 0x8b, // magic
+        8,          // CM = deflate
+        0,          // FLG
+        0, 0, 0, 0, // MTIME (none)
+        0,          // XFL
+        11          // OS = NTFS
+    };
+    unsigned long i;
+
+    if (Level < GZIP_MIN_LEVEL || Level > GZIP_MAX_LEVEL) {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    InitOnceExecuteOnce(&GzipTablesOnce, GzipInitTables, NULL, NULL);
+    Gzip->Output = Output;
+    Gzip->Context = Context;
+    Gzip->MaxChain = 4ul << (Level - 1);
+    Gzip->NiceLength = min(32ul * Level, GZIP_MAX_MATCH);
+    Gzip->InsertAll = Level > 3;
+    Gzip->WindowEnd = 0;
+    Gzip->Pos = 0;
+    for (i = 0; i < RTL_NUMBER_OF(Gzip->Head); i++) {
+        Gzip->Head[i] = -1;
+    }
+    Gzip->BitBuf = 0;
+    Gzip->BitCount = 0;
+    Gzip->Crc = 0xFFFFFFFF;
+    Gzip->Size = 0;
+
+    memcpy(Gzip->Out, Header, sizeof(Header));
+    Gzip->OutUsed = sizeof(Header);
+
+    // All the data goes in one fixed Huffman block (they can be any
+    // length), closed by GzipFinish.
+    GzipPutBits(Gzip, 0, 1); // BFINAL
+    GzipPutBits(Gzip, 1, 2); // BTYPE = fixed Huffman codes
+
+    return NO_ERROR;
+}
+
+int GzipWrite(struct GZIP_STREAM* Gzip, const void* Data, unsigned long Length)
+{
+    int Err;
+    const BYTE* In = (const BYTE*)Data;
+    unsigned long Chunk;
+    unsigned long Crc = Gzip->Crc;
+    unsigned long i;
+
+    while (Length > 0) {
+        Chunk = min(Length, sizeof(Gzip->Window) - Gzip->WindowEnd);
+        memcpy(Gzip->Window + Gzip->WindowEnd, In, Chunk);
+        for (i = 0; i < Chunk; i++) {
+            Crc = GzipTables.Crc[(Crc ^ In[i]) & 0xFF] ^ (Crc >> 8);
+        }
+        Gzip->WindowEnd += Chunk;
+        Gzip->Size += Chunk;
+        In += Chunk;
+        Length -= Chunk;
+
+        if (Gzip->WindowEnd == sizeof(Gzip->Window)) {
+            // Leave enough lookahead for the longest match.
+            Err = GzipEncode(Gzip, Gzip->WindowEnd - GZIP_MAX_MATCH);
+            if (Err != NO_ERROR) {
+                return Err;
+            }
+            GzipSlide(Gzip);
+        }
+    }
+
+    Gzip->Crc = Crc;
+    return NO_ERROR;
+}
+
+int GzipFinish(struct GZIP_STREAM* Gzip)
+{
+    int Err;
+    unsigned long Crc = Gzip->Crc ^ 0xFFFFFFFF;
+    unsigned long i;
+
+    Err = GzipEncode(Gzip, Gzip->WindowEnd);
+    if (Err != NO_ERROR) {
+        return Err;
+    }
+    if (Gzip->OutUsed > GZIP_OUT_SIZE - 16) {
+        Err = GzipFlushOut(Gzip);
+        if (Err != NO_ERROR) {
+            return Err;
+        }
+    }
+
+    GzipPutLiteral(Gzip, GZIP_END_OF_BLOCK);
+    // An empty final block.
+    GzipPutBits(Gzip, 1, 1); // BFINAL
+    GzipPutBits(Gzip, 1, 2); // BTYPE = fixed Huffman codes
+    GzipPutLiteral(Gzip, GZIP_END_OF_BLOCK);
+    if (Gzip->BitCount > 0) {
+        GzipPutBits(Gzip, 0, 8 - Gzip->BitCount);
+    }
+
+    for (i = 0; i < 4; i++) {
+        Gzip->Out[Gzip->OutUsed++] = (BYTE)(Crc >> (8 * i));
+    }
+    for (i = 0; i < 4; i++) {
+        Gzip->Out[Gzip->OutUsed++] = (BYTE)(Gzip->Size >> (8 * i));
+    }
+
+    return GzipFlushOut(Gzip);
+}
@@ -0,0 +1,59 @@
+/*
+
+Copyright (c) Microsoft Corporation.
+Licensed under the MIT License.
+
+Streaming gzip (RFC 1952) compressor.
+
+The deflate stream uses LZ77 matching over a 32K window with hash chains,
+and fixed Huffman codes, so no code tables have to be built or sent. That
+compresses noticeably worse than zlib's dynamic codes, most of all on
+payload-heavy captures, but the repeated headers that dominate many packet
+captures are handled by the LZ77 stage.
+
+*/
+
+#pragma once
+
+#define GZIP_WINDOW_SIZE 32768
+#define GZIP_HASH_BITS 15
+#define GZIP_OUT_SIZE 65536
+
+#define GZIP_MIN_LEVEL 1
+#define GZIP_MAX_LEVEL 9
+#define GZIP_DEFAULT_LEVEL 6
+
+// Receives the compressed stream in pieces of up to GZIP_OUT_SIZE bytes.
+typedef int (*GZIP_OUTPUT)(void* Context, const BYTE* Data, unsigned long Length);
+
+struct GZIP_STREAM {
+    GZIP_OUTPUT Output;
+    void* Context;
+    unsigned long MaxChain; // how many earlier positions to try per match
+    unsigned long NiceLength; // stop looking once a match is this long
+    BOOLEAN InsertAll; // hash every position inside matches, not just the first
+
+    // The last GZIP_WINDOW_SIZE bytes already encoded (the history matches
+    // can refer to), followed by the input not encoded yet.
+    BYTE Window[2 * GZIP_WINDOW_SIZE];
+    unsigned long WindowEnd;
+    unsigned long Pos; // next byte to encode
+    long Head[1 << GZIP_HASH_BITS]; // latest position with each hash, or -1
+    long Prev[GZIP_WINDOW_SIZE]; // previous position with the same hash
+
+    unsigned long long BitBuf;
+    unsigned long BitCount;
+    BYTE Out[GZIP_OUT_SIZE];
+    unsigned long OutUsed;
+
+    unsigned long Crc;
+    unsigned long Size; // of the input, mod 2^32
+};
+
+// Level is 1 (fastest) to 9 (smallest). Writes the gzip header.
+int GzipInit(struct GZIP_STREAM* Gzip, int Level, GZIP_OUTPUT Output, void* Context);
+
+int GzipWrite(struct GZIP_STREAM* Gzip, const void* Data, unsigned long Length);
+
+// Encodes the rest of the input and writes the gzip trailer.
+int GzipFinish(struct GZIP_STREAM* Gzip);
@@ -0,0 +1,645 @@
+/*
+
+Copyright (c) Microsoft Corporation.
+Licensed under the MIT License.
+
+Helpers for working with .pcapng files.
+https://github.com/pcapng/pcapng
+
+*/
+
+#pragma once
+#pragma warning(disable:4200) // zero-sized array
+
+#define PCAPNG_BLOCKTYPE_SECTION_HEADER  0x0a0d0d0a
+#define PCAPNG_BLOCKTYPE_INTERFACEDESC   0x00000001
+#define PCAPNG_BLOCKTYPE_INTERFACE_STATS 0x00000005
+#define PCAPNG_BLOCKTYPE_ENHANCED_PACKET 0x00000006
+
+#define PCAPNG_OPTIONCODE_ENDOFOPT  0
+#define PCAPNG_OPTIONCODE_COMMENT   1
+#define PCAPNG_OPTIONCODE_EPB_FLAGS 2
+#define PCAPNG_OPTIONCODE_CUSTOM_STRING 2988 // copyable, value starts with a PEN
+#define PCAPNG_OPTIONCODE_CUSTOM_BINARY 2989 // copyable, value starts with a PEN
+
+// Interface description block options
+#define PCAPNG_OPTIONCODE_IF_NAME        2  // UTF-8
+#define PCAPNG_OPTIONCODE_IF_DESCRIPTION 3  // UTF-8
+#define PCAPNG_OPTIONCODE_IF_TSRESOL  9  // 1 byte: 10^-value seconds per tick
+#define PCAPNG_OPTIONCODE_IF_TSOFFSET 14 // 8 bytes: seconds added to timestamps
+
+// Interface statistics block options
+#define PCAPNG_OPTIONCODE_ISB_STARTTIME 2 // struct PCAPNG_TIMESTAMP
+#define PCAPNG_OPTIONCODE_ISB_ENDTIME   3 // struct PCAPNG_TIMESTAMP
+#define PCAPNG_OPTIONCODE_ISB_USRDELIV  8 // 8 bytes: packets written
+
+#define PCAPNG_LINKTYPE_ETHERNET    1
+#define PCAPNG_LINKTYPE_RAW         101
+#define PCAPNG_LINKTYPE_IEEE802_11  105
+#define PCAPNG_LINKTYPE_IEEE802_11_RADIOTAP 127
+
+#define PCAPNG_SECTION_HEADER_MAGIC 0x1a2b3c4d // for byte order detection
+
+#include <pshpack1.h>
+struct PCAPNG_BLOCK_HEAD {
+    DWORD Type;
+    DWORD Length;
+};
+struct PCAPNG_SECTION_HEADER_BODY {
+    DWORD Magic; // endian detection (set this to PCAPNG_SECTION_HEADER_MAGIC)
+    USHORT MajorVersion;
+    USHORT MinorVersion;
+    INT64 Length;
+};
+struct PCAPNG_INTERFACE_DESC_BODY {
+    USHORT LinkType;
+    USHORT Reserved;
+    DWORD SnapLen;
+};
+struct PCAPNG_TIMESTAMP {
+    DWORD High; // in the units of the interface's if_tsresol
+    DWORD Low;
+};
+struct PCAPNG_INTERFACE_STATS_BODY {
+    DWORD InterfaceId;
+    DWORD TimeStampHigh;
+    DWORD TimeStampLow;
+};
+struct PCAPNG_ENHANCED_PACKET_BODY {
+    DWORD InterfaceId;
+    DWORD TimeStampHigh;
+    DWORD TimeStampLow;
+    DWORD CapturedLength; // excludes padding
+    DWORD PacketLength;   // excludes padding
+    BYTE PacketData[0];   // padded to 4 bytes
+};
+struct PCAPNG_BLOCK_OPTION_ENDOFOPT {
+    USHORT Code;   // PCAPNG_OPTIONCODE_ENDOFOPT
+    USHORT Length; // 0
+};
+struct PCAPNG_BLOCK_OPTION_EPB_FLAGS {
+    USHORT Code;   // PCAPNG_OPTIONCODE_EPB_FLAGS
+    USHORT Length; // 4
+    DWORD Value;
+};
+struct PCAPNG_BLOCK_OPTION_HEAD {
+    USHORT Code;
+    USHORT Length;       // excludes padding
+    BYTE   Value[0];     // padded to 4 bytes
+};
+struct PCAPNG_BLOCK_TAIL {
+    DWORD Length; // Same as PCAPNG_BLOCK_HEAD.Length, for easier backward processing.
+};
+#include <poppack.h>
+
+// All block helpers below go through a PCAPNG_WRITER, which assembles each
+// block in a staging buffer and only hands data to its sink once the buffer
+// fills up (or on PcapNgWriterFlush). Issuing one syscall per field is what
+// makes a straightforward pcapng writer slow on large captures.
+#define PCAPNG_WRITER_DEFAULT_BUFFER_SIZE (4 * 1024 * 1024)
+#define PCAPNG_WRITER_MIN_BUFFER_SIZE     (128 * 1024) // fits any single block we write
+
+// Staging buffers are page aligned (which also satisfies the sector
+// alignment needed for unbuffered I/O) and can be passed between the
+// writer and its sinks, so they are always allocated and freed with these.
+inline char*
+PcapNgAllocBuffer(
+    unsigned long Size
+    )
+{
+    return (char*)VirtualAlloc(NULL, Size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+}
+
+inline void
+PcapNgFreeBuffer(
+    char* Buffer
+    )
+{
+    if (Buffer != NULL) {
+        VirtualFree(Buffer, 0, MEM_RELEASE);
+    }
+}
+
+// A sink consumes the contents of full staging buffers. Write consumes the
+// first *Length bytes of *Buffer; a sink that needs to hold on to the buffer
+// (e.g. to write it asynchronously) may replace *Buffer with another buffer
+// of the same size for the writer to continue with. A sink that can only
+// write in fixed-size units may also leave the bytes it couldn't write yet
+// at the start of the returned buffer, setting *Length to their count (it
+// is set to 0 otherwise). Close finishes any outstanding work, including
+// such leftover bytes, and releases the sink's resources.
+struct PCAPNG_SINK {
+    int (*Write)(struct PCAPNG_SINK* Sink, char** Buffer, unsigned long* Length);
+    int (*Close)(struct PCAPNG_SINK* Sink);
+};
+
+// The basic sink: synchronous WriteFile calls on a handle owned by the caller.
+struct PCAPNG_FILE_SINK {
+    struct PCAPNG_SINK Sink;
+    HANDLE File;
+};
+
+inline int
+PcapNgFileSinkWrite(
+    struct PCAPNG_SINK* Sink,
+    char** Buffer,
+    unsigned long* Length
+    )
+{
+    struct PCAPNG_FILE_SINK* FileSink = (struct PCAPNG_FILE_SINK*)Sink;
+    int Err = NO_ERROR;
+
+    if (!WriteFile(FileSink->File, *Buffer, *Length, NULL, NULL)) {
+        Err = GetLastError();
+        printf("WriteFile failed with %u\n", Err);
+    }
+    *Length = 0;
+
+    return Err;
+}
+
+inline int
+PcapNgFileSinkClose(
+    struct PCAPNG_SINK* Sink
+    )
+{
+    UNREFERENCED_PARAMETER(Sink);
+    return NO_ERROR;
+}
+
+inline void
+PcapNgFileSinkInit(
+    struct PCAPNG_FILE_SINK* FileSink,
+    HANDLE File
+    )
+{
+    FileSink->Sink.Write = PcapNgFileSinkWrite;
+    FileSink->Sink.Close = PcapNgFileSinkClose;
+    FileSink->File = File;
+}
+
+struct PCAPNG_WRITER {
+    struct PCAPNG_SINK* Sink;
+    char* Buffer;
+    unsigned long BufferSize;
+    unsigned long BufferUsed;
+    unsigned long long Offset; // bytes handed to the sink so far
+};
+
+inline int
+PcapNgWriterInit(
+    struct PCAPNG_WRITER* Writer,
+    struct PCAPNG_SINK* Sink,
+    unsigned long BufferSize
+    )
+{
+    if (BufferSize < PCAPNG_WRITER_MIN_BUFFER_SIZE) {
+        BufferSize = PCAPNG_WRITER_MIN_BUFFER_SIZE;
+    }
+
+    Writer->Sink = Sink;
+    Writer->BufferSize = BufferSize;
+    Writer->BufferUsed = 0;
+    Writer->Offset = 0;
+    Writer->Buffer = PcapNgAllocBuffer(BufferSize);
+    if (Writer->Buffer == NULL) {
+        printf("out of memory\n");
+        return ERROR_NOT_ENOUGH_MEMORY;
+    }
+
+    return NO_ERROR;
+}
+
+inline int
+PcapNgWriterFlush(
+    struct PCAPNG_WRITER* Writer
+    )
+{
+    int Err = NO_ERROR;
+    unsigned long Length;
+
+    if (Writer->BufferUsed > 0) {
+        Length = Writer->BufferUsed;
+        Err = Writer->Sink->Write(Writer->Sink, &Writer->Buffer, &Length);
+        if (Err == NO_ERROR) {
+            Writer->Offset += Writer->BufferUsed - Length;
+            Writer->BufferUsed = Length;
+        } else {
+            Writer->BufferUsed = 0;
+        }
+    }
+
+    return Err;
+}
+
+// Frees the staging buffer. Anything still buffered is discarded, so call
+// PcapNgWriterFlush first (and then close the sink, which the caller owns).
+inline void
+PcapNgWriterCleanup(
+    struct PCAPNG_WRITER* Writer
+    )
+{
+    PcapNgFreeBuffer(Writer->Buffer);
+    Writer->Buffer = NULL;
+}
+
+// Makes sure a block of BlockLength bytes can be assembled in the staging
+// buffer without being split across two writes.
+inline int
+PcapNgWriterBeginBlock(
+    struct PCAPNG_WRITER* Writer,
+    unsigned long BlockLength
+    )
+{
+    if (BlockLength > Writer->BufferSize - Writer->BufferUsed) {
+        return PcapNgWriterFlush(Writer);
+    }
+    return NO_ERROR;
+}
+
+inline int
+PcapNgWriterAppend(
+    struct PCAPNG_WRITER* Writer,
+    const void* Data,
+    unsigned long Length
+    )
+{
+    int Err = NO_ERROR;
+    unsigned long Chunk;
+
+    while (Length > Writer->BufferSize - Writer->BufferUsed) {
+        Chunk = Writer->BufferSize - Writer->BufferUsed;
+        memcpy(Writer->Buffer + Writer->BufferUsed, Data, Chunk);
+        Writer->BufferUsed += Chunk;
+        Data = (const char*)Data + Chunk;
+        Length -= Chunk;
+        Err = PcapNgWriterFlush(Writer);
+        if (Err != NO_ERROR) {
+            return Err;
+        }
+    }
+
+    memcpy(Writer->Buffer + Writer->BufferUsed, Data, Length);
+    Writer->BufferUsed += Length;
+
+    return NO_ERROR;
+}
+
+inline int
+PcapNgWriteSectionHeader(
+    struct PCAPNG_WRITER* Writer
+    )
+{
+    int Err = NO_ERROR;
+    struct PCAPNG_BLOCK_HEAD Head;
+    struct PCAPNG_SECTION_HEADER_BODY Body;
+    struct PCAPNG_BLOCK_TAIL Tail;
+    int TotalLength = sizeof(Head) + sizeof(Body) + sizeof(Tail);
+
+    Err = PcapNgWriterBeginBlock(Writer, TotalLength);
+    if (Err != NO_ERROR) {
+        goto Done;
+    }
+
+    Head.Type = PCAPNG_BLOCKTYPE_SECTION_HEADER;
+    Head.Length = TotalLength;
+    Err = PcapNgWriterAppend(Writer, &Head, sizeof(Head));
+    if (Err != NO_ERROR) {
+        goto Done;
+    }
+
+    Body.Magic = PCAPNG_SECTION_HEADER_MAGIC;
+    Body.MajorVersion = 1;
+    Body.MinorVersion = 0;
+    Body.Length = -1;
+    Err = PcapNgWriterAppend(Writer, &Body, sizeof(Body));
+    if (Err != NO_ERROR) {
+        goto Done;
+    }
+
+    Tail.Length = TotalLength;
+    Err = PcapNgWriterAppend(Writer, &Tail, sizeof(Tail));
+    if (Err != NO_ERROR) {
+        goto Done;
+    }
+
+Done:
+
+    return Err;
+}
+
+// An option to be written into a block. Value is Length bytes long and is
+// padded to 4 bytes when it's written. The value of a custom option
+// (PCAPNG_OPTIONCODE_CUSTOM_*) must start with the Private Enterprise Number.
+struct PCAPNG_OPTION {
+    USHORT Code;
+    USHORT Length;
+    const void* Value;
+};
+
+inline unsigned long
+PcapNgOptionsLength(
+    const struct PCAPNG_OPTION* Options,
+    unsigned long NumOptions
+    )
+{
+    unsigned long Length = 0;
+    unsigned long i;
+
+    for (i = 0; i < NumOptions; i++) {
+        Length += sizeof(struct PCAPNG_BLOCK_OPTION_HEAD) + ((Options[i].Length + 3) & ~3);
+    }
+    return Length;
+}
+
+inline int
+PcapNgWriteOption(
+    __in struct PCAPNG_WRITER* Writer,
+    __in const struct PCAPNG_OPTION* Option
+)
+{
+    int Err = NO_ERROR;
+    int PadLength = (4 - (Option->Length & 3)) & 3;
+    struct PCAPNG_BLOCK_OPTION_HEAD Head;
+    char Pad[4] = { 0 };
+
+    Head.Code = Option->Code;
+    Head.Length = Option->Length;
+
+    Err = PcapNgWriterAppend(Writer, &Head, sizeof(Head));
+    if (Err != NO_ERROR) {
+        goto Done;
+    }
+    Err = PcapNgWriterAppend(Writer, Option->Value, Option->Length);
+    if (Err != NO_ERROR) {
+        goto Done;
+    }
+    if (PadLength > 0) {
+        Err = PcapNgWriterAppend(Writer, Pad, PadLength);
+        if (Err != NO_ERROR) {
+            goto Done;
+        }
+    }
+
+Done:
+
+    return Err;
+}
+
+inline int
+PcapNgWriteInterfaceDesc(
+    struct PCAPNG_WRITER* Writer,
+    short LinkType,
+    long SnapLen,
+    const struct PCAPNG_OPTION* Options,
+    unsigned long NumOptions
+    )
+{
+    int Err = NO_ERROR;
+    struct PCAPNG_BLOCK_HEAD Head;
+    struct PCAPNG_INTERFACE_DESC_BODY Body;
+    struct PCAPNG_BLOCK_OPTION_ENDOFOPT EndOption;
+    struct PCAPNG_BLOCK_TAIL Tail;
+    unsigned long i;
+    int TotalLength = sizeof(Head) + sizeof(Body) + sizeof(Tail);
+
+    if (NumOptions > 0) {
+        TotalLength += PcapNgOptionsLength(Options, NumOptions) + sizeof(EndOption);
+    }
+
+    Err = PcapNgWriterBeginBlock(Writer, TotalLength);
+    if (Err != NO_ERROR) {
+        goto Done;
+    }
+
+    Head.Type = PCAPNG_BLOCKTYPE_INTERFACEDESC;
+    Head.Length = TotalLength;
+    Err = PcapNgWriterAppend(Writer, &Head, sizeof(Head));
+    if (Err != NO_ERROR) {
+        goto Done;
+    }
+
+    Body.LinkType = LinkType;
+    Body.Reserved = 0;
+    Body.SnapLen = SnapLen;
+    Err = PcapNgWriterAppend(Writer, &Body, sizeof(Body));
+    if (Err != NO_ERROR) {
+        goto Done;
+    }
+
+    if (NumOptions > 0) {
+        for (i = 0; i < NumOptions; i++) {
+            Err = PcapNgWriteOption(Writer, &Options[i]);
+            if (Err != NO_ERROR) {
+                goto Done;
+            }
+        }
+
+        EndOption.Code = PCAPNG_OPTIONCODE_ENDOFOPT;
+        EndOption.Length = 0;
+        Err = PcapNgWriterAppend(Writer, &EndOption, sizeof(EndOption));
+        if (Err != NO_ERROR) {
+            goto Done;
+        }
+    }
+
+    Tail.Length = TotalLength;
+    Err = PcapNgWriterAppend(Writer, &Tail, sizeof(Tail));
+    if (Err != NO_ERROR) {
+        goto Done;
+    }
+
+Done:
+
+    return Err;
+}
+
+// The packet data of an EPB can be passed in several pieces (for example a
+// patched copy of a header followed by the rest of the frame), which are
+// concatenated in the block so the caller never has to build a contiguous
+// copy of the packet.
+struct PCAPNG_PACKET_FRAGMENT {
+    const void* Data;
+    unsigned long Length;
+};
+
+// Only the first SnapLen bytes of the fragments are written (all of them if
+// SnapLen is 0); PacketLength still records the full length.
+inline int
+PcapNgWriteEnhancedPacket(
+    struct PCAPNG_WRITER* Writer,
+    const struct PCAPNG_PACKET_FRAGMENT* Frags,
+    unsigned long NumFrags,
+    long InterfaceId,
+    long IsSend,
+    long TimeStampHigh, // usec (unless if_tsresol is used)
+    long TimeStampLow,
+    unsigned long SnapLen,
+    const struct PCAPNG_OPTION* Options,
+    unsigned long NumOptions
+)
+{
+    int Err = NO_ERROR;
+    struct PCAPNG_BLOCK_HEAD Head;
+    struct PCAPNG_ENHANCED_PACKET_BODY Body;
+    struct PCAPNG_BLOCK_OPTION_ENDOFOPT EndOption;
+    struct PCAPNG_BLOCK_OPTION_EPB_FLAGS EpbFlagsOption;
+    struct PCAPNG_BLOCK_TAIL Tail;
+    char Pad[4] = {0};
+    unsigned long FragLength = 0;
+    unsigned long CapturedLength;
+    unsigned long Length;
+    unsigned long i;
+    int FragPadLength;
+    int TotalLength;
+
+    for (i = 0; i < NumFrags; i++) {
+        FragLength += Frags[i].Length;
+    }
+    CapturedLength = FragLength;
+    if (SnapLen != 0 && CapturedLength > SnapLen) {
+        CapturedLength = SnapLen;
+    }
+    FragPadLength = (4 - ((sizeof(Body) + CapturedLength) & 3)) & 3; // pad to 4 bytes per the spec.
+    TotalLength =
+        sizeof(Head) + sizeof(Body) + CapturedLength + FragPadLength +
+        sizeof(EpbFlagsOption) + sizeof(EndOption) + sizeof(Tail) +
+        PcapNgOptionsLength(Options, NumOptions);
+
+    Err = PcapNgWriterBeginBlock(Writer, TotalLength);
+    if (Err != NO_ERROR) {
+        goto Done;
+    }
+
+    Head.Type = PCAPNG_BLOCKTYPE_ENHANCED_PACKET;
+    Head.Length = TotalLength;
+    Err = PcapNgWriterAppend(Writer, &Head, sizeof(Head));
+    if (Err != NO_ERROR) {
+        goto Done;
+    }
+
+    Body.InterfaceId = InterfaceId;
+    Body.TimeStampHigh = TimeStampHigh;
+    Body.TimeStampLow = TimeStampLow;
+    Body.PacketLength = FragLength; // actual length
+    Body.CapturedLength = CapturedLength; // truncated length
+    Err = PcapNgWriterAppend(Writer, &Body, sizeof(Body));
+    if (Err != NO_ERROR) {
+        goto Done;
+    }
+    Length = CapturedLength;
+    for (i = 0; i < NumFrags && Length > 0; i++) {
+        Err = PcapNgWriterAppend(Writer, Frags[i].Data, min(Frags[i].Length, Length));
+        if (Err != NO_ERROR) {
+            goto Done;
+        }
+        Length -= min(Frags[i].Length, Length);
+    }
+    if (FragPadLength > 0) {
+        Err = PcapNgWriterAppend(Writer, Pad, FragPadLength);
+        if (Err != NO_ERROR) {
+            goto Done;
+        }
+    }
+
+    EpbFlagsOption.Code = PCAPNG_OPTIONCODE_EPB_FLAGS;
+    EpbFlagsOption.Length = 4;
+    EpbFlagsOption.Value = IsSend ? 2 : 1;
+    Err = PcapNgWriterAppend(Writer, &EpbFlagsOption, sizeof(EpbFlagsOption));
+    if (Err != NO_ERROR) {
+        goto Done;
+    }
+
+    for (i = 0; i < NumOptions; i++) {
+        Err = PcapNgWriteOption(Writer, &Options[i]);
+        if (Err != NO_ERROR) {
+            goto Done;
+        }
+    }
+
+    EndOption.Code = PCAPNG_OPTIONCODE_ENDOFOPT;
+    EndOption.Length = 0;
+    Err = PcapNgWriterAppend(Writer, &EndOption, sizeof(EndOption));
+    if (Err != NO_ERROR) {
+        goto Done;
+    }
+
+    Tail.Length = TotalLength;
+    Err = PcapNgWriterAppend(Writer, &Tail, sizeof(Tail));
+    if (Err != NO_ERROR) {
+        goto Done;
+    }
+
+Done:
+
+    return Err;
+}
+
+inline int
+PcapNgWriteInterfaceStats(
+    struct PCAPNG_WRITER* Writer,
+    long InterfaceId,
+    long TimeStampHigh,
+    long TimeStampLow,
+    const struct PCAPNG_OPTION* Options,
+    unsigned long NumOptions
+    )
+{
+    int Err = NO_ERROR;
+    struct PCAPNG_BLOCK_HEAD Head;
+    struct PCAPNG_INTERFACE_STATS_BODY Body;
+    struct PCAPNG_BLOCK_OPTION_ENDOFOPT EndOption;
+    struct PCAPNG_BLOCK_TAIL Tail;
+    unsigned long i;
+    int TotalLength = sizeof(Head) + sizeof(Body) + sizeof(Tail);
+
+    if (NumOptions > 0) {
+        TotalLength += PcapNgOptionsLength(Options, NumOptions) + sizeof(EndOption);
+    }
+
+    Err = PcapNgWriterBeginBlock(Writer, TotalLength);
+    if (Err != NO_ERROR) {
+        goto Done;
+    }
+
+    Head.Type = PCAPNG_BLOCKTYPE_INTERFACE_STATS;
+    Head.Length = TotalLength;
+    Err = PcapNgWriterAppend(Writer, &Head, sizeof(Head));
+    if (Err != NO_ERROR) {
+        goto Done;
+    }
+
+    Body.InterfaceId = InterfaceId;
+    Body.TimeStampHigh = TimeStampHigh;
+    Body.TimeStampLow = TimeStampLow;
+    Err = PcapNgWriterAppend(Writer, &Body, sizeof(Body));
+    if (Err != NO_ERROR) {
+        goto Done;
+    }
+
+    if (NumOptions > 0) {
+        for (i = 0; i < NumOptions; i++) {
+            Err = PcapNgWriteOption(Writer, &Options[i]);
+            if (Err != NO_ERROR) {
+                goto Done;
+            }
+        }
+
+        EndOption.Code = PCAPNG_OPTIONCODE_ENDOFOPT;
+        EndOption.Length = 0;
+        Err = PcapNgWriterAppend(Writer, &EndOption, sizeof(EndOption));
+        if (Err != NO_ERROR) {
+            goto Done;
+        }
+    }
+
+    Tail.Length = TotalLength;
+    Err = PcapNgWriterAppend(Writer, &Tail, sizeof(Tail));
+    if (Err != NO_ERROR) {
+        goto Done;
+    }
+
+Done:
+
+    return Err;
+}
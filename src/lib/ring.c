@@ -0,0 +1,189 @@
+/*
+
+Copyright (c) Microsoft Corporation.
+Licensed under the MIT License.
+
+Bounded single-producer/single-consumer ring of variable-length records.
+
+*/
+
+#define WIN32_LEAN_AND_MEAN 1
+#include <windows.h>
+#include <stdlib.h>
+#include <ring.h>
+
+// Every record starts with a header and is padded to 8 bytes. A record never
+// straddles the end of the buffer: if it doesn't fit, the producer writes a
+// RING_WRAP header and starts again at the beginning.
+struct RING_RECORD_HEADER {
+    unsigned long Length;
+    unsigned long Reserved;
+};
+
+#define RING_WRAP ULONG_MAX
+#define RING_SPIN_COUNT 256
+
+#define RingRecordSize(Length) \
+    ((sizeof(struct RING_RECORD_HEADER) + (Length) + 7) & ~7ul)
+
+int RingInit(struct RECORD_RING* Ring, unsigned long Size)
+{
+    ZeroMemory(Ring, sizeof(*Ring));
+
+    if (Size == 0 || (Size & (Size - 1)) != 0) {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    Ring->Buffer = (BYTE*)VirtualAlloc(NULL, Size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    if (Ring->Buffer == NULL) {
+        return ERROR_NOT_ENOUGH_MEMORY;
+    }
+    Ring->Size = Size;
+
+    return NO_ERROR;
+}
+
+void RingCleanup(struct RECORD_RING* Ring)
+{
+    if (Ring->Buffer != NULL) {
+        VirtualFree(Ring->Buffer, 0, MEM_RELEASE);
+        Ring->Buffer = NULL;
+    }
+}
+
+// Waits until *Address no longer equals Value (or the ring is closed).
+static void RingWait(
+    struct RECORD_RING* Ring,
+    volatile LONG* Address,
+    LONG Value,
+    volatile LONG* WaitingFlag
+    )
+{
+    int i;
+
+    for (i = 0; i < RING_SPIN_COUNT; i++) {
+        if (ReadAcquire(Address) != Value || ReadAcquire(&Ring->Closed)) {
+            return;
+        }
+        YieldProcessor();
+    }
+
+    // InterlockedExchange is a full barrier, so either the other side sees
+    // the flag after it updates *Address, or we see the update here.
+    InterlockedExchange(WaitingFlag, 1);
+    if (ReadAcquire(Address) == Value && !ReadAcquire(&Ring->Closed)) {
+        WaitOnAddress(Address, &Value, sizeof(Value), INFINITE);
+    }
+    InterlockedExchange(WaitingFlag, 0);
+}
+
+static void RingWake(volatile LONG* Address, volatile LONG* WaitingFlag)
+{
+    if (ReadAcquire(WaitingFlag)) {
+        WakeByAddressSingle((PVOID)Address);
+    }
+}
+
+void* RingReserve(struct RECORD_RING* Ring, unsigned long Length)
+{
+    unsigned long Needed = RingRecordSize(Length);
+    unsigned long Head = (unsigned long)Ring->Head; // only we write Head
+    unsigned long Offset;
+    unsigned long ToEnd;
+    unsigned long Tail;
+
+    if (Needed > Ring->Size / 2) {
+        return NULL;
+    }
+
+    for (;;) {
+        Offset = Head & (Ring->Size - 1);
+        ToEnd = Ring->Size - Offset;
+        Tail = (unsigned long)ReadAcquire(&Ring->Tail);
+
+        if (ReadAcquire(&Ring->Closed)) {
+            return NULL;
+        }
+
+        if (Needed <= ToEnd) {
+            if (Ring->Size - (Head - Tail) >= Needed) {
+                break;
+            }
+        } else if (Ring->Size - (Head - Tail) >= ToEnd + Needed) {
+            // Skip the rest of the buffer and start over at the beginning.
+            ((struct RING_RECORD_HEADER*)(Ring->Buffer + Offset))->Length = RING_WRAP;
+            Head += ToEnd;
+            InterlockedExchange(&Ring->Head, (LONG)Head);
+            RingWake(&Ring->Head, &Ring->ConsumerWaiting);
+            continue;
+        }
+
+        RingWait(Ring, &Ring->Tail, (LONG)Tail, &Ring->ProducerWaiting);
+    }
+
+    ((struct RING_RECORD_HEADER*)(Ring->Buffer + Offset))->Length = Length;
+    Ring->Reserved = Needed;
+    return Ring->Buffer + Offset + sizeof(struct RING_RECORD_HEADER);
+}
+
+void RingCommit(struct RECORD_RING* Ring)
+{
+    InterlockedExchange(&Ring->Head, (LONG)((unsigned long)Ring->Head + Ring->Reserved));
+    RingWake(&Ring->Head, &Ring->ConsumerWaiting);
+}
+
+void RingTrim(struct RECORD_RING* Ring, unsigned long Length)
+{
+    // RingReserve left Head at the start of the record (past any wrap).
+    unsigned long Offset = (unsigned long)Ring->Head & (Ring->Size - 1);
+
+    ((struct RING_RECORD_HEADER*)(Ring->Buffer + Offset))->Length = Length;
+    Ring->Reserved = RingRecordSize(Length);
+}
+
+void* RingPeek(struct RECORD_RING* Ring, unsigned long* Length)
+{
+    unsigned long Tail = (unsigned long)Ring->Tail; // only we write Tail
+    unsigned long Head;
+    struct RING_RECORD_HEADER* Header;
+
+    for (;;) {
+        Head = (unsigned long)ReadAcquire(&Ring->Head);
+        if (Head == Tail) {
+            if (ReadAcquire(&Ring->Closed)) {
+                // Check once more in case the last record was committed
+                // just before the ring was closed.
+                if ((unsigned long)ReadAcquire(&Ring->Head) == Tail) {
+                    return NULL;
+                }
+                continue;
+            }
+            RingWait(Ring, &Ring->Head, (LONG)Head, &Ring->ConsumerWaiting);
+            continue;
+        }
+
+        Header = (struct RING_RECORD_HEADER*)(Ring->Buffer + (Tail & (Ring->Size - 1)));
+        if (Header->Length == RING_WRAP) {
+            Tail += Ring->Size - (Tail & (Ring->Size - 1));
+            InterlockedExchange(&Ring->Tail, (LONG)Tail);
+            RingWake(&Ring->Tail, &Ring->ProducerWaiting);
+            continue;
+        }
+
+        *Length = Header->Length;
+        return Header + 1;
+    }
+}
+
+void RingRelease(struct RECORD_RING* Ring, unsigned long Length)
+{
+    InterlockedExchange(&Ring->Tail, (LONG)((unsigned long)Ring->Tail + RingRecordSize(Length)));
+    RingWake(&Ring->Tail, &Ring->ProducerWaiting);
+}
+
+void RingClose(struct RECORD_RING* Ring)
+{
+    InterlockedExchange(&Ring->Closed, 1);
+    WakeByAddressAll((PVOID)&Ring->Head);
+    WakeByAddressAll((PVOID)&Ring->Tail);
+}
@@ -0,0 +1,47 @@
+/*
+
+Copyright (c) Microsoft Corporation.
+Licensed under the MIT License.
+
+Bounded single-producer/single-consumer ring of variable-length records.
+
+The producer and consumer only synchronize through the Head and Tail
+counters; a thread only blocks (with WaitOnAddress) when the ring is full or
+empty.
+
+*/
+
+#pragma once
+
+struct RECORD_RING {
+    BYTE* Buffer;
+    unsigned long Size; // power of 2
+    volatile LONG Head; // bytes produced, wraps at 2^32
+    volatile LONG Tail; // bytes consumed, wraps at 2^32
+    volatile LONG Closed;
+    volatile LONG ProducerWaiting;
+    volatile LONG ConsumerWaiting;
+    unsigned long Reserved; // size of the record being produced
+};
+
+int RingInit(struct RECORD_RING* Ring, unsigned long Size);
+void RingCleanup(struct RECORD_RING* Ring);
+
+// Producer side. RingReserve blocks until Length bytes are free and returns
+// a pointer to fill in, or NULL if the ring has been closed. RingCommit
+// publishes the reserved record to the consumer.
+void* RingReserve(struct RECORD_RING* Ring, unsigned long Length);
+void RingCommit(struct RECORD_RING* Ring);
+
+// Shrinks the reserved record to Length bytes before it's committed, so a
+// producer can reserve room for the largest record it might build.
+void RingTrim(struct RECORD_RING* Ring, unsigned long Length);
+
+// Consumer side. RingPeek blocks until a record is available and returns
+// it, or returns NULL once the ring is closed and drained. RingRelease frees
+// the record returned by the last RingPeek.
+void* RingPeek(struct RECORD_RING* Ring, unsigned long* Length);
+void RingRelease(struct RECORD_RING* Ring, unsigned long Length);
+
+// Called by the producer when it's done, or by either side to abort.
+void RingClose(struct RECORD_RING* Ring);
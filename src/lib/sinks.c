@@ -0,0 +1,672 @@
+/*
+
+Copyright (c) Microsoft Corporation.
+Licensed under the MIT License.
+
+PCAPNG_SINK implementations beyond the basic file sink in pcapng.h.
+
+*/
+
+#define WIN32_LEAN_AND_MEAN 1
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <pcapng.h>
+#include <sinks.h>
+#include <gzip.h>
+
+DWORD WINAPI ThreadSinkWorker(LPVOID Context)
+{
+    struct THREAD_SINK* ThreadSink = (struct THREAD_SINK*)Context;
+    char* Buffer;
+    unsigned long Length;
+    int Err;
+
+    AcquireSRWLockExclusive(&ThreadSink->Lock);
+    for (;;) {
+        while (ThreadSink->QueueLength == 0 && !ThreadSink->Closing) {
+            SleepConditionVariableSRW(&ThreadSink->QueueChanged, &ThreadSink->Lock, INFINITE, 0);
+        }
+        if (ThreadSink->QueueLength == 0) {
+            break; // closing and drained
+        }
+        Buffer = ThreadSink->Queue[ThreadSink->QueueHead].Buffer;
+        Length = ThreadSink->Queue[ThreadSink->QueueHead].Length;
+        ReleaseSRWLockExclusive(&ThreadSink->Lock);
+
+        Err = NO_ERROR;
+        if (ThreadSink->Err == NO_ERROR) {
+            // The next sink must not leave bytes behind (see sinks.h).
+            Err = ThreadSink->Next->Write(ThreadSink->Next, &Buffer, &Length);
+        }
+
+        AcquireSRWLockExclusive(&ThreadSink->Lock);
+        if (Err != NO_ERROR && ThreadSink->Err == NO_ERROR) {
+            ThreadSink->Err = Err;
+        }
+        ThreadSink->QueueHead = (ThreadSink->QueueHead + 1) % THREAD_SINK_MAX_BUFFERS;
+        ThreadSink->QueueLength--;
+        ThreadSink->Free[ThreadSink->NumFree++] = Buffer;
+        WakeAllConditionVariable(&ThreadSink->QueueChanged);
+    }
+    ReleaseSRWLockExclusive(&ThreadSink->Lock);
+
+    return 0;
+}
+
+int ThreadSinkWrite(struct PCAPNG_SINK* Sink, char** Buffer, unsigned long* Length)
+{
+    struct THREAD_SINK* ThreadSink = (struct THREAD_SINK*)Sink;
+    int Err;
+
+    AcquireSRWLockExclusive(&ThreadSink->Lock);
+    while (ThreadSink->NumFree == 0) {
+        SleepConditionVariableSRW(&ThreadSink->QueueChanged, &ThreadSink->Lock, INFINITE, 0);
+    }
+    Err = ThreadSink->Err;
+    if (Err == NO_ERROR) {
+        unsigned long Tail =
+            (ThreadSink->QueueHead + ThreadSink->QueueLength) % THREAD_SINK_MAX_BUFFERS;
+        ThreadSink->Queue[Tail].Buffer = *Buffer;
+        ThreadSink->Queue[Tail].Length = *Length;
+        ThreadSink->QueueLength++;
+        *Buffer = ThreadSink->Free[--ThreadSink->NumFree];
+        *Length = 0;
+        WakeAllConditionVariable(&ThreadSink->QueueChanged);
+    }
+    ReleaseSRWLockExclusive(&ThreadSink->Lock);
+
+    return Err;
+}
+
+int ThreadSinkClose(struct PCAPNG_SINK* Sink)
+{
+    struct THREAD_SINK* ThreadSink = (struct THREAD_SINK*)Sink;
+    int Err;
+    unsigned long i;
+
+    if (ThreadSink->Thread != NULL) {
+        AcquireSRWLockExclusive(&ThreadSink->Lock);
+        ThreadSink->Closing = TRUE;
+        WakeAllConditionVariable(&ThreadSink->QueueChanged);
+        ReleaseSRWLockExclusive(&ThreadSink->Lock);
+
+        WaitForSingleObject(ThreadSink->Thread, INFINITE);
+        CloseHandle(ThreadSink->Thread);
+        ThreadSink->Thread = NULL;
+    }
+
+    for (i = 0; i < ThreadSink->NumFree; i++) {
+        PcapNgFreeBuffer(ThreadSink->Free[i]);
+    }
+    ThreadSink->NumFree = 0;
+
+    Err = ThreadSink->Next->Close(ThreadSink->Next);
+    if (ThreadSink->Err != NO_ERROR) {
+        Err = ThreadSink->Err;
+    }
+    return Err;
+}
+
+int ThreadSinkInit(
+    struct THREAD_SINK* ThreadSink,
+    struct PCAPNG_SINK* Next,
+    unsigned long BufferSize,
+    unsigned long NumBuffers)
+{
+    int Err;
+
+    ZeroMemory(ThreadSink, sizeof(*ThreadSink));
+    ThreadSink->Sink.Write = ThreadSinkWrite;
+    ThreadSink->Sink.Close = ThreadSinkClose;
+    ThreadSink->Next = Next;
+    ThreadSink->BufferSize = BufferSize;
+    InitializeSRWLock(&ThreadSink->Lock);
+    InitializeConditionVariable(&ThreadSink->QueueChanged);
+
+    if (NumBuffers == 0 || NumBuffers > THREAD_SINK_MAX_BUFFERS) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    ThreadSink->NumBuffers = NumBuffers;
+
+    for (ThreadSink->NumFree = 0; ThreadSink->NumFree < NumBuffers; ThreadSink->NumFree++) {
+        ThreadSink->Free[ThreadSink->NumFree] = PcapNgAllocBuffer(BufferSize);
+        if (ThreadSink->Free[ThreadSink->NumFree] == NULL) {
+            printf("out of memory\n");
+            Err = ERROR_NOT_ENOUGH_MEMORY;
+            goto Fail;
+        }
+    }
+
+    ThreadSink->Thread = CreateThread(NULL, 0, ThreadSinkWorker, ThreadSink, 0, NULL);
+    if (ThreadSink->Thread == NULL) {
+        Err = GetLastError();
+        printf("CreateThread failed with %u\n", Err);
+        goto Fail;
+    }
+
+    return NO_ERROR;
+
+Fail:
+    while (ThreadSink->NumFree > 0) {
+        PcapNgFreeBuffer(ThreadSink->Free[--ThreadSink->NumFree]);
+    }
+    return Err;
+}
+
+// Waits for the write in slot i, if there is one.
+int OverlappedSinkComplete(struct OVERLAPPED_SINK* OverlappedSink, unsigned long i)
+{
+    DWORD Written;
+    int Err = NO_ERROR;
+
+    if (!OverlappedSink->Writes[i].Pending) {
+        return NO_ERROR;
+    }
+    OverlappedSink->Writes[i].Pending = FALSE;
+
+    if (!GetOverlappedResult(OverlappedSink->File, &OverlappedSink->Writes[i].Overlapped, &Written, TRUE)) {
+        Err = GetLastError();
+        printf("WriteFile failed with %u\n", Err);
+    } else if (Written != OverlappedSink->Writes[i].Length) {
+        Err = ERROR_WRITE_FAULT;
+        printf("WriteFile wrote %u of %u bytes\n", Written, OverlappedSink->Writes[i].Length);
+    }
+
+    return Err;
+}
+
+int OverlappedSinkStart(
+    struct OVERLAPPED_SINK* OverlappedSink,
+    unsigned long i,
+    char* Buffer,
+    unsigned long Length
+    )
+{
+    OVERLAPPED* Overlapped = &OverlappedSink->Writes[i].Overlapped;
+    int Err;
+
+    Overlapped->Offset = (DWORD)OverlappedSink->Offset;
+    Overlapped->OffsetHigh = (DWORD)(OverlappedSink->Offset >> 32);
+    if (!WriteFile(OverlappedSink->File, Buffer, Length, NULL, Overlapped)) {
+        Err = GetLastError();
+        if (Err != ERROR_IO_PENDING) {
+            printf("WriteFile failed with %u\n", Err);
+            return Err;
+        }
+    }
+    OverlappedSink->Writes[i].Length = Length;
+    OverlappedSink->Writes[i].Pending = TRUE;
+
+    return NO_ERROR;
+}
+
+int OverlappedSinkWrite(struct PCAPNG_SINK* Sink, char** Buffer, unsigned long* Length)
+{
+    struct OVERLAPPED_SINK* OverlappedSink = (struct OVERLAPPED_SINK*)Sink;
+    unsigned long i = OverlappedSink->NextWrite;
+    unsigned long Aligned = *Length;
+    unsigned long TailLength = 0;
+    char* Free;
+    int Err;
+
+    if (OverlappedSink->Unbuffered) {
+        Aligned = *Length & ~(OverlappedSink->SectorSize - 1);
+        TailLength = *Length - Aligned;
+    }
+
+    if (Aligned > 0) {
+        // Reuse the oldest slot: its buffer goes back to the writer and
+        // the writer's buffer is written from the slot.
+        Err = OverlappedSinkComplete(OverlappedSink, i);
+        if (Err != NO_ERROR) {
+            return Err;
+        }
+        Free = OverlappedSink->Writes[i].Buffer;
+        OverlappedSink->Writes[i].Buffer = *Buffer;
+        *Buffer = Free;
+
+        Err = OverlappedSinkStart(OverlappedSink, i, OverlappedSink->Writes[i].Buffer, Aligned);
+        if (Err != NO_ERROR) {
+            return Err;
+        }
+        OverlappedSink->Offset += Aligned;
+        OverlappedSink->NextWrite = (i + 1) % OverlappedSink->NumWrites;
+
+        memcpy(*Buffer, OverlappedSink->Writes[i].Buffer + Aligned, TailLength);
+    }
+
+    memcpy(OverlappedSink->Tail, *Buffer, TailLength);
+    OverlappedSink->TailLength = TailLength;
+    *Length = TailLength;
+
+    return NO_ERROR;
+}
+
+void OverlappedSinkFree(struct OVERLAPPED_SINK* OverlappedSink)
+{
+    unsigned long i;
+
+    for (i = 0; i < OverlappedSink->NumWrites; i++) {
+        PcapNgFreeBuffer(OverlappedSink->Writes[i].Buffer);
+        OverlappedSink->Writes[i].Buffer = NULL;
+        if (OverlappedSink->Writes[i].Overlapped.hEvent != NULL) {
+            CloseHandle(OverlappedSink->Writes[i].Overlapped.hEvent);
+            OverlappedSink->Writes[i].Overlapped.hEvent = NULL;
+        }
+    }
+    PcapNgFreeBuffer(OverlappedSink->Tail);
+    OverlappedSink->Tail = NULL;
+}
+
+int OverlappedSinkClose(struct PCAPNG_SINK* Sink)
+{
+    struct OVERLAPPED_SINK* OverlappedSink = (struct OVERLAPPED_SINK*)Sink;
+    FILE_END_OF_FILE_INFO EndOfFile;
+    int Err = NO_ERROR;
+    int WriteErr;
+    unsigned long i;
+
+    for (i = 0; i < OverlappedSink->NumWrites; i++) {
+        WriteErr = OverlappedSinkComplete(OverlappedSink, i);
+        if (Err == NO_ERROR) {
+            Err = WriteErr;
+        }
+    }
+
+    if (Err == NO_ERROR && OverlappedSink->TailLength > 0) {
+        ZeroMemory(
+            OverlappedSink->Tail + OverlappedSink->TailLength,
+            OverlappedSink->SectorSize - OverlappedSink->TailLength);
+        Err = OverlappedSinkStart(OverlappedSink, 0, OverlappedSink->Tail, OverlappedSink->SectorSize);
+        if (Err == NO_ERROR) {
+            Err = OverlappedSinkComplete(OverlappedSink, 0);
+        }
+        OverlappedSink->Offset += OverlappedSink->TailLength;
+        OverlappedSink->TailLength = 0;
+    }
+
+    if (Err == NO_ERROR) {
+        // Drops the padding of the last sector, and any space that was
+        // preallocated but not used.
+        EndOfFile.EndOfFile.QuadPart = (LONGLONG)OverlappedSink->Offset;
+        if (!SetFileInformationByHandle(
+                OverlappedSink->File, FileEndOfFileInfo, &EndOfFile, sizeof(EndOfFile))) {
+            Err = GetLastError();
+            printf("SetFileInformationByHandle(FileEndOfFileInfo) failed with %u\n", Err);
+        }
+    }
+
+    OverlappedSinkFree(OverlappedSink);
+
+    return Err;
+}
+
+int OverlappedSinkInit(
+    struct OVERLAPPED_SINK* OverlappedSink,
+    HANDLE File,
+    BOOLEAN Unbuffered,
+    unsigned long BufferSize,
+    unsigned long NumWrites)
+{
+    FILE_STORAGE_INFO StorageInfo;
+    unsigned long i;
+
+    ZeroMemory(OverlappedSink, sizeof(*OverlappedSink));
+    OverlappedSink->Sink.Write = OverlappedSinkWrite;
+    OverlappedSink->Sink.Close = OverlappedSinkClose;
+    OverlappedSink->File = File;
+    OverlappedSink->Unbuffered = Unbuffered;
+    OverlappedSink->NumWrites = NumWrites;
+
+    if (NumWrites == 0 || NumWrites > OVERLAPPED_SINK_MAX_WRITES) {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    // Unbuffered I/O has to be done in multiples of the sector size. Use the
+    // size the device prefers, or a page if it can't tell us.
+    OverlappedSink->SectorSize = 4096;
+    if (Unbuffered &&
+        GetFileInformationByHandleEx(File, FileStorageInfo, &StorageInfo, sizeof(StorageInfo)) &&
+        StorageInfo.PhysicalBytesPerSectorForPerformance != 0 &&
+        (StorageInfo.PhysicalBytesPerSectorForPerformance &
+         (StorageInfo.PhysicalBytesPerSectorForPerformance - 1)) == 0) {
+        OverlappedSink->SectorSize = StorageInfo.PhysicalBytesPerSectorForPerformance;
+    }
+    if (OverlappedSink->SectorSize > BufferSize / 2) {
+        printf("Write buffer too small for the sector size (%u)\n", OverlappedSink->SectorSize);
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    OverlappedSink->Tail = PcapNgAllocBuffer(OverlappedSink->SectorSize);
+    if (OverlappedSink->Tail == NULL) {
+        goto OutOfMemory;
+    }
+
+    for (i = 0; i < NumWrites; i++) {
+        OverlappedSink->Writes[i].Buffer = PcapNgAllocBuffer(BufferSize);
+        OverlappedSink->Writes[i].Overlapped.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+        if (OverlappedSink->Writes[i].Buffer == NULL ||
+            OverlappedSink->Writes[i].Overlapped.hEvent == NULL) {
+            goto OutOfMemory;
+        }
+    }
+
+    return NO_ERROR;
+
+OutOfMemory:
+    printf("out of memory\n");
+    OverlappedSinkFree(OverlappedSink);
+    return ERROR_NOT_ENOUGH_MEMORY;
+}
+
+int GzipSinkOutput(void* Context, const BYTE* Data, unsigned long Length)
+{
+    struct GZIP_SINK* GzipSink = (struct GZIP_SINK*)Context;
+    unsigned long Chunk;
+    unsigned long Used;
+    int Err;
+
+    while (Length > 0) {
+        Chunk = min(Length, GzipSink->BufferSize - GzipSink->BufferUsed);
+        memcpy(GzipSink->Buffer + GzipSink->BufferUsed, Data, Chunk);
+        GzipSink->BufferUsed += Chunk;
+        Data += Chunk;
+        Length -= Chunk;
+
+        if (GzipSink->BufferUsed == GzipSink->BufferSize) {
+            Used = GzipSink->BufferUsed;
+            Err = GzipSink->Next->Write(GzipSink->Next, &GzipSink->Buffer, &Used);
+            if (Err != NO_ERROR) {
+                return Err;
+            }
+            GzipSink->BufferUsed = Used;
+        }
+    }
+
+    return NO_ERROR;
+}
+
+int GzipSinkWrite(struct PCAPNG_SINK* Sink, char** Buffer, unsigned long* Length)
+{
+    struct GZIP_SINK* GzipSink = (struct GZIP_SINK*)Sink;
+    int Err;
+
+    Err = GzipWrite(GzipSink->Gzip, *Buffer, *Length);
+    *Length = 0;
+
+    return Err;
+}
+
+void GzipSinkFree(struct GZIP_SINK* GzipSink)
+{
+    free(GzipSink->Gzip);
+    GzipSink->Gzip = NULL;
+    PcapNgFreeBuffer(GzipSink->Buffer);
+    GzipSink->Buffer = NULL;
+}
+
+int GzipSinkClose(struct PCAPNG_SINK* Sink)
+{
+    struct GZIP_SINK* GzipSink = (struct GZIP_SINK*)Sink;
+    unsigned long Used;
+    int Err;
+    int CloseErr;
+
+    Err = GzipFinish(GzipSink->Gzip);
+    if (Err == NO_ERROR && GzipSink->BufferUsed > 0) {
+        Used = GzipSink->BufferUsed;
+        Err = GzipSink->Next->Write(GzipSink->Next, &GzipSink->Buffer, &Used);
+        GzipSink->BufferUsed = 0;
+    }
+
+    CloseErr = GzipSink->Next->Close(GzipSink->Next);
+    if (Err == NO_ERROR) {
+        Err = CloseErr;
+    }
+
+    GzipSinkFree(GzipSink);
+
+    return Err;
+}
+
+int GzipSinkInit(
+    struct GZIP_SINK* GzipSink,
+    struct PCAPNG_SINK* Next,
+    int Level,
+    unsigned long BufferSize)
+{
+    int Err;
+
+    ZeroMemory(GzipSink, sizeof(*GzipSink));
+    GzipSink->Sink.Write = GzipSinkWrite;
+    GzipSink->Sink.Close = GzipSinkClose;
+    GzipSink->Next = Next;
+    GzipSink->BufferSize = BufferSize;
+
+    GzipSink->Gzip = malloc(sizeof(struct GZIP_STREAM));
+    GzipSink->Buffer = PcapNgAllocBuffer(BufferSize);
+    if (GzipSink->Gzip == NULL || GzipSink->Buffer == NULL) {
+        printf("out of memory\n");
+        GzipSinkFree(GzipSink);
+        return ERROR_NOT_ENOUGH_MEMORY;
+    }
+
+    Err = GzipInit(GzipSink->Gzip, Level, GzipSinkOutput, GzipSink);
+    if (Err != NO_ERROR) {
+        GzipSinkFree(GzipSink);
+    }
+    return Err;
+}
+
+int TimedSinkWrite(struct PCAPNG_SINK* Sink, char** Buffer, unsigned long* Length)
+{
+    struct TIMED_SINK* TimedSink = (struct TIMED_SINK*)Sink;
+    LARGE_INTEGER Start;
+    LARGE_INTEGER End;
+    int Err;
+
+    QueryPerformanceCounter(&Start);
+    Err = TimedSink->Next->Write(TimedSink->Next, Buffer, Length);
+    QueryPerformanceCounter(&End);
+    *TimedSink->Ticks += End.QuadPart - Start.QuadPart;
+
+    return Err;
+}
+
+int TimedSinkClose(struct PCAPNG_SINK* Sink)
+{
+    struct TIMED_SINK* TimedSink = (struct TIMED_SINK*)Sink;
+    LARGE_INTEGER Start;
+    LARGE_INTEGER End;
+    int Err;
+
+    QueryPerformanceCounter(&Start);
+    Err = TimedSink->Next->Close(TimedSink->Next);
+    QueryPerformanceCounter(&End);
+    *TimedSink->Ticks += End.QuadPart - Start.QuadPart;
+
+    return Err;
+}
+
+void TimedSinkInit(struct TIMED_SINK* TimedSink, struct PCAPNG_SINK* Next, LONGLONG* Ticks)
+{
+    TimedSink->Sink.Write = TimedSinkWrite;
+    TimedSink->Sink.Close = TimedSinkClose;
+    TimedSink->Next = Next;
+    TimedSink->Ticks = Ticks;
+}
+
+int MemorySinkWrite(struct PCAPNG_SINK* Sink, char** Buffer, unsigned long* Length)
+{
+    struct MEMORY_SINK* MemorySink = (struct MEMORY_SINK*)Sink;
+    size_t NewSize;
+    char* NewData;
+
+    if (MemorySink->Length + *Length > MemorySink->Size) {
+        NewSize = max(MemorySink->Size * 2, MemorySink->Length + *Length);
+        NewData = realloc(MemorySink->Data, NewSize);
+        if (NewData == NULL) {
+            printf("out of memory\n");
+            return ERROR_NOT_ENOUGH_MEMORY;
+        }
+        MemorySink->Data = NewData;
+        MemorySink->Size = NewSize;
+    }
+    memcpy(MemorySink->Data + MemorySink->Length, *Buffer, *Length);
+    MemorySink->Length += *Length;
+    *Length = 0;
+
+    return NO_ERROR;
+}
+
+int MemorySinkClose(struct PCAPNG_SINK* Sink)
+{
+    UNREFERENCED_PARAMETER(Sink);
+    return NO_ERROR;
+}
+
+void MemorySinkInit(struct MEMORY_SINK* MemorySink)
+{
+    MemorySink->Sink.Write = MemorySinkWrite;
+    MemorySink->Sink.Close = MemorySinkClose;
+    MemorySink->Data = NULL;
+    MemorySink->Length = 0;
+    MemorySink->Size = 0;
+}
+
+void MemorySinkReset(struct MEMORY_SINK* MemorySink)
+{
+    MemorySink->Length = 0;
+}
+
+void MemorySinkFree(struct MEMORY_SINK* MemorySink)
+{
+    free(MemorySink->Data);
+    MemorySinkInit(MemorySink);
+}
+
+int SocketSinkWrite(struct PCAPNG_SINK* Sink, char** Buffer, unsigned long* Length)
+{
+    struct SOCKET_SINK* SocketSink = (struct SOCKET_SINK*)Sink;
+    const char* Data = *Buffer;
+    unsigned long Left = *Length;
+    int Sent;
+    int Err = NO_ERROR;
+
+    while (Left > 0) {
+        Sent = send(SocketSink->Socket, Data, (int)Left, 0);
+        if (Sent == SOCKET_ERROR) {
+            Err = WSAGetLastError();
+            printf("send failed with %u\n", Err);
+            break;
+        }
+        Data += Sent;
+        Left -= Sent;
+    }
+    *Length = 0;
+
+    return Err;
+}
+
+int SocketSinkClose(struct PCAPNG_SINK* Sink)
+{
+    struct SOCKET_SINK* SocketSink = (struct SOCKET_SINK*)Sink;
+
+    if (SocketSink->Socket != INVALID_SOCKET) {
+        // Lets the receiver see the end of the stream after the last data.
+        shutdown(SocketSink->Socket, SD_SEND);
+        closesocket(SocketSink->Socket);
+        SocketSink->Socket = INVALID_SOCKET;
+        WSACleanup();
+    }
+    return NO_ERROR;
+}
+
+int SocketSinkInit(struct SOCKET_SINK* SocketSink, const wchar_t* Address, unsigned long BufferSize)
+{
+    int Err;
+    WSADATA WsaData;
+    wchar_t Host[256];
+    const wchar_t* HostStart = Address;
+    const wchar_t* HostEnd;
+    const wchar_t* Port;
+    ADDRINFOW Hints;
+    PADDRINFOW Results = NULL;
+    PADDRINFOW Result;
+    BOOL NoDelay = TRUE;
+    int SendBufferSize = (int)min(BufferSize, INT_MAX);
+
+    SocketSink->Sink.Write = SocketSinkWrite;
+    SocketSink->Sink.Close = SocketSinkClose;
+    SocketSink->Socket = INVALID_SOCKET;
+
+    if (Address[0] == L'[') {
+        HostStart = Address + 1;
+        HostEnd = wcschr(HostStart, L']');
+        Port = HostEnd != NULL && HostEnd[1] == L':' ? HostEnd + 2 : NULL;
+    } else {
+        HostEnd = wcsrchr(Address, L':');
+        Port = HostEnd != NULL ? HostEnd + 1 : NULL;
+    }
+    if (Port == NULL || *Port == L'\0' ||
+        HostEnd == HostStart || HostEnd - HostStart >= RTL_NUMBER_OF(Host)) {
+        printf("%ws isn't a valid host:port\n", Address);
+        return ERROR_INVALID_PARAMETER;
+    }
+    wmemcpy(Host, HostStart, HostEnd - HostStart);
+    Host[HostEnd - HostStart] = L'\0';
+
+    Err = WSAStartup(MAKEWORD(2, 2), &WsaData);
+    if (Err != NO_ERROR) {
+        printf("WSAStartup failed with %u\n", Err);
+        return Err;
+    }
+
+    ZeroMemory(&Hints, sizeof(Hints));
+    Hints.ai_family = AF_UNSPEC;
+    Hints.ai_socktype = SOCK_STREAM;
+    Hints.ai_protocol = IPPROTO_TCP;
+    Err = GetAddrInfoW(Host, Port, &Hints, &Results);
+    if (Err != NO_ERROR) {
+        printf("GetAddrInfoW called on %ws failed with %u\n", Address, Err);
+        goto Fail;
+    }
+
+    Err = ERROR_NOT_FOUND;
+    for (Result = Results; Result != NULL; Result = Result->ai_next) {
+        SocketSink->Socket = socket(Result->ai_family, Result->ai_socktype, Result->ai_protocol);
+        if (SocketSink->Socket == INVALID_SOCKET) {
+            Err = WSAGetLastError();
+            continue;
+        }
+        if (connect(SocketSink->Socket, Result->ai_addr, (int)Result->ai_addrlen) == 0) {
+            Err = NO_ERROR;
+            break;
+        }
+        Err = WSAGetLastError();
+        closesocket(SocketSink->Socket);
+        SocketSink->Socket = INVALID_SOCKET;
+    }
+    FreeAddrInfoW(Results);
+    if (Err != NO_ERROR) {
+        printf("Connecting to %ws failed with %u\n", Address, Err);
+        goto Fail;
+    }
+
+    // Full buffers are sent at once anyway, and with --live the partly
+    // filled buffer flushed every second shouldn't wait for an ACK. A send
+    // buffer of one staging buffer lets the next batch be built while the
+    // last one is still on its way.
+    setsockopt(SocketSink->Socket, IPPROTO_TCP, TCP_NODELAY, (const char*)&NoDelay, sizeof(NoDelay));
+    setsockopt(SocketSink->Socket, SOL_SOCKET, SO_SNDBUF, (const char*)&SendBufferSize, sizeof(SendBufferSize));
+
+    return NO_ERROR;
+
+Fail:
+    WSACleanup();
+    return Err;
+}
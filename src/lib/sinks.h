@@ -0,0 +1,134 @@
+/*
+
+Copyright (c) Microsoft Corporation.
+Licensed under the MIT License.
+
+PCAPNG_SINK implementations beyond the basic file sink in pcapng.h.
+Include after <winsock2.h> (for SOCKET_SINK).
+
+*/
+
+#pragma once
+
+// Passes full staging buffers to a dedicated thread, which writes them to
+// the next sink in order. The writer only waits if all NumBuffers buffers
+// are still queued. The next sink has to consume whole buffers, so it can't
+// be an OVERLAPPED_SINK in unbuffered mode.
+#define THREAD_SINK_MAX_BUFFERS 16
+
+struct THREAD_SINK {
+    struct PCAPNG_SINK Sink;
+    struct PCAPNG_SINK* Next;
+    HANDLE Thread;
+    SRWLOCK Lock;
+    CONDITION_VARIABLE QueueChanged;
+    unsigned long BufferSize;
+    unsigned long NumBuffers;
+    char* Free[THREAD_SINK_MAX_BUFFERS];
+    unsigned long NumFree;
+    struct {
+        char* Buffer;
+        unsigned long Length;
+    } Queue[THREAD_SINK_MAX_BUFFERS];
+    unsigned long QueueHead;
+    unsigned long QueueLength;
+    BOOLEAN Closing;
+    int Err; // first error from the next sink
+};
+
+int ThreadSinkInit(
+    struct THREAD_SINK* ThreadSink,
+    struct PCAPNG_SINK* Next,
+    unsigned long BufferSize,
+    unsigned long NumBuffers);
+
+// Writes staging buffers with overlapped WriteFile calls at explicit
+// offsets, with up to NumWrites writes in flight. The file must have been
+// opened with FILE_FLAG_OVERLAPPED, and with FILE_FLAG_NO_BUFFERING if
+// Unbuffered is set. In unbuffered mode only whole sectors are written: the
+// partial sector at the end of each buffer is handed back to the writer, and
+// on Close the last one is written padded and the file is trimmed to size.
+#define OVERLAPPED_SINK_MAX_WRITES 16
+
+struct OVERLAPPED_SINK {
+    struct PCAPNG_SINK Sink;
+    HANDLE File; // owned by the caller
+    BOOLEAN Unbuffered;
+    unsigned long SectorSize;
+    unsigned long NumWrites;
+    struct {
+        OVERLAPPED Overlapped;
+        char* Buffer; // being written if Pending, otherwise free
+        unsigned long Length;
+        BOOLEAN Pending;
+    } Writes[OVERLAPPED_SINK_MAX_WRITES];
+    unsigned long NextWrite;
+    ULONGLONG Offset; // where the next write goes
+    char* Tail; // copy of the partial sector handed back to the writer
+    unsigned long TailLength;
+};
+
+int OverlappedSinkInit(
+    struct OVERLAPPED_SINK* OverlappedSink,
+    HANDLE File,
+    BOOLEAN Unbuffered,
+    unsigned long BufferSize,
+    unsigned long NumWrites);
+
+// Compresses the stream with gzip (see gzip.h) and passes the compressed
+// data to the next sink in buffers of BufferSize bytes. Compression runs on
+// the calling thread, so put a THREAD_SINK in front of it to keep it off the
+// converting thread.
+struct GZIP_SINK {
+    struct PCAPNG_SINK Sink;
+    struct PCAPNG_SINK* Next;
+    struct GZIP_STREAM* Gzip;
+    char* Buffer;
+    unsigned long BufferSize;
+    unsigned long BufferUsed;
+};
+
+int GzipSinkInit(
+    struct GZIP_SINK* GzipSink,
+    struct PCAPNG_SINK* Next,
+    int Level,
+    unsigned long BufferSize);
+
+// Adds the time spent in the next sink's Write and Close calls, in
+// QueryPerformanceCounter ticks, to *Ticks.
+struct TIMED_SINK {
+    struct PCAPNG_SINK Sink;
+    struct PCAPNG_SINK* Next;
+    LONGLONG* Ticks;
+};
+
+void TimedSinkInit(struct TIMED_SINK* TimedSink, struct PCAPNG_SINK* Next, LONGLONG* Ticks);
+
+// Collects the stream in a heap buffer, e.g. to get the output of a
+// conversion from Etl2PcapngCreate back as bytes. Data and Length are the
+// bytes received so far; MemorySinkReset discards them (keeping the
+// buffer) once the caller has consumed them. Close does nothing, so the
+// data is still there after Etl2PcapngFinish; free it with MemorySinkFree.
+struct MEMORY_SINK {
+    struct PCAPNG_SINK Sink;
+    char* Data;
+    size_t Length;
+    size_t Size;
+};
+
+void MemorySinkInit(struct MEMORY_SINK* MemorySink);
+void MemorySinkReset(struct MEMORY_SINK* MemorySink);
+void MemorySinkFree(struct MEMORY_SINK* MemorySink);
+
+// Streams the output over a TCP connection to Address, host:port or
+// [IPv6 address]:port, e.g. to a collector on another machine. Each staging
+// buffer is one batch, sent with blocking sends: a receiver that doesn't
+// keep up makes the writer wait instead of data piling up in memory (with
+// --live, ETW then buffers the events, and drops them once its buffers are
+// full). The receiver gets a plain pcapng stream, as from a pipe.
+struct SOCKET_SINK {
+    struct PCAPNG_SINK Sink;
+    SOCKET Socket;
+};
+
+int SocketSinkInit(struct SOCKET_SINK* SocketSink, const wchar_t* Address, unsigned long BufferSize);
@@ -7,13 +7,8 @@ etl2pcapng
 
 Converts packet captures in ETL format generated by ndiscap (the ETW provider
 in Windows that produces packet capture events) to pcapng format
-(readable by Wireshark).
-
-Issues:
-
--ndiscap supports packet truncation and so does pcapng, but ndiscap doesn't
- currently log metadata about truncation in its events (other than marking
- them with a keyword), so we pretend there is no truncation for now.
+(readable by Wireshark). This is the command line tool; the conversion
+itself is done by the library in lib (see lib\etl2pcapng.h).
 
 */
 
@@ -21,462 +16,427 @@ Issues:
 #include <windows.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <limits.h>
 #include <evntrace.h>
 #include <evntcons.h>
-#include <tdh.h>
 #include <strsafe.h>
 #include <pcapng.h>
+#include <gzip.h>
+#include <etl2pcapng.h>
 
 #define USAGE \
-"etl2pcapng <infile> <outfile>\n" \
-"Converts a packet capture from etl to pcapng format.\n"
-
-#define MAX_PACKET_SIZE 65535
-
-// From the ndiscap manifest
-#define KW_MEDIA_WIRELESS_WAN         0x200
-#define KW_MEDIA_NATIVE_802_11      0x10000
-#define KW_PACKET_START          0x40000000
-#define KW_PACKET_END            0x80000000
-#define KW_SEND                 0x100000000
-#define KW_RECEIVE              0x200000000
-
-#define tidPacketFragment            1001
-#define tidPacketMetadata            1002
-#define tidVMSwitchPacketFragment    1003
-
-// From: https://docs.microsoft.com/en-us/windows-hardware/drivers/ddi/windot11/ns-windot11-dot11_extsta_recv_context
-#pragma pack(push,8)
-typedef struct _NDIS_OBJECT_HEADER {
-    UCHAR  Type;
-    UCHAR  Revision;
-    USHORT Size;
-} NDIS_OBJECT_HEADER, * PNDIS_OBJECT_HEADER;
-
-typedef struct DOT11_EXTSTA_RECV_CONTEXT {
-    NDIS_OBJECT_HEADER Header;
-    ULONG              uReceiveFlags;
-    ULONG              uPhyId;
-    ULONG              uChCenterFrequency;
-    USHORT             usNumberOfMPDUsReceived;
-    LONG               lRSSI;
-    UCHAR              ucDataRate;
-    ULONG              uSizeMediaSpecificInfo;
-    PVOID              pvMediaSpecificInfo;
-    ULONGLONG          ullTimestamp;
-} DOT11_EXTSTA_RECV_CONTEXT, * PDOT11_EXTSTA_RECV_CONTEXT;
-#pragma pack(pop)
-
-// From: https://docs.microsoft.com/en-us/windows-hardware/drivers/ddi/windot11/ne-windot11-_dot11_phy_type
-static const char* DOT11_PHY_TYPE_NAMES[] = {
-    "Unknown",        // dot11_phy_type_unknown = 0
-    "Fhss",           // dot11_phy_type_fhss = 1
-    "Dsss",           // dot11_phy_type_dsss = 2
-    "IrBaseband",     // dot11_phy_type_irbaseband = 3
-    "802.11a",        // dot11_phy_type_ofdm = 4
-    "802.11b",        // dot11_phy_type_hrdsss = 5
-    "802.11g",        // dot11_phy_type_erp = 6
-    "802.11n",        // dot11_phy_type_ht = 7
-    "802.11ac",       // dot11_phy_type_vht = 8
-    "802.11ad",       // dot11_phy_type_dmg = 9
-    "802.11ax"        // dot11_phy_type_he = 10
-};
-
-HANDLE OutFile = INVALID_HANDLE_VALUE;
-unsigned long long NumFramesConverted = 0;
-BOOLEAN Pass2 = FALSE;
-char AuxFragBuf[MAX_PACKET_SIZE] = {0};
-unsigned long AuxFragBufOffset = 0;
-
-DOT11_EXTSTA_RECV_CONTEXT PacketMetadata;
-BOOLEAN AddMetadata = FALSE;
-
-const GUID NdisCapId = { // Microsoft-Windows-NDIS-PacketCapture {2ED6006E-4729-4609-B423-3EE7BCD678EF}
-    0x2ed6006e, 0x4729, 0x4609, 0xb4, 0x23, 0x3e, 0xe7, 0xbc, 0xd6, 0x78, 0xef};
-
-struct INTERFACE {
-    struct INTERFACE* Next;
-    unsigned long LowerIfIndex;
-    unsigned long MiniportIfIndex;
-    unsigned long PcapNgIfIndex;
-    short Type;
-};
-
-#define IFACE_HT_SIZE 100
-struct INTERFACE* InterfaceHashTable[IFACE_HT_SIZE] = {0};
-unsigned long NumInterfaces = 0;
-
-struct INTERFACE* GetInterface(unsigned long LowerIfIndex)
+"etl2pcapng [options] <infile> [<infile>...] <outfile>\n" \
+"etl2pcapng --live [options] <outfile>\n" \
+"etl2pcapng --batch [options] <indir|pattern> <outdir>\n" \
+"etl2pcapng --scan [--json] [filters] <infile> [<infile>...]\n" \
+"Converts a packet capture from etl to pcapng format. Several infiles\n" \
+"are merged into one outfile in timestamp order.\n" \
+"<outfile> can also be - (stdout), \\\\.\\pipe\\<name> or tcp://<host>:<port>.\n" \
+"\n" \
+"Options:\n" \
+"  --write-buffer <size>  Size of the output staging buffer in bytes\n" \
+"                         (K, M and G suffixes accepted, default 4M).\n" \
+"  --sort-interfaces      Read the input twice so that interface IDs are\n" \
+"                         sorted by IfIndex instead of numbered in order\n" \
+"                         of first appearance.\n" \
+"  --metadata <format>    How the PID and 802.11 metadata are attached to\n" \
+"                         packets: comment (default), custom (binary\n" \
+"                         custom options) or radiotap (custom options, and\n" \
+"                         radiotap headers on 802.11 interfaces).\n" \
+"  --live                 Convert packets from a new real-time capture\n" \
+"                         session instead of an etl file, until Ctrl+C.\n" \
+"  --batch                Convert every .etl file in <indir> (or every\n" \
+"                         file matching <pattern>) to <outdir>\\<name>.pcapng.\n" \
+"  --jobs <n>             Number of files --batch converts at the same\n" \
+"                         time (default: number of processors).\n" \
+"  --scan                 Don't convert, only print the interfaces, their\n" \
+"                         packet and byte counts, the time range and the\n" \
+"                         number of events of each id, without reading the\n" \
+"                         packet data.\n" \
+"  --json                 With --scan, print the summary as JSON.\n" \
+"  --stats                Print event, interface and timing statistics.\n" \
+"  --progress             Print progress about once a second.\n" \
+"  --max-packets <n>      Stop after converting n packets.\n" \
+"  --max-bytes <size>     Stop before converting more than size bytes of\n" \
+"                         packet data (K, M and G suffixes accepted).\n" \
+"  --direct               Read the etl files without ProcessTrace, which is\n" \
+"                         faster (ProcessTrace is still used for files\n" \
+"                         that can't be read this way).\n" \
+"  --pipeline             Encode packets and write the output on separate\n" \
+"                         threads while the input is being read.\n" \
+"                         Packet order is unchanged.\n" \
+"  --parallel <n>         Convert n time ranges of the input at the same\n" \
+"                         time, into temporary files next to <outfile>\n" \
+"                         that are then concatenated (up to 64).\n" \
+"  --overlapped           Write the output with overlapped I/O, several\n" \
+"                         writes in flight, preallocating the file based\n" \
+"                         on the size of the input.\n" \
+"  --no-buffering         Like --overlapped, but also bypass the system\n" \
+"                         file cache.\n" \
+"  --compress gzip        Write the output gzip compressed (on a separate\n" \
+"                         thread). Wireshark opens .pcapng.gz directly.\n" \
+"  --compress-level <n>   1 (fastest) to 9 (smallest), default 6.\n" \
+"  --snaplen <n>          Write at most n bytes of each packet.\n" \
+"  --dedup miniport|top   Write packets that were logged on several layers\n" \
+"                         of the stack (miniport and filters) only once, as\n" \
+"                         seen closest to the miniport or top-most.\n" \
+"  --if-names             Name the interfaces after the network adapters of\n" \
+"                         this machine (for converting on the capture host).\n" \
+"  --if-stats             End the output with per-interface packet counts\n" \
+"                         (interface statistics blocks).\n" \
+"  --tsresol us|100ns     Timestamp resolution, default us. 100ns keeps\n" \
+"                         the full precision of ETW timestamps.\n" \
+"  --tsoffset             With --tsresol 100ns, write the ETW timestamps\n" \
+"                         unchanged and the epoch difference in if_tsoffset.\n" \
+"  --split-size <size>    Start a new output file (<outfile>_00001,\n" \
+"                         _00002...) when the current one reaches size\n" \
+"                         bytes (K, M and G suffixes accepted).\n" \
+"  --split-seconds <n>    Start a new output file when the current one\n" \
+"                         spans n seconds of packets.\n" \
+"  --index                Write <outfile>.idx, an index of the packet\n" \
+"                         offsets and times, for seeking into the output.\n" \
+"  --index-interval <n>   With --index, index every nth packet (default\n" \
+"                         1024).\n" \
+"\n" \
+"Filters (packets that don't match are not converted):\n" \
+"  --ifindex <n>          Only packets on this IfIndex (can be repeated).\n" \
+"  --direction send|recv  Only packets in this direction.\n" \
+"  --pid <n>              Only packets logged in this process.\n" \
+"  --start <time>         Only packets logged at or after this UTC time,\n" \
+"                         e.g. 2021-03-04T05:06:07.5Z\n" \
+"  --end <time>           Only packets logged before this UTC time.\n"
+
+BOOLEAN ParseUlong(wchar_t* Str, unsigned long* Value)
 {
-    struct INTERFACE* Iface = InterfaceHashTable[LowerIfIndex % IFACE_HT_SIZE];
-    while (Iface != NULL) {
-        if (Iface->LowerIfIndex == LowerIfIndex) {
-            return Iface;
-        }
-        Iface = Iface->Next;
-    }
-    return NULL;
-}
+    wchar_t* End;
+    unsigned long long Parsed = wcstoull(Str, &End, 0);
 
-void AddInterface(unsigned long LowerIfIndex, unsigned long MiniportIfIndex, short Type)
-{
-    struct INTERFACE** Iface = &InterfaceHashTable[LowerIfIndex % IFACE_HT_SIZE];
-    struct INTERFACE* NewIface = malloc(sizeof(struct INTERFACE));
-    if (NewIface == NULL) {
-        printf("out of memory\n");
-        exit(1);
-    }
-    NewIface->LowerIfIndex = LowerIfIndex;
-    NewIface->MiniportIfIndex = MiniportIfIndex;
-    NewIface->Type = Type;
-    NewIface->Next = *Iface;
-    *Iface = NewIface;
-    NumInterfaces++;
+    if (End == Str || *End != L'\0' || Parsed > ULONG_MAX) {
+        return FALSE;
+    }
+    *Value = (unsigned long)Parsed;
+    return TRUE;
 }
 
-int __cdecl InterfaceCompareFn(const void* A, const void* B)
+BOOLEAN ParseDigits(wchar_t** Str, int Digits, WORD* Value)
 {
-    // MiniportIfIndex is the primary sort and LowerIfIndex is
-    // the secondary sort, except that inside a group of interfaces
-    // with the same MiniportIfIndex we want the one with
-    // MiniportIfIndex==LowerIfIndex (i.e. the miniport) to come
-    // first.
-
-    unsigned long MA = (*((struct INTERFACE**)A))->MiniportIfIndex;
-    unsigned long MB = (*((struct INTERFACE**)B))->MiniportIfIndex;
-    unsigned long LA = (*((struct INTERFACE**)A))->LowerIfIndex;
-    unsigned long LB = (*((struct INTERFACE**)B))->LowerIfIndex;
-
-    if (MA == MB) {
-        if (MA == LA) {
-            // A is the miniport.
-            return -1;
-        } else if (MB == LB) {
-            // B is the miniport.
-            return 1;
-        } else if (LA < LB) {
-            return -1;
-        } else if (LB < LA) {
-            return 1;
-        } else {
-            return 0;
+    *Value = 0;
+    while (Digits-- > 0) {
+        if (**Str < L'0' || **Str > L'9') {
+            return FALSE;
         }
-    } else if (MA < MB) {
-        return -1;
-    } else {
-        return 1;
+        *Value = *Value * 10 + (WORD)(**Str - L'0');
+        (*Str)++;
     }
+    return TRUE;
 }
 
-void WriteInterfaces()
+// Parses a UTC time like 2021-03-04T05:06:07.1234567Z into FILETIME ticks.
+// The fraction and the Z are optional, and a space can be used instead of
+// the T.
+BOOLEAN ParseTime(wchar_t* Str, LONGLONG* Time)
 {
-    // Sorts the interfaces, writes them to the pcapng file, and prints them
-    // for user reference.
-
-    struct INTERFACE** InterfaceArray;
-    struct INTERFACE* Interface;
-    unsigned int i, j;
-
-    InterfaceArray = (struct INTERFACE**)malloc(NumInterfaces * sizeof(struct INTERFACE*));
-    if (InterfaceArray == NULL) {
-        printf("out of memory\n");
-        exit(1);
+    SYSTEMTIME SystemTime = {0};
+    FILETIME FileTime;
+    ULARGE_INTEGER Ticks;
+    LONGLONG Fraction = 0;
+    LONGLONG Scale = 1000000; // ticks per tenth of a second
+
+    if (!ParseDigits(&Str, 4, &SystemTime.wYear) || *Str++ != L'-' ||
+        !ParseDigits(&Str, 2, &SystemTime.wMonth) || *Str++ != L'-' ||
+        !ParseDigits(&Str, 2, &SystemTime.wDay) || (*Str != L'T' && *Str != L' ') ||
+        !(Str++, ParseDigits(&Str, 2, &SystemTime.wHour)) || *Str++ != L':' ||
+        !ParseDigits(&Str, 2, &SystemTime.wMinute) || *Str++ != L':' ||
+        !ParseDigits(&Str, 2, &SystemTime.wSecond)) {
+        return FALSE;
     }
 
-    j = 0;
-    for (i = 0; i < IFACE_HT_SIZE; i++) {
-        for (Interface = InterfaceHashTable[i]; Interface != NULL; Interface = Interface->Next) {
-            InterfaceArray[j++] = Interface;
+    if (*Str == L'.') {
+        Str++;
+        if (*Str < L'0' || *Str > L'9') {
+            return FALSE;
         }
+        while (*Str >= L'0' && *Str <= L'9') {
+            Fraction += (*Str - L'0') * Scale;
+            Scale /= 10;
+            Str++;
+        }
+    }
+    if (*Str == L'Z') {
+        Str++;
+    }
+    if (*Str != L'\0' || !SystemTimeToFileTime(&SystemTime, &FileTime)) {
+        return FALSE;
     }
 
-    qsort(InterfaceArray, NumInterfaces, sizeof(struct INTERFACE*), InterfaceCompareFn);
+    Ticks.LowPart = FileTime.dwLowDateTime;
+    Ticks.HighPart = FileTime.dwHighDateTime;
+    *Time = (LONGLONG)Ticks.QuadPart + Fraction;
+    return TRUE;
+}
 
-    for (i = 0; i < NumInterfaces; i++) {
-        Interface = InterfaceArray[i];
-        Interface->PcapNgIfIndex = i;
-        PcapNgWriteInterfaceDesc(OutFile, Interface->Type, MAX_PACKET_SIZE);
+BOOLEAN ParseSize64(wchar_t* Str, unsigned long long* Size)
+{
+    wchar_t* End;
+    unsigned long long Value = wcstoull(Str, &End, 10);
+    unsigned long long Scale = 1;
 
-        switch (Interface->Type) {
-        case PCAPNG_LINKTYPE_ETHERNET:
-            printf("IF: medium=eth  ID=%u\tIfIndex=%u", Interface->PcapNgIfIndex, Interface->LowerIfIndex);
-            break;
-        case PCAPNG_LINKTYPE_IEEE802_11:
-            printf("IF: medium=wifi ID=%u\tIfIndex=%u", Interface->PcapNgIfIndex, Interface->LowerIfIndex);
-            break;
-        case PCAPNG_LINKTYPE_RAW:
-            printf("IF: medium=mbb  ID=%u\tIfIndex=%u", Interface->PcapNgIfIndex, Interface->LowerIfIndex);
-            break;
-        }
-        if (Interface->LowerIfIndex != Interface->MiniportIfIndex) {
-            printf("\t(LWF over IfIndex %u)", Interface->MiniportIfIndex);
-        }
-        printf("\n");
+    if (End == Str) {
+        return FALSE;
     }
-
-    free(InterfaceArray);
+    if (*End == L'k' || *End == L'K') {
+        Scale = 1024;
+        End++;
+    } else if (*End == L'm' || *End == L'M') {
+        Scale = 1024 * 1024;
+        End++;
+    } else if (*End == L'g' || *End == L'G') {
+        Scale = 1024 * 1024 * 1024;
+        End++;
+    }
+    if (*End != L'\0' || Value > ULLONG_MAX / Scale) {
+        return FALSE;
+    }
+    *Size = Value * Scale;
+    return TRUE;
 }
 
-inline int
-CombineMetadataWithPacket(
-    _In_ HANDLE File,
-    _In_ PCHAR FragBuf,
-    _In_ unsigned long FragLength,
-    _In_ long InterfaceId,
-    _In_ long IsSend,
-    _In_ long TimeStampHigh, // usec (unless if_tsresol is used)
-    _In_ long TimeStampLow,
-    _In_ PDOT11_EXTSTA_RECV_CONTEXT Metadata,
-    _In_ unsigned long ProcessId
-)
+BOOLEAN ParseSize(wchar_t* Str, unsigned long* Size)
 {
+    unsigned long long Value;
 
-    char Comment[MAX_PACKET_SIZE] = { 0 };
-    size_t commentlength = 0;
-
-    HRESULT Err = StringCchPrintfA((char*)&Comment, MAX_PACKET_SIZE, "Packet Metadata: ReceiveFlags:0x%x, PhyType:%s, CenterCh:%u, NumMPDUsReceived:%u, RSSI:%d, DataRate:%u, PID=%d",
-        Metadata->uReceiveFlags,
-        DOT11_PHY_TYPE_NAMES[Metadata->uPhyId],
-        Metadata->uChCenterFrequency,
-        Metadata->usNumberOfMPDUsReceived,
-        Metadata->lRSSI,
-        Metadata->ucDataRate,
-        ProcessId);
-
-    if (FAILED(Err))
-    {
-        printf("Failed converting NdisMetadata to string with error: %u\n", Err);
-    }
-    else
-    {
-        Err = StringCchLengthA((char*)&Comment, MAX_PACKET_SIZE, &commentlength);
-
-        if (FAILED(Err))
-        {
-            printf("Failed getting length of metadata string with error: %u\n", Err);
-            commentlength = 0;
-            memset(&Comment, 0, MAX_PACKET_SIZE);
-        }
+    if (!ParseSize64(Str, &Value) || Value > ULONG_MAX) {
+        return FALSE;
     }
+    *Size = (unsigned long)Value;
+    return TRUE;
+}
 
+// --batch: converts every file matching a pattern (or every .etl file in a
+// directory) to a .pcapng file of the same name in an output directory.
+// Files are handed out to a pool of worker threads, one file at a time.
+#define BATCH_MAX_JOBS 64
 
+struct BATCH_FILE {
+    wchar_t InFileName[MAX_PATH];
+    wchar_t OutFileName[MAX_PATH];
+};
 
+struct BATCH {
+    const struct ETL2PCAPNG_OPTIONS* Options;
+    struct BATCH_FILE* Files;
+    unsigned long NumFiles;
+    volatile LONG NextFile;
+    volatile LONG NumFailed;
+};
 
-    return PcapNgWriteEnhancedPacket(
-        File,
-        FragBuf,
-        sizeof(DOT11_EXTSTA_RECV_CONTEXT) + FragLength,
-        InterfaceId,
-        IsSend,
-        TimeStampHigh,
-        TimeStampLow,
-        commentlength > 0 ? (char*)&Comment : NULL,
-        (USHORT)commentlength);
+DWORD WINAPI BatchWorker(LPVOID Context)
+{
+    struct BATCH* Batch = (struct BATCH*)Context;
+    struct ETL2PCAPNG_OPTIONS Options = *Batch->Options;
+    struct CONVERSION* Conv;
+    struct ETL2PCAPNG_COUNTERS Counters;
+    struct BATCH_FILE* File;
+    wchar_t* InFileName;
+    LONG Index;
+    int Err;
+
+    Options.Quiet = TRUE;
+    while ((Index = InterlockedIncrement(&Batch->NextFile) - 1) < (LONG)Batch->NumFiles) {
+        File = &Batch->Files[Index];
+        InFileName = File->InFileName;
+        Err = Etl2PcapngOpenFiles(&Options, &InFileName, 1, File->OutFileName, &Conv);
+        if (Err == NO_ERROR) {
+            Err = Etl2PcapngConvert(Conv);
+        }
+        if (Err == NO_ERROR) {
+            Etl2PcapngGetCounters(Conv, &Counters);
+            printf("%ws: converted %llu frames\n", File->InFileName, Counters.FramesConverted);
+        } else {
+            printf("%ws: failed with %u\n", File->InFileName, Err);
+            InterlockedIncrement(&Batch->NumFailed);
+        }
+        Etl2PcapngFree(Conv);
+    }
+    return 0;
 }
 
-void WINAPI EventCallback(PEVENT_RECORD ev)
+// Builds the list of files to convert. Input is a directory or a
+// FindFirstFile pattern (e.g. C:\traces\*.etl).
+int FindBatchFiles(wchar_t* Input, wchar_t* OutDir, struct BATCH* Batch)
 {
-    int Err;
-    unsigned long LowerIfIndex;
-    struct INTERFACE* Iface;
-    unsigned long FragLength;
-    PROPERTY_DATA_DESCRIPTOR Desc;
-    ULARGE_INTEGER TimeStamp;
-
-    if (!IsEqualGUID(&ev->EventHeader.ProviderId, &NdisCapId) ||
-        (ev->EventHeader.EventDescriptor.Id != tidPacketFragment &&
-         ev->EventHeader.EventDescriptor.Id != tidPacketMetadata &&
-         ev->EventHeader.EventDescriptor.Id != tidVMSwitchPacketFragment)) {
-        return;
-    }
-
-    Desc.PropertyName = (ULONGLONG)L"LowerIfIndex";
-    Desc.ArrayIndex = ULONG_MAX;
-    Err = TdhGetProperty(ev, 0, NULL, 1, &Desc, sizeof(LowerIfIndex), (PBYTE)&LowerIfIndex);
-    if (Err != NO_ERROR) {
-        printf("TdhGetProperty LowerIfIndex failed with %u\n", Err);
-        return;
+    int Err = NO_ERROR;
+    wchar_t Pattern[MAX_PATH];
+    size_t DirLength;
+    DWORD Attributes;
+    HANDLE Find;
+    WIN32_FIND_DATA FindData;
+    wchar_t* Ext;
+    unsigned long MaxFiles = 0;
+    struct BATCH_FILE* NewFiles;
+
+    Attributes = GetFileAttributes(Input);
+    if (Attributes != INVALID_FILE_ATTRIBUTES && (Attributes & FILE_ATTRIBUTE_DIRECTORY)) {
+        Err = StringCchPrintf(Pattern, MAX_PATH, L"%ws\\*.etl", Input);
+    } else {
+        Err = StringCchCopy(Pattern, MAX_PATH, Input);
+    }
+    if (FAILED(Err)) {
+        printf("%ws is too long\n", Input);
+        return ERROR_FILENAME_EXCED_RANGE;
     }
 
-    Iface = GetInterface(LowerIfIndex);
+    // The matches are relative to the directory part of the pattern.
+    DirLength = wcslen(Pattern);
+    while (DirLength > 0 && Pattern[DirLength - 1] != L'\\' && Pattern[DirLength - 1] != L'/') {
+        DirLength--;
+    }
 
-    if (!Pass2) {
-        short Type;
-        if (!!(ev->EventHeader.EventDescriptor.Keyword & KW_MEDIA_NATIVE_802_11)) {
-            Type = PCAPNG_LINKTYPE_IEEE802_11;
-        } else if (!!(ev->EventHeader.EventDescriptor.Keyword & KW_MEDIA_WIRELESS_WAN)) {
-            Type = PCAPNG_LINKTYPE_RAW;
-        } else {
-            Type = PCAPNG_LINKTYPE_ETHERNET;
+    Find = FindFirstFile(Pattern, &FindData);
+    if (Find == INVALID_HANDLE_VALUE) {
+        Err = GetLastError();
+        printf("FindFirstFile called on %ws failed with %u\n", Pattern, Err);
+        return Err;
+    }
+
+    do {
+        if (FindData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+            continue;
         }
-        // Record the IfIndex if it's a new one.
-        if (Iface == NULL) {
-            unsigned long MiniportIfIndex;
-            Desc.PropertyName = (ULONGLONG)L"MiniportIfIndex";
-            Desc.ArrayIndex = ULONG_MAX;
-            Err = TdhGetProperty(ev, 0, NULL, 1, &Desc, sizeof(MiniportIfIndex), (PBYTE)&MiniportIfIndex);
-            if (Err != NO_ERROR) {
-                printf("TdhGetProperty MiniportIfIndex failed with %u\n", Err);
-                return;
+        if (Batch->NumFiles == MaxFiles) {
+            MaxFiles = MaxFiles == 0 ? 64 : MaxFiles * 2;
+            NewFiles = realloc(Batch->Files, MaxFiles * sizeof(struct BATCH_FILE));
+            if (NewFiles == NULL) {
+                Err = ERROR_NOT_ENOUGH_MEMORY;
+                printf("out of memory\n");
+                goto Done;
             }
-            AddInterface(LowerIfIndex, MiniportIfIndex, Type);
-        } else if (Iface->Type != Type) {
-            printf("WARNING: inconsistent media type in packet events!\n");
+            Batch->Files = NewFiles;
         }
-        return;
-    }
+        if (FAILED(StringCchPrintf(
+                Batch->Files[Batch->NumFiles].InFileName, MAX_PATH, L"%.*ws%ws",
+                (int)DirLength, Pattern, FindData.cFileName))) {
+            printf("WARNING: skipping %ws, the path is too long\n", FindData.cFileName);
+            continue;
+        }
+        // <name>.etl -> <outdir>\<name>.pcapng
+        Ext = wcsrchr(FindData.cFileName, L'.');
+        if (Ext != NULL) {
+            *Ext = L'\0';
+        }
+        if (FAILED(StringCchPrintf(
+                Batch->Files[Batch->NumFiles].OutFileName, MAX_PATH, L"%ws\\%ws.pcapng",
+                OutDir, FindData.cFileName))) {
+            printf("WARNING: skipping %ws, the path is too long\n", FindData.cFileName);
+            continue;
+        }
+        Batch->NumFiles++;
+    } while (FindNextFile(Find, &FindData));
 
-    if (Iface == NULL) {
-        // We generated the list of interfaces directly from the
-        // packet traces themselves, so there must be a bug.
-        printf("ERROR: packet with unrecognized IfIndex\n");
-        exit(1);
+    Err = GetLastError();
+    if (Err == ERROR_NO_MORE_FILES) {
+        Err = NO_ERROR;
+    } else {
+        printf("FindNextFile failed with %u\n", Err);
     }
 
-    //Save off Ndis/Wlan metadata to be added to the next packet
-    if (ev->EventHeader.EventDescriptor.Id == tidPacketMetadata)
-    {
-        DWORD MetadataLength = 0;
-        Desc.PropertyName = (ULONGLONG)L"MetadataSize";
-        Desc.ArrayIndex = ULONG_MAX;
-        Err = TdhGetProperty(ev, 0, NULL, 1, &Desc, sizeof(MetadataLength), (PBYTE)&MetadataLength);
-        if (Err != NO_ERROR) {
-            printf("TdhGetProperty MetadataSize failed with %u\n", Err);
-            return;
-        }
+Done:
+    FindClose(Find);
+    return Err;
+}
 
-        if (MetadataLength != sizeof(PacketMetadata))
-        {
-            printf("Unknown Metadata length. Expected %u, got %u\n", sizeof(DOT11_EXTSTA_RECV_CONTEXT), MetadataLength);
-            return;
-        }
+int ConvertBatch(const struct ETL2PCAPNG_OPTIONS* Options, wchar_t* Input, wchar_t* OutDir, unsigned long Jobs)
+{
+    int Err;
+    struct BATCH Batch;
+    SYSTEM_INFO SystemInfo;
+    HANDLE Workers[BATCH_MAX_JOBS];
+    unsigned long NumWorkers = 0;
+    unsigned long i;
 
-        Desc.PropertyName = (ULONGLONG)L"Metadata";
-        Desc.ArrayIndex = ULONG_MAX;
-        Err = TdhGetProperty(ev, 0, NULL, 1, &Desc, MetadataLength, (PBYTE)&PacketMetadata);
-        if (Err != NO_ERROR) {
-            printf("TdhGetProperty Metadata failed with %u\n", Err);
-            return;
-        }
+    ZeroMemory(&Batch, sizeof(Batch));
+    Batch.Options = Options;
 
-        AddMetadata = TRUE;
-        return;
+    if (!CreateDirectory(OutDir, NULL) && GetLastError() != ERROR_ALREADY_EXISTS) {
+        Err = GetLastError();
+        printf("CreateDirectory called on %ws failed with %u\n", OutDir, Err);
+        return Err;
     }
 
-    // N.B.: Here we are querying the FragmentSize property to get the
-    // total size of the packet, and then reading that many bytes from
-    // the Fragment property. This is unorthodox (normally you are
-    // supposed to use TdhGetPropertySize to get the size of a property)
-    // but required due to the way ndiscap puts packet contents in
-    // multiple adjacent properties (which happen to be contiguous in
-    // memory).
-
-    Desc.PropertyName = (ULONGLONG)L"FragmentSize";
-    Desc.ArrayIndex = ULONG_MAX;
-    Err = TdhGetProperty(ev, 0, NULL, 1, &Desc, sizeof(FragLength), (PBYTE)&FragLength);
+    Err = FindBatchFiles(Input, OutDir, &Batch);
     if (Err != NO_ERROR) {
-        printf("TdhGetProperty FragmentSize failed with %u\n", Err);
-        return;
+        goto Done;
     }
 
-    if (FragLength > RTL_NUMBER_OF(AuxFragBuf) - AuxFragBufOffset) {
-        printf("Packet too large (size = %u) and skipped\n", AuxFragBufOffset + FragLength);
-        return;
+    if (Jobs == 0) {
+        GetSystemInfo(&SystemInfo);
+        Jobs = SystemInfo.dwNumberOfProcessors;
+    }
+    if (Jobs > BATCH_MAX_JOBS) {
+        Jobs = BATCH_MAX_JOBS;
+    }
+    if (Jobs > Batch.NumFiles) {
+        Jobs = Batch.NumFiles;
     }
 
-    Desc.PropertyName = (ULONGLONG)L"Fragment";
-    Desc.ArrayIndex = ULONG_MAX;
-    Err = TdhGetProperty(ev, 0, NULL, 1, &Desc, FragLength, (PBYTE)(AuxFragBuf + AuxFragBufOffset));
-    if (Err != NO_ERROR) {
-        printf("TdhGetProperty Fragment failed with %u\n", Err);
-        return;
-    }
-
-    // 100ns since 1/1/1601 -> usec since 1/1/1970.
-    // The offset of 11644473600 seconds can be calculated with a
-    // couple of calls to SystemTimeToFileTime.
-    TimeStamp.QuadPart = (ev->EventHeader.TimeStamp.QuadPart / 10) - 11644473600000000ll;
-
-    // The KW_PACKET_START and KW_PACKET_END keywords are used as follows:
-    // -A single-event packet has both KW_PACKET_START and KW_PACKET_END.
-    // -A multi-event packet consists of an event with KW_PACKET_START followed
-    //  by an event with KW_PACKET_END, with zero or more events with neither
-    //  keyword in between.
-    //
-    // So, we accumulate fragments in AuxFragBuf until KW_PACKET_END is
-    // encountered, then call PcapNgWriteEnhancedPacket and start over. There's
-    // no need for us to even look for KW_PACKET_START.
-    //
-    // NB: Starting with Windows 8.1, only single-event packets are traced.
-    // This logic is here to support packet captures from older systems.
-
-    if (!!(ev->EventHeader.EventDescriptor.Keyword & KW_PACKET_END)) {
-
-        if (ev->EventHeader.EventDescriptor.Keyword & KW_MEDIA_NATIVE_802_11 &&
-            AuxFragBuf[1] & 0x40)
-        {
-            // Clear Protected bit in the case of 802.11
-            // Ndis captures will be decrypted in the etl file
-
-            AuxFragBuf[1] = AuxFragBuf[1] & 0xBF; // _1011_1111_ - Clear "Protected Flag"
-        }
+    printf("Converting %u files with %u jobs\n", Batch.NumFiles, Jobs);
 
-        if (AddMetadata)
-        {
-            CombineMetadataWithPacket(
-                OutFile,
-                AuxFragBuf,
-                AuxFragBufOffset + FragLength,
-                Iface->PcapNgIfIndex,
-                !!(ev->EventHeader.EventDescriptor.Keyword & KW_SEND),
-                TimeStamp.HighPart,
-                TimeStamp.LowPart,
-                &PacketMetadata,
-                ev->EventHeader.ProcessId
-            );
-        }
-        else
-        {
-            // COMMENT_MAX_SIZE must be multiple of 4
-            #define COMMENT_MAX_SIZE 16
-            char Comment[COMMENT_MAX_SIZE] = { 0 };
-            size_t CommentLength = 0;
-
-            if SUCCEEDED(StringCchPrintfA(Comment, COMMENT_MAX_SIZE, "PID=%d", ev->EventHeader.ProcessId)) {
-                if FAILED(StringCchLengthA(Comment, COMMENT_MAX_SIZE, &CommentLength)) {
-                    CommentLength = 0;
-                }
+    for (i = 0; i < Jobs; i++) {
+        Workers[NumWorkers] = CreateThread(NULL, 0, BatchWorker, &Batch, 0, NULL);
+        if (Workers[NumWorkers] == NULL) {
+            Err = GetLastError();
+            printf("CreateThread failed with %u\n", Err);
+            if (NumWorkers == 0) {
+                goto Done;
             }
-
-            PcapNgWriteEnhancedPacket(
-                OutFile,
-                AuxFragBuf,
-                AuxFragBufOffset + FragLength,
-                Iface->PcapNgIfIndex,
-                !!(ev->EventHeader.EventDescriptor.Keyword & KW_SEND),
-                TimeStamp.HighPart,
-                TimeStamp.LowPart,
-                CommentLength > 0 ? (char*)&Comment : NULL,
-                (USHORT)CommentLength);
+            // The workers that did start convert the rest of the files.
+            Err = NO_ERROR;
+            break;
         }
+        NumWorkers++;
+    }
 
-        AddMetadata = FALSE;
-        memset(&PacketMetadata, 0, sizeof(DOT11_EXTSTA_RECV_CONTEXT));
+    // WaitForMultipleObjects is limited to MAXIMUM_WAIT_OBJECTS handles.
+    for (i = 0; i < NumWorkers; i++) {
+        WaitForSingleObject(Workers[i], INFINITE);
+        CloseHandle(Workers[i]);
+    }
 
-        AuxFragBufOffset = 0;
-        NumFramesConverted++;
-    } else {
-        AuxFragBufOffset += FragLength;
+    printf("Converted %u of %u files\n", Batch.NumFiles - Batch.NumFailed, Batch.NumFiles);
+    if (Batch.NumFailed > 0) {
+        Err = ERROR_GEN_FAILURE;
     }
+
+Done:
+    free(Batch.Files);
+    return Err;
+}
+
+// The --live conversion that Ctrl+C stops.
+struct CONVERSION* LiveConv;
+
+BOOL WINAPI LiveCtrlHandler(DWORD CtrlType)
+{
+    UNREFERENCED_PARAMETER(CtrlType);
+
+    Etl2PcapngStopLive(LiveConv);
+    return TRUE;
 }
 
 int __cdecl wmain(int argc, wchar_t** argv)
 {
     int Err;
-    EVENT_TRACE_LOGFILE LogFile;
-    TRACEHANDLE TraceHandle;
-    wchar_t* InFileName;
+    struct ETL2PCAPNG_OPTIONS Options;
+    struct CONVERSION* Conv;
+    wchar_t* FileNames[ETL2PCAPNG_MAX_INPUTS + 1]; // inputs, then the output
+    unsigned long NumFileNames = 0;
     wchar_t* OutFileName;
+    BOOLEAN StreamOutput;
+    BOOLEAN Batch = FALSE;
+    unsigned long Jobs = 0;
+    unsigned long IndexInterval = 0;
+    BOOLEAN Json = FALSE;
+    int i;
 
     if (argc == 2 &&
         (!wcscmp(argv[1], L"-v") ||
@@ -485,67 +445,266 @@ int __cdecl wmain(int argc, wchar_t** argv)
         return 0;
     }
 
-    if (argc != 3) {
-        printf(USAGE);
-        return ERROR_INVALID_PARAMETER;
-    }
-    InFileName = argv[1];
-    OutFileName = argv[2];
+    Etl2PcapngDefaultOptions(&Options);
 
-    OutFile = CreateFile(OutFileName, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
-                         FILE_ATTRIBUTE_NORMAL, NULL);
-    if (OutFile == INVALID_HANDLE_VALUE) {
-        Err = GetLastError();
-        printf("CreateFile called on %ws failed with %u\n", OutFileName, Err);
-        if (Err == ERROR_SHARING_VIOLATION) {
-            printf("The file appears to be open already.\n");
+    for (i = 1; i < argc; i++) {
+        if (!wcscmp(argv[i], L"--write-buffer")) {
+            if (++i == argc || !ParseSize(argv[i], &Options.WriteBufferSize)) {
+                printf(USAGE);
+                return ERROR_INVALID_PARAMETER;
+            }
+        } else if (!wcscmp(argv[i], L"--sort-interfaces")) {
+            Options.SortInterfaces = TRUE;
+        } else if (!wcscmp(argv[i], L"--metadata")) {
+            if (++i == argc) {
+                printf(USAGE);
+                return ERROR_INVALID_PARAMETER;
+            } else if (!wcscmp(argv[i], L"comment")) {
+                Options.MetadataFormat = ETL2PCAPNG_METADATA_COMMENT;
+            } else if (!wcscmp(argv[i], L"custom")) {
+                Options.MetadataFormat = ETL2PCAPNG_METADATA_CUSTOM;
+            } else if (!wcscmp(argv[i], L"radiotap")) {
+                Options.MetadataFormat = ETL2PCAPNG_METADATA_RADIOTAP;
+            } else {
+                printf(USAGE);
+                return ERROR_INVALID_PARAMETER;
+            }
+        } else if (!wcscmp(argv[i], L"--dedup")) {
+            if (++i == argc) {
+                printf(USAGE);
+                return ERROR_INVALID_PARAMETER;
+            } else if (!wcscmp(argv[i], L"miniport")) {
+                Options.Dedup = ETL2PCAPNG_DEDUP_MINIPORT;
+            } else if (!wcscmp(argv[i], L"top")) {
+                Options.Dedup = ETL2PCAPNG_DEDUP_TOP;
+            } else {
+                printf(USAGE);
+                return ERROR_INVALID_PARAMETER;
+            }
+        } else if (!wcscmp(argv[i], L"--scan")) {
+            Options.Scan = ETL2PCAPNG_SCAN_TEXT;
+        } else if (!wcscmp(argv[i], L"--json")) {
+            Json = TRUE;
+        } else if (!wcscmp(argv[i], L"--stats")) {
+            Options.ReportStats = TRUE;
+        } else if (!wcscmp(argv[i], L"--progress")) {
+            Options.ReportProgress = TRUE;
+        } else if (!wcscmp(argv[i], L"--max-packets")) {
+            if (++i == argc || !ParseUlong(argv[i], &Options.MaxPackets) || Options.MaxPackets == 0) {
+                printf(USAGE);
+                return ERROR_INVALID_PARAMETER;
+            }
+        } else if (!wcscmp(argv[i], L"--max-bytes")) {
+            if (++i == argc || !ParseSize64(argv[i], &Options.MaxBytes) || Options.MaxBytes == 0) {
+                printf(USAGE);
+                return ERROR_INVALID_PARAMETER;
+            }
+        } else if (!wcscmp(argv[i], L"--direct")) {
+            Options.Direct = TRUE;
+        } else if (!wcscmp(argv[i], L"--pipeline")) {
+            Options.Pipeline = TRUE;
+        } else if (!wcscmp(argv[i], L"--live")) {
+            Options.Live = TRUE;
+        } else if (!wcscmp(argv[i], L"--batch")) {
+            Batch = TRUE;
+        } else if (!wcscmp(argv[i], L"--jobs")) {
+            if (++i == argc || !ParseUlong(argv[i], &Jobs) || Jobs == 0) {
+                printf(USAGE);
+                return ERROR_INVALID_PARAMETER;
+            }
+        } else if (!wcscmp(argv[i], L"--parallel")) {
+            if (++i == argc || !ParseUlong(argv[i], &Options.ParallelRanges) ||
+                Options.ParallelRanges == 0 || Options.ParallelRanges > ETL2PCAPNG_MAX_PARALLEL_RANGES) {
+                printf(USAGE);
+                return ERROR_INVALID_PARAMETER;
+            }
+        } else if (!wcscmp(argv[i], L"--overlapped")) {
+            Options.Overlapped = TRUE;
+        } else if (!wcscmp(argv[i], L"--no-buffering")) {
+            Options.Overlapped = TRUE;
+            Options.NoBuffering = TRUE;
+        } else if (!wcscmp(argv[i], L"--compress")) {
+            if (++i == argc || wcscmp(argv[i], L"gzip")) {
+                printf(USAGE);
+                return ERROR_INVALID_PARAMETER;
+            }
+            Options.Compress = TRUE;
+        } else if (!wcscmp(argv[i], L"--compress-level")) {
+            if (++i == argc || !ParseUlong(argv[i], &Options.CompressLevel) ||
+                Options.CompressLevel < GZIP_MIN_LEVEL || Options.CompressLevel > GZIP_MAX_LEVEL) {
+                printf(USAGE);
+                return ERROR_INVALID_PARAMETER;
+            }
+        } else if (!wcscmp(argv[i], L"--snaplen")) {
+            if (++i == argc || !ParseUlong(argv[i], &Options.SnapLen) || Options.SnapLen == 0) {
+                printf(USAGE);
+                return ERROR_INVALID_PARAMETER;
+            }
+        } else if (!wcscmp(argv[i], L"--if-names")) {
+            Options.ResolveNames = TRUE;
+        } else if (!wcscmp(argv[i], L"--if-stats")) {
+            Options.WriteStatsBlocks = TRUE;
+        } else if (!wcscmp(argv[i], L"--tsresol")) {
+            if (++i == argc) {
+                printf(USAGE);
+                return ERROR_INVALID_PARAMETER;
+            }
+            if (!wcscmp(argv[i], L"us")) {
+                Options.TsResol = ETL2PCAPNG_TSRESOL_USEC;
+            } else if (!wcscmp(argv[i], L"100ns")) {
+                Options.TsResol = ETL2PCAPNG_TSRESOL_100NS;
+            } else {
+                printf(USAGE);
+                return ERROR_INVALID_PARAMETER;
+            }
+        } else if (!wcscmp(argv[i], L"--tsoffset")) {
+            Options.TsOffset = TRUE;
+        } else if (!wcscmp(argv[i], L"--split-size")) {
+            if (++i == argc || !ParseSize(argv[i], &Options.SplitSize) || Options.SplitSize == 0) {
+                printf(USAGE);
+                return ERROR_INVALID_PARAMETER;
+            }
+        } else if (!wcscmp(argv[i], L"--split-seconds")) {
+            if (++i == argc || !ParseUlong(argv[i], &Options.SplitSeconds) || Options.SplitSeconds == 0) {
+                printf(USAGE);
+                return ERROR_INVALID_PARAMETER;
+            }
+        } else if (!wcscmp(argv[i], L"--index")) {
+            if (Options.IndexInterval == 0) {
+                Options.IndexInterval = ETL2PCAPNG_INDEX_DEFAULT_INTERVAL;
+            }
+        } else if (!wcscmp(argv[i], L"--index-interval")) {
+            if (++i == argc || !ParseUlong(argv[i], &IndexInterval) || IndexInterval == 0) {
+                printf(USAGE);
+                return ERROR_INVALID_PARAMETER;
+            }
+        } else if (!wcscmp(argv[i], L"--ifindex")) {
+            if (++i == argc || Options.Filter.NumIfIndex == ETL2PCAPNG_FILTER_MAX_IFINDEX ||
+                !ParseUlong(argv[i], &Options.Filter.IfIndex[Options.Filter.NumIfIndex])) {
+                printf(USAGE);
+                return ERROR_INVALID_PARAMETER;
+            }
+            Options.Filter.NumIfIndex++;
+        } else if (!wcscmp(argv[i], L"--direction")) {
+            if (++i == argc) {
+                printf(USAGE);
+                return ERROR_INVALID_PARAMETER;
+            } else if (!wcscmp(argv[i], L"send")) {
+                Options.Filter.Direction = ETL2PCAPNG_DIRECTION_SEND;
+            } else if (!wcscmp(argv[i], L"recv")) {
+                Options.Filter.Direction = ETL2PCAPNG_DIRECTION_RECV;
+            } else {
+                printf(USAGE);
+                return ERROR_INVALID_PARAMETER;
+            }
+        } else if (!wcscmp(argv[i], L"--pid")) {
+            if (++i == argc || !ParseUlong(argv[i], &Options.Filter.Pid)) {
+                printf(USAGE);
+                return ERROR_INVALID_PARAMETER;
+            }
+            Options.Filter.MatchPid = TRUE;
+        } else if (!wcscmp(argv[i], L"--start")) {
+            if (++i == argc || !ParseTime(argv[i], &Options.Filter.Start)) {
+                printf(USAGE);
+                return ERROR_INVALID_PARAMETER;
+            }
+        } else if (!wcscmp(argv[i], L"--end")) {
+            if (++i == argc || !ParseTime(argv[i], &Options.Filter.End)) {
+                printf(USAGE);
+                return ERROR_INVALID_PARAMETER;
+            }
+        } else if (NumFileNames < RTL_NUMBER_OF(FileNames)) {
+            FileNames[NumFileNames++] = argv[i];
+        } else {
+            printf(USAGE);
+            return ERROR_INVALID_PARAMETER;
         }
-        goto Done;
     }
 
-    Err = PcapNgWriteSectionHeader(OutFile);
-    if (Err != NO_ERROR) {
-        goto Done;
+    if (IndexInterval != 0) {
+        if (Options.IndexInterval == 0) {
+            printf(USAGE);
+            return ERROR_INVALID_PARAMETER;
+        }
+        Options.IndexInterval = IndexInterval;
     }
 
-    ZeroMemory(&LogFile, sizeof(LogFile));
-    LogFile.LogFileName = InFileName;
-    LogFile.ProcessTraceMode = PROCESS_TRACE_MODE_EVENT_RECORD;
-    LogFile.EventRecordCallback = EventCallback;
-    LogFile.Context = NULL;
+    if (Json) {
+        // Nothing but the JSON object goes to stdout.
+        if (Options.Scan == ETL2PCAPNG_SCAN_NONE) {
+            printf(USAGE);
+            return ERROR_INVALID_PARAMETER;
+        }
+        Options.Scan = ETL2PCAPNG_SCAN_JSON;
+        Options.Quiet = TRUE;
+    }
 
-    TraceHandle = OpenTrace(&LogFile);
-    if (TraceHandle == INVALID_PROCESSTRACE_HANDLE) {
-        Err = GetLastError();
-        printf("OpenTrace failed with %u\n", Err);
-        goto Done;
+    if (Options.Scan != ETL2PCAPNG_SCAN_NONE) {
+        // All the file names are inputs, and there is no output.
+        if (Batch || Jobs != 0 || NumFileNames == 0 || NumFileNames > ETL2PCAPNG_MAX_INPUTS ||
+            Etl2PcapngCheckOptions(&Options, NULL) != NO_ERROR) {
+            printf(USAGE);
+            return ERROR_INVALID_PARAMETER;
+        }
+        Err = Etl2PcapngOpenFiles(&Options, FileNames, NumFileNames, NULL, &Conv);
+        if (Err != NO_ERROR) {
+            return Err;
+        }
+        Err = Etl2PcapngConvert(Conv);
+        Etl2PcapngFree(Conv);
+        return Err;
     }
 
-    // Read the ETL file twice.
-    // Pass1: Gather interface information.
-    // Pass2: Convert packet traces.
+    if (Options.Live) {
+        // A single output, with a NULL input for the real-time session.
+        if (NumFileNames != 1) {
+            printf(USAGE);
+            return ERROR_INVALID_PARAMETER;
+        }
+        FileNames[1] = FileNames[0];
+        FileNames[0] = NULL;
+        NumFileNames = 2;
+    }
 
-    Err = ProcessTrace(&TraceHandle, 1, 0, 0);
-    if (Err != NO_ERROR) {
-        printf("ProcessTrace failed with %u\n", Err);
-        goto Done;
+    if (NumFileNames < 2) {
+        printf(USAGE);
+        return ERROR_INVALID_PARAMETER;
     }
+    OutFileName = FileNames[NumFileNames - 1];
+    StreamOutput = Etl2PcapngIsStreamOutput(OutFileName);
 
-    WriteInterfaces();
+    if (Etl2PcapngCheckOptions(&Options, OutFileName) != NO_ERROR) {
+        printf(USAGE);
+        return ERROR_INVALID_PARAMETER;
+    }
 
-    Pass2 = TRUE;
+    if (Batch) {
+        // Each output is a file in the output directory.
+        if (Options.Live || NumFileNames != 2 || StreamOutput) {
+            printf(USAGE);
+            return ERROR_INVALID_PARAMETER;
+        }
+        return ConvertBatch(&Options, FileNames[0], OutFileName, Jobs);
+    } else if (Jobs != 0) {
+        printf(USAGE);
+        return ERROR_INVALID_PARAMETER;
+    }
 
-    Err = ProcessTrace(&TraceHandle, 1, 0, 0);
+    Err = Etl2PcapngOpenFiles(&Options, FileNames, NumFileNames - 1, OutFileName, &Conv);
     if (Err != NO_ERROR) {
-        printf("ProcessTrace failed with %u\n", Err);
-        goto Done;
+        return Err;
     }
-
-    printf("Converted %llu frames\n", NumFramesConverted);
-
-Done:
-    if (OutFile != INVALID_HANDLE_VALUE) {
-        CloseHandle(OutFile);
+    if (Options.Live) {
+        // Etl2PcapngConvert finishes the output once the session is gone.
+        LiveConv = Conv;
+        SetConsoleCtrlHandler(LiveCtrlHandler, TRUE);
+        // On stderr: with "-" stdout is still the output at this point.
+        fprintf(stderr, "Press Ctrl+C to stop\n");
+    }
+    Err = Etl2PcapngConvert(Conv);
+    if (Options.Live) {
+        SetConsoleCtrlHandler(LiveCtrlHandler, FALSE);
     }
+    Etl2PcapngFree(Conv);
     return Err;
 }